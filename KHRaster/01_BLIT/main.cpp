@@ -8,7 +8,7 @@
 #include <Common/Shaders.h>
 #include <Common/Rasterizer.h>
 #include <Common/RasterSurface.h>
-#include <Common/XTime.h>
+#include <Common/FrameScheduler.h>
 
 #include "tiles_12.h"
 #include "teleporter_hit.h"
@@ -42,25 +42,28 @@ int main(int argc, char **argv)
 	srand(time(NULL));
 
 	Texture2D<UINT> Surface(Width, Height), CopySurface(Width, Height);
+	// the headers are BGRA8, uploading converts them once
+	Texture2D<UINT> Tiles(tiles_12_width, tiles_12_height, 1, nullptr, tiles_12_pixels, BGRA8);
+	Texture2D<UINT> TeleporterHit(teleporter_hit_width, teleporter_hit_height, 1, nullptr, teleporter_hit_pixels, BGRA8);
 
 	// grass
 	for (int y = 0; y < Height; y += 32)
 	{
 		for (int x = 0; x < Width; x += 32)
 		{
-			Surface.BLIT(tiles_12_pixels, tiles_12_width, GrassBlock, x, y);
+			Surface.BLIT(Tiles, GrassBlock, x, y);
 		}
 	}
 
-	Surface.BLIT(tiles_12_pixels, tiles_12_width, House, rand() % (Width + 1 - 95), rand() % (Height + 1 - 82));
-	Surface.BLIT(tiles_12_pixels, tiles_12_width, House, rand() % (Width + 1 - 95), rand() % (Height + 1 - 82));
-	Surface.BLIT(tiles_12_pixels, tiles_12_width, RedHouse, rand() % (Width + 1 - 63), rand() % (Height + 1 - 66));
-	Surface.BLIT(tiles_12_pixels, tiles_12_width, MailBox, rand() % (Width + 1 - 15), rand() % (Height + 1 - 23));
-	Surface.BLIT(tiles_12_pixels, tiles_12_width, GreenHouse, rand() % (Width + 1 - 95), rand() % (Height + 1 - 64));
-	Surface.BLIT(tiles_12_pixels, tiles_12_width, Tree, rand() % (Width + 1 - 63), rand() % (Height + 1 - 79));
-	Surface.BLIT(tiles_12_pixels, tiles_12_width, Tree, rand() % (Width + 1 - 63), rand() % (Height + 1 - 79));
-	Surface.BLIT(tiles_12_pixels, tiles_12_width, Park, rand() % (Width + 1 - 143), rand() % (Height + 1 - 71));
-	Surface.BLIT(tiles_12_pixels, tiles_12_width, Fence, rand() % (Width + 1 - 39), rand() % (Height + 1 - 47));
+	Surface.BLIT(Tiles, House, rand() % (Width + 1 - 95), rand() % (Height + 1 - 82));
+	Surface.BLIT(Tiles, House, rand() % (Width + 1 - 95), rand() % (Height + 1 - 82));
+	Surface.BLIT(Tiles, RedHouse, rand() % (Width + 1 - 63), rand() % (Height + 1 - 66));
+	Surface.BLIT(Tiles, MailBox, rand() % (Width + 1 - 15), rand() % (Height + 1 - 23));
+	Surface.BLIT(Tiles, GreenHouse, rand() % (Width + 1 - 95), rand() % (Height + 1 - 64));
+	Surface.BLIT(Tiles, Tree, rand() % (Width + 1 - 63), rand() % (Height + 1 - 79));
+	Surface.BLIT(Tiles, Tree, rand() % (Width + 1 - 63), rand() % (Height + 1 - 79));
+	Surface.BLIT(Tiles, Park, rand() % (Width + 1 - 143), rand() % (Height + 1 - 71));
+	Surface.BLIT(Tiles, Fence, rand() % (Width + 1 - 39), rand() % (Height + 1 - 47));
 
 	// place holder for the raster so we can use it for later
 	CopySurface = Surface;
@@ -68,25 +71,21 @@ int main(int argc, char **argv)
 	// cell locations
 	int x = 0;
 	int y = 0;
-	double ElapsedTime = 0.0;
-
-	XTime XTime;
-	XTime.Restart();
 
+	FrameScheduler Scheduler;
 	RS_Initialize(Width, Height);
-	do
+	while (RS_IsOpen())
 	{
-		XTime.Signal();
-		ElapsedTime += XTime.Delta();
-		if (ElapsedTime > (1.0 / 60.0))
-		{
-			ElapsedTime = 0.0;
+		// sleeps until the frame is due
+		Scheduler.WaitForFrame();
 
+		if (Scheduler.BeginFrame())
+		{
 			Surface = CopySurface;
 
 			// draw cells each frame
 			RECT Teleporter = {x, y, x + 128, y + 128};
-			Surface.BLIT(teleporter_hit_pixels, teleporter_hit_width, Teleporter, Width / 2, Height / 2);
+			Surface.BLIT(TeleporterHit, Teleporter, Width / 2, Height / 2);
 
 			x += 128;
 			if (x == 1024)
@@ -98,9 +97,14 @@ int main(int argc, char **argv)
 			{
 				y = 0;
 			}
+
+			RS_Update(Surface, Surface.NumPixels);
+			// the scene animates, on demand pacing needs the next frame as well
+			Scheduler.Invalidate();
+			Scheduler.EndFrame();
 		}
-	} while (RS_Update(Surface, Surface.NumPixels));
+	}
 	RS_Shutdown();
 
-	return Save(Surface, 3);
+	return Save(Surface, 3, argc > 1 ? argv[1] : nullptr);
 }
\ No newline at end of file
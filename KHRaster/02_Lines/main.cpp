@@ -6,7 +6,7 @@
 
 #include <Common/Defines.h>
 #include <Common/RasterSurface.h>
-#include <Common/XTime.h>
+#include <Common/FrameScheduler.h>
 
 struct Vector2D
 {
@@ -96,9 +96,13 @@ int main(int argc, char **argv)
 	float randEndX2 = 0.0f;
 	float randEndY2 = 0.0f;
 
+	FrameScheduler Scheduler;
 	RS_Initialize(Width, Height);
-	do
+	while (RS_IsOpen())
 	{
+		// sleeps until the frame is due
+		Scheduler.WaitForFrame();
+
 		if (GetAsyncKeyState('1') & 0x1)
 		{
 			Surface.Clear();
@@ -110,6 +114,7 @@ int main(int argc, char **argv)
 			rngBresenhamLine[0].position.y = randStartY;
 			rngBresenhamLine[1].position.x = randEndX;
 			rngBresenhamLine[1].position.y = randEndY;
+			Scheduler.Invalidate();
 		}
 		if (GetAsyncKeyState('2') & 0x1)
 		{
@@ -122,6 +127,7 @@ int main(int argc, char **argv)
 			rngMidpointLine[0].position.y = randStartY1;
 			rngMidpointLine[1].position.x = randEndX1;
 			rngMidpointLine[1].position.y = randEndY1;
+			Scheduler.Invalidate();
 		}
 		if (GetAsyncKeyState('3') & 0x1)
 		{
@@ -134,6 +140,7 @@ int main(int argc, char **argv)
 			rngParametrixLine[0].position.y = randStartY2;
 			rngParametrixLine[1].position.x = randEndX2;
 			rngParametrixLine[1].position.y = randEndY2;
+			Scheduler.Invalidate();
 		}
 		if (GetAsyncKeyState('4') & 0x1)
 		{
@@ -163,43 +170,50 @@ int main(int argc, char **argv)
 			randStartY2 = 0;
 			randEndX2 = 0;
 			randEndY2 = 0;
+			Scheduler.Invalidate();
 		}
-		if (!useOptimizedVersion)
+		if (Scheduler.BeginFrame())
 		{
-			DrawBresenhamLine(bresenhamLine[0], bresenhamLine[1], &Surface);
-			DrawMidpointLine(midpointLine[0], midpointLine[1], &Surface);
-			DrawParametrixLine(parametrixLine[0], parametrixLine[1], &Surface);
+			if (!useOptimizedVersion)
+			{
+				DrawBresenhamLine(bresenhamLine[0], bresenhamLine[1], &Surface);
+				DrawMidpointLine(midpointLine[0], midpointLine[1], &Surface);
+				DrawParametrixLine(parametrixLine[0], parametrixLine[1], &Surface);
 
-			DrawBresenhamLine(rngBresenhamLine[0], rngBresenhamLine[1], &Surface);
-			Surface.SetPixel(static_cast<int>(randStartX), static_cast<int>(randStartY), YELLOW);
-			Surface.SetPixel(static_cast<int>(randEndX), static_cast<int>(randEndY), YELLOW);
-			DrawMidpointLine(rngMidpointLine[0], rngMidpointLine[1], &Surface);
-			Surface.SetPixel(static_cast<int>(randStartX1), static_cast<int>(randStartY1), YELLOW);
-			Surface.SetPixel(static_cast<int>(randEndX1), static_cast<int>(randEndY1), YELLOW);
-			DrawParametrixLine(rngParametrixLine[0], rngParametrixLine[1], &Surface);
-			Surface.SetPixel(static_cast<int>(randStartX2), static_cast<int>(randStartY2), YELLOW);
-			Surface.SetPixel(static_cast<int>(randEndX2), static_cast<int>(randEndY2), YELLOW);
-		}
-		else
-		{
-			DrawBresenhamLineOptimized(bresenhamLine[0], bresenhamLine[1], &Surface);
-			DrawMidpointLineOptimized(midpointLine[0], midpointLine[1], &Surface);
-			DrawParametrixLineOptimized(parametrixLine[0], parametrixLine[1], &Surface);
+				DrawBresenhamLine(rngBresenhamLine[0], rngBresenhamLine[1], &Surface);
+				Surface.SetPixel(static_cast<int>(randStartX), static_cast<int>(randStartY), YELLOW);
+				Surface.SetPixel(static_cast<int>(randEndX), static_cast<int>(randEndY), YELLOW);
+				DrawMidpointLine(rngMidpointLine[0], rngMidpointLine[1], &Surface);
+				Surface.SetPixel(static_cast<int>(randStartX1), static_cast<int>(randStartY1), YELLOW);
+				Surface.SetPixel(static_cast<int>(randEndX1), static_cast<int>(randEndY1), YELLOW);
+				DrawParametrixLine(rngParametrixLine[0], rngParametrixLine[1], &Surface);
+				Surface.SetPixel(static_cast<int>(randStartX2), static_cast<int>(randStartY2), YELLOW);
+				Surface.SetPixel(static_cast<int>(randEndX2), static_cast<int>(randEndY2), YELLOW);
+			}
+			else
+			{
+				DrawBresenhamLineOptimized(bresenhamLine[0], bresenhamLine[1], &Surface);
+				DrawMidpointLineOptimized(midpointLine[0], midpointLine[1], &Surface);
+				DrawParametrixLineOptimized(parametrixLine[0], parametrixLine[1], &Surface);
 
-			DrawBresenhamLineOptimized(rngBresenhamLine[0], rngBresenhamLine[1], &Surface);
-			Surface.SetPixel(static_cast<int>(randStartX), static_cast<int>(randStartY), YELLOW);
-			Surface.SetPixel(static_cast<int>(randEndX), static_cast<int>(randEndY), YELLOW);
-			DrawMidpointLineOptimized(rngMidpointLine[0], rngMidpointLine[1], &Surface);
-			Surface.SetPixel(static_cast<int>(randStartX1), static_cast<int>(randStartY1), YELLOW);
-			Surface.SetPixel(static_cast<int>(randEndX1), static_cast<int>(randEndY1), YELLOW);
-			DrawParametrixLineOptimized(rngParametrixLine[0], rngParametrixLine[1], &Surface);
-			Surface.SetPixel(static_cast<int>(randStartX2), static_cast<int>(randStartY2), YELLOW);
-			Surface.SetPixel(static_cast<int>(randEndX2), static_cast<int>(randEndY2), YELLOW);
+				DrawBresenhamLineOptimized(rngBresenhamLine[0], rngBresenhamLine[1], &Surface);
+				Surface.SetPixel(static_cast<int>(randStartX), static_cast<int>(randStartY), YELLOW);
+				Surface.SetPixel(static_cast<int>(randEndX), static_cast<int>(randEndY), YELLOW);
+				DrawMidpointLineOptimized(rngMidpointLine[0], rngMidpointLine[1], &Surface);
+				Surface.SetPixel(static_cast<int>(randStartX1), static_cast<int>(randStartY1), YELLOW);
+				Surface.SetPixel(static_cast<int>(randEndX1), static_cast<int>(randEndY1), YELLOW);
+				DrawParametrixLineOptimized(rngParametrixLine[0], rngParametrixLine[1], &Surface);
+				Surface.SetPixel(static_cast<int>(randStartX2), static_cast<int>(randStartY2), YELLOW);
+				Surface.SetPixel(static_cast<int>(randEndX2), static_cast<int>(randEndY2), YELLOW);
+			}
+
+			RS_Update(Surface, Surface.NumPixels);
+			Scheduler.EndFrame();
 		}
-	} while (RS_Update(Surface, Surface.NumPixels));
+	}
 	RS_Shutdown();
 
-	return Save(Surface, 3);
+	return Save(Surface, 3, argc > 1 ? argv[1] : nullptr);
 }
 
 unsigned int ColorBlend(Vertex2D start, Vertex2D end, float ratio)
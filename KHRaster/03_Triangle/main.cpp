@@ -8,7 +8,7 @@
 #include <Common/Shaders.h>
 #include <Common/Rasterizer.h>
 #include <Common/RasterSurface.h>
-#include <Common/XTime.h>
+#include <Common/FrameScheduler.h>
 
 int main(int argc, char **argv)
 {
@@ -24,26 +24,46 @@ int main(int argc, char **argv)
 			{{-0.5f, 0.0f, 0.0f, 1.0f}, GREEN},
 			{{0.5f, 0.0f, 0.0f, 1.0f}, BLUE}};
 
-	XTime XTime;
-	XTime.Restart();
+	FrameScheduler Scheduler;
 	RS_Initialize(Width, Height);
-	do
+	while (RS_IsOpen())
 	{
-		XTime.Signal();
-
-		RenderTarget.Clear();
-		Rasterizer.VS = VertexShader;
-		Rasterizer.DrawParametricLine(vertices[0], vertices[1]);
-		Rasterizer.DrawParametricLine(vertices[1], vertices[2]);
-		Rasterizer.DrawParametricLine(vertices[2], vertices[0]);
-		Rasterizer.FillTriangleBetterBrute(vertices[0], vertices[1], vertices[2]);
-		RenderTarget.RT1.SetPixel(NDCXToRasterCoord(vertices[0].position.x, RenderTarget.Width), NDCYToRasterCoord(vertices[0].position.y, RenderTarget.Height), vertices[0].color);
-		RenderTarget.RT1.SetPixel(NDCXToRasterCoord(vertices[1].position.x, RenderTarget.Width), NDCYToRasterCoord(vertices[1].position.y, RenderTarget.Height), vertices[1].color);
-		RenderTarget.RT1.SetPixel(NDCXToRasterCoord(vertices[2].position.x, RenderTarget.Width), NDCYToRasterCoord(vertices[2].position.y, RenderTarget.Height), vertices[2].color);
-
-		angle++;
-	} while (RS_Update(RenderTarget.RT1, RenderTarget.NumPixels));
+		// sleeps until the frame is due
+		Scheduler.WaitForFrame();
+
+		if (Scheduler.BeginFrame())
+		{
+			// frames are rendered straight into the back buffers of the surface
+			UINT *pBackBuffer = RS_AcquireBackBuffer();
+			if (!pBackBuffer)
+			{
+				break;
+			}
+			RenderTarget.SetBackBuffer(pBackBuffer);
+			RenderTarget.Clear();
+			Rasterizer.VS = VertexShader;
+			Rasterizer.DrawParametricLine(vertices[0], vertices[1]);
+			Rasterizer.DrawParametricLine(vertices[1], vertices[2]);
+			Rasterizer.DrawParametricLine(vertices[2], vertices[0]);
+			Rasterizer.FillTriangle(vertices[0], vertices[1], vertices[2]);
+			for (const Vertex &V : vertices)
+			{
+				Vec4 Position = V.position;
+				NDCToRaster(Position, RenderTarget.Width, RenderTarget.Height);
+				RenderTarget.RT1.SetPixel(UINT(Position.x), UINT(Position.y), V.color);
+			}
+
+			angle++;
+
+			RS_Present();
+			// the scene animates, on demand pacing needs the next frame as well
+			Scheduler.Invalidate();
+			Scheduler.EndFrame();
+		}
+	}
+	// RT1 is a back buffer, save it before the surface releases them
+	int Result = Save(RenderTarget.RT1, 3, argc > 1 ? argv[1] : nullptr);
 	RS_Shutdown();
 
-	return Save(RenderTarget.RT1, 3);
+	return Result;
 }
\ No newline at end of file
@@ -8,7 +8,7 @@
 #include <Common/Shaders.h>
 #include <Common/Rasterizer.h>
 #include <Common/RasterSurface.h>
-#include <Common/XTime.h>
+#include <Common/FrameScheduler.h>
 
 int main(int argc, char **argv)
 {
@@ -108,18 +108,37 @@ int main(int argc, char **argv)
 	Camera.FOV = 90.0f;
 	Camera.AspectRatio = (float)Width / (float)Height;
 
-	XTime XTime;
-	XTime.Restart();
-	double ElapsedTime = 0.0;
+	FrameScheduler Scheduler;
 	RS_Initialize(Width, Height);
-	do
+	while (RS_IsOpen())
 	{
-		XTime.Signal();
-		ElapsedTime += XTime.Delta();
-		if (ElapsedTime > (1.0 / 60.0))
-		{
-			ElapsedTime = 0.0;
+		// sleeps until the frame is due
+		Scheduler.WaitForFrame();
 
+		if (GetAsyncKeyState('1') & 0x1)
+		{
+			Camera.FOV += 2.0f;
+			Scheduler.Invalidate();
+		}
+		if (GetAsyncKeyState('2') & 0x1)
+		{
+			Camera.FOV -= 2.0f;
+			Scheduler.Invalidate();
+		}
+		if (GetAsyncKeyState('3') & 0x1)
+		{
+			Camera.FOV = 90.0f;
+			Scheduler.Invalidate();
+		}
+		if (Scheduler.BeginFrame())
+		{
+			// frames are rendered straight into the back buffers of the surface
+			UINT *pBackBuffer = RS_AcquireBackBuffer();
+			if (!pBackBuffer)
+			{
+				break;
+			}
+			RenderTarget.SetBackBuffer(pBackBuffer);
 			RenderTarget.Clear();
 
 			ConstantBuffer.World = gridMatrix;
@@ -178,21 +197,16 @@ int main(int argc, char **argv)
 			cube1Matrix = Matrix_Matrix_Multiply(cube1Matrix, cubeMatrix);
 			cube1Matrix = Matrix_Matrix_Multiply(cube1Matrix, Matrix_Create_Rotation_Y(angle));
 			// Shrubbery 2
-			if (GetAsyncKeyState('1') & 0x1)
-			{
-				Camera.FOV += 2.0f;
-			}
-			if (GetAsyncKeyState('2') & 0x1)
-			{
-				Camera.FOV -= 2.0f;
-			}
-			if (GetAsyncKeyState('3') & 0x1)
-			{
-				Camera.FOV = 90.0f;
-			}
+
+			RS_Present();
+			// the scene animates, on demand pacing needs the next frame as well
+			Scheduler.Invalidate();
+			Scheduler.EndFrame();
 		}
-	} while (RS_Update(RenderTarget.RT1, RenderTarget.NumPixels));
+	}
+	// RT1 is a back buffer, save it before the surface releases them
+	int Result = Save(RenderTarget.RT1, 3, argc > 1 ? argv[1] : nullptr);
 	RS_Shutdown();
 
-	return Save(RenderTarget.RT1, 3);
+	return Result;
 }
\ No newline at end of file
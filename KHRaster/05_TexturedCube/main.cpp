@@ -8,7 +8,7 @@
 #include <Common/Shaders.h>
 #include <Common/Rasterizer.h>
 #include <Common/RasterSurface.h>
-#include <Common/XTime.h>
+#include <Common/FrameScheduler.h>
 
 // Texture data
 #include "celestial.h"
@@ -19,7 +19,8 @@ enum RENDER_OPTIONS
 	WireframedCube,
 	ColoredCube_NoDepth,
 	ColoredCube_Depth,
-	TexturedCube
+	TexturedCube,
+	CompressedCube
 };
 
 int main(int argc, char **argv)
@@ -29,6 +30,7 @@ int main(int argc, char **argv)
 	std::cout << "2: Colored cube: DepthEnable = false\n";
 	std::cout << "3: Colored cube: DepthEnable = true\n";
 	std::cout << "4: Textured cube\n";
+	std::cout << "5: Textured cube: BC1/BC3 compressed textures\n";
 
 	const UINT64 Width = 500;
 	const UINT64 Height = 500;
@@ -36,8 +38,14 @@ int main(int argc, char **argv)
 	RenderTarget RenderTarget(Width, Height);
 	Rasterizer Rasterizer(&RenderTarget);
 
-	Texture2D<UINT> celestial(celestial_width, celestial_height, celestial_numlevels, celestial_leveloffsets, celestial_pixels);
-	Texture2D<UINT> CatMarioModel(CatMarioModel_Death_width, CatMarioModel_Death_height, CatMarioModel_Death_numlevels, CatMarioModel_Death_leveloffsets, CatMarioModel_Death_pixels);
+	Texture2D<UINT> celestial(celestial_width, celestial_height, celestial_numlevels, celestial_leveloffsets, celestial_pixels, BGRA8, Tiled4x4);
+	Texture2D<UINT> CatMarioModel(CatMarioModel_Death_width, CatMarioModel_Death_height, CatMarioModel_Death_numlevels, CatMarioModel_Death_leveloffsets, CatMarioModel_Death_pixels, BGRA8, Tiled4x4);
+
+	// celestial is opaque and fits BC1, the cut out of CatMarioModel needs the alpha of BC3
+	Texture2D<UINT> celestialBC1(celestial_width, celestial_height, celestial_numlevels, celestial_leveloffsets, celestial_pixels, BGRA8, Tiled4x4);
+	Texture2D<UINT> CatMarioModelBC3(CatMarioModel_Death_width, CatMarioModel_Death_height, CatMarioModel_Death_numlevels, CatMarioModel_Death_leveloffsets, CatMarioModel_Death_pixels, BGRA8, Tiled4x4);
+	celestialBC1.Compress(BC1);
+	CatMarioModelBC3.Compress(BC3);
 
 	unsigned int cubeColor = GREEN;
 
@@ -101,19 +109,47 @@ int main(int argc, char **argv)
 
 	RENDER_OPTIONS Option = WireframedCube;
 
-	XTime XTime;
-	XTime.Restart();
+	FrameScheduler Scheduler;
 	RS_Initialize(Width, Height);
-	double ElapsedTime = 0.0;
-	double FPS = 1.0 / 60.0;
-	do
+	while (RS_IsOpen())
 	{
-		XTime.Signal();
-		ElapsedTime += XTime.Delta();
-		if (ElapsedTime > FPS)
-		{
-			ElapsedTime = 0;
+		// sleeps until the frame is due
+		Scheduler.WaitForFrame();
 
+		if (GetAsyncKeyState('1') & 0x1)
+		{
+			Option = WireframedCube;
+			Scheduler.Invalidate();
+		}
+		if (GetAsyncKeyState('2') & 0x1)
+		{
+			Option = ColoredCube_NoDepth;
+			Scheduler.Invalidate();
+		}
+		if (GetAsyncKeyState('3') & 0x1)
+		{
+			Option = ColoredCube_Depth;
+			Scheduler.Invalidate();
+		}
+		if (GetAsyncKeyState('4') & 0x1)
+		{
+			Option = TexturedCube;
+			Scheduler.Invalidate();
+		}
+		if (GetAsyncKeyState('5') & 0x1)
+		{
+			Option = CompressedCube;
+			Scheduler.Invalidate();
+		}
+		if (Scheduler.BeginFrame())
+		{
+			// frames are rendered straight into the back buffers of the surface
+			UINT *pBackBuffer = RS_AcquireBackBuffer();
+			if (!pBackBuffer)
+			{
+				break;
+			}
+			RenderTarget.SetBackBuffer(pBackBuffer);
 			RenderTarget.Clear();
 
 			ConstantBuffer.World = gridMatrix;
@@ -150,20 +186,20 @@ int main(int argc, char **argv)
 				ConstantBuffer.World = cubeMatrix;
 				// front face
 				Rasterizer.PS = PS_Red;
-				Rasterizer.FillTriangleBetterBrute(cube[0], cube[1], cube[2]);
-				Rasterizer.FillTriangleBetterBrute(cube[3], cube[1], cube[2]);
+				Rasterizer.FillTriangle(cube[0], cube[1], cube[2]);
+				Rasterizer.FillTriangle(cube[3], cube[1], cube[2]);
 				// left face
 				Rasterizer.PS = PS_Green;
-				Rasterizer.FillTriangleBetterBrute(cube[4], cube[0], cube[6]);
-				Rasterizer.FillTriangleBetterBrute(cube[2], cube[0], cube[6]);
+				Rasterizer.FillTriangle(cube[4], cube[0], cube[6]);
+				Rasterizer.FillTriangle(cube[2], cube[0], cube[6]);
 				// right face
 				Rasterizer.PS = PS_Blue;
-				Rasterizer.FillTriangleBetterBrute(cube[1], cube[3], cube[5]);
-				Rasterizer.FillTriangleBetterBrute(cube[7], cube[3], cube[5]);
+				Rasterizer.FillTriangle(cube[1], cube[3], cube[5]);
+				Rasterizer.FillTriangle(cube[7], cube[3], cube[5]);
 				// back face
 				Rasterizer.PS = PS_Purple;
-				Rasterizer.FillTriangleBetterBrute(cube[4], cube[5], cube[6]);
-				Rasterizer.FillTriangleBetterBrute(cube[7], cube[5], cube[6]);
+				Rasterizer.FillTriangle(cube[4], cube[5], cube[6]);
+				Rasterizer.FillTriangle(cube[7], cube[5], cube[6]);
 			}
 			if (Option == ColoredCube_Depth)
 			{
@@ -171,72 +207,56 @@ int main(int argc, char **argv)
 				ConstantBuffer.World = cubeMatrix;
 				// front face
 				Rasterizer.PS = PS_Red;
-				Rasterizer.FillTriangleBetterBrute(cube[0], cube[1], cube[2]);
-				Rasterizer.FillTriangleBetterBrute(cube[3], cube[1], cube[2]);
+				Rasterizer.FillTriangle(cube[0], cube[1], cube[2]);
+				Rasterizer.FillTriangle(cube[3], cube[1], cube[2]);
 				// left face
 				Rasterizer.PS = PS_Green;
-				Rasterizer.FillTriangleBetterBrute(cube[4], cube[0], cube[6]);
-				Rasterizer.FillTriangleBetterBrute(cube[2], cube[0], cube[6]);
+				Rasterizer.FillTriangle(cube[4], cube[0], cube[6]);
+				Rasterizer.FillTriangle(cube[2], cube[0], cube[6]);
 				// right face
 				Rasterizer.PS = PS_Blue;
-				Rasterizer.FillTriangleBetterBrute(cube[1], cube[3], cube[5]);
-				Rasterizer.FillTriangleBetterBrute(cube[7], cube[3], cube[5]);
+				Rasterizer.FillTriangle(cube[1], cube[3], cube[5]);
+				Rasterizer.FillTriangle(cube[7], cube[3], cube[5]);
 				// back face
 				Rasterizer.PS = PS_Purple;
-				Rasterizer.FillTriangleBetterBrute(cube[4], cube[5], cube[6]);
-				Rasterizer.FillTriangleBetterBrute(cube[7], cube[5], cube[6]);
+				Rasterizer.FillTriangle(cube[4], cube[5], cube[6]);
+				Rasterizer.FillTriangle(cube[7], cube[5], cube[6]);
 			}
-			if (Option == TexturedCube)
+			if (Option == TexturedCube || Option == CompressedCube)
 			{
 				RenderTarget.DepthEnable = true;
 				ConstantBuffer.World = cubeMatrix;
-				ConstantBuffer.pTexture = &celestial;
+				ConstantBuffer.pTexture = Option == CompressedCube ? &celestialBC1 : &celestial;
 
 				Rasterizer.PS = PS_Texture;
 				// front face
-				Rasterizer.FillTriangleBetterBrute(cube[0], cube[1], cube[2]);
-				Rasterizer.FillTriangleBetterBrute(cube[3], cube[1], cube[2]);
+				Rasterizer.FillTriangle(cube[0], cube[1], cube[2]);
+				Rasterizer.FillTriangle(cube[3], cube[1], cube[2]);
 				// left face
-				Rasterizer.FillTriangleBetterBrute(cube[8], cube[9], cube[10]);
-				Rasterizer.FillTriangleBetterBrute(cube[11], cube[9], cube[10]);
+				Rasterizer.FillTriangle(cube[8], cube[9], cube[10]);
+				Rasterizer.FillTriangle(cube[11], cube[9], cube[10]);
 				// right face
-				Rasterizer.FillTriangleBetterBrute(cube[12], cube[13], cube[14]);
-				Rasterizer.FillTriangleBetterBrute(cube[15], cube[13], cube[14]);
+				Rasterizer.FillTriangle(cube[12], cube[13], cube[14]);
+				Rasterizer.FillTriangle(cube[15], cube[13], cube[14]);
 				// back face
-				Rasterizer.FillTriangleBetterBrute(cube[5], cube[4], cube[7]);
-				Rasterizer.FillTriangleBetterBrute(cube[6], cube[4], cube[7]);
+				Rasterizer.FillTriangle(cube[5], cube[4], cube[7]);
+				Rasterizer.FillTriangle(cube[6], cube[4], cube[7]);
 
 				ConstantBuffer.World = cube1Matrix;
-				ConstantBuffer.pTexture = &CatMarioModel;
+				ConstantBuffer.pTexture = Option == CompressedCube ? &CatMarioModelBC3 : &CatMarioModel;
 
 				// front face
-				Rasterizer.FillTriangleBetterBrute(cube1[0], cube1[1], cube1[2]);
-				Rasterizer.FillTriangleBetterBrute(cube1[3], cube1[1], cube1[2]);
+				Rasterizer.FillTriangle(cube1[0], cube1[1], cube1[2]);
+				Rasterizer.FillTriangle(cube1[3], cube1[1], cube1[2]);
 				// left face
-				Rasterizer.FillTriangleBetterBrute(cube1[8], cube1[9], cube1[10]);
-				Rasterizer.FillTriangleBetterBrute(cube1[11], cube1[9], cube1[10]);
+				Rasterizer.FillTriangle(cube1[8], cube1[9], cube1[10]);
+				Rasterizer.FillTriangle(cube1[11], cube1[9], cube1[10]);
 				// right face
-				Rasterizer.FillTriangleBetterBrute(cube1[12], cube1[13], cube1[14]);
-				Rasterizer.FillTriangleBetterBrute(cube1[15], cube1[13], cube1[14]);
+				Rasterizer.FillTriangle(cube1[12], cube1[13], cube1[14]);
+				Rasterizer.FillTriangle(cube1[15], cube1[13], cube1[14]);
 				// back face
-				Rasterizer.FillTriangleBetterBrute(cube1[5], cube1[4], cube1[7]);
-				Rasterizer.FillTriangleBetterBrute(cube1[6], cube1[4], cube1[7]);
-			}
-			if (GetAsyncKeyState('1') & 0x1)
-			{
-				Option = WireframedCube;
-			}
-			if (GetAsyncKeyState('2') & 0x1)
-			{
-				Option = ColoredCube_NoDepth;
-			}
-			if (GetAsyncKeyState('3') & 0x1)
-			{
-				Option = ColoredCube_Depth;
-			}
-			if (GetAsyncKeyState('4') & 0x1)
-			{
-				Option = TexturedCube;
+				Rasterizer.FillTriangle(cube1[5], cube1[4], cube1[7]);
+				Rasterizer.FillTriangle(cube1[6], cube1[4], cube1[7]);
 			}
 
 			angle++;
@@ -249,9 +269,16 @@ int main(int argc, char **argv)
 
 			Rasterizer.VS = nullptr;
 			Rasterizer.PS = nullptr;
+
+			RS_Present();
+			// the scene animates, on demand pacing needs the next frame as well
+			Scheduler.Invalidate();
+			Scheduler.EndFrame();
 		}
-	} while (RS_Update(RenderTarget.RT1, RenderTarget.RT1.NumPixels));
+	}
+	// RT1 is a back buffer, save it before the surface releases them
+	int Result = Save(RenderTarget.RT1, 3, argc > 1 ? argv[1] : nullptr);
 	RS_Shutdown();
 
-	return Save(RenderTarget.RT1, 3);
+	return Result;
 }
\ No newline at end of file
@@ -3,12 +3,13 @@
 #include <memory>
 #include <cassert>
 #include <iostream>
+#include <thread>
 
 #include <Common/Defines.h>
 #include <Common/Shaders.h>
 #include <Common/Rasterizer.h>
 #include <Common/RasterSurface.h>
-#include <Common/XTime.h>
+#include <Common/FrameScheduler.h>
 
 // Geometry and texture data
 #include "StoneHenge.h"
@@ -24,13 +25,33 @@ Vertex vertices[1457];
 
 int main(int argc, char **argv)
 {
+	std::cout << "Controls\n";
+	std::cout << "W/A/S/D: rotate the camera\n";
+	std::cout << "R: reset the camera\n";
+	std::cout << "M: toggle 4x MSAA\n";
+	std::cout << "V: toggle the visibility buffer, multisampled targets don't use it\n";
+
 	const UINT64 Width = 500;
 	const UINT64 Height = 500;
 
-	RenderTarget RenderTarget(Width, Height);
-	Rasterizer Rasterizer(&RenderTarget);
-
-	Texture2D<UINT> stoneHenge(StoneHenge_width, StoneHenge_height, StoneHenge_numlevels, StoneHenge_leveloffsets, StoneHenge_pixels);
+	// M recreates the target with the other sample count, the rasterizer keeps the visibility buffer setting
+	UINT sampleCount = 4;
+	BOOL visibilityBuffer = FALSE;
+	std::unique_ptr<RenderTarget> pRenderTarget;
+	std::unique_ptr<Rasterizer> pRasterizer;
+	auto CreateTarget = [&]()
+	{
+		// the rasterizer refers to the target, release it first
+		pRasterizer.reset();
+		pRenderTarget = std::make_unique<RenderTarget>(Width, Height, sampleCount);
+		pRenderTarget->FastClear = TRUE;
+		pRasterizer = std::make_unique<Rasterizer>(pRenderTarget.get());
+		pRasterizer->SetThreadCount(std::thread::hardware_concurrency());
+		pRasterizer->SetVisibilityBuffer(visibilityBuffer);
+	};
+	CreateTarget();
+
+	Texture2D<UINT> stoneHenge(StoneHenge_width, StoneHenge_height, StoneHenge_numlevels, StoneHenge_leveloffsets, StoneHenge_pixels, BGRA8, Tiled4x4);
 
 	bool shrink = false;
 	srand(time(NULL));
@@ -63,74 +84,95 @@ int main(int argc, char **argv)
 		vertices[i].normal.z = StoneHenge_data[i].nrm[2];
 		vertices[i].normal.w = 0.0f;
 	}
-	ConstantBuffer.light.color = 0xf0c0c0ff;
+	ConstantBuffer.light.color = 0xffc0c0f0;
 	ConstantBuffer.light.position = {0.0f, 0.0f, 0.0f, 1.0f};
 	ConstantBuffer.light.normal = Vector_Normalize({0.577f, 0.577f, -0.577f, 0.0f});
-	ConstantBuffer.pointLight.color = 0x00ffffff;
+	ConstantBuffer.pointLight.color = 0xffffff00;
 	ConstantBuffer.pointLight.position = {-1.0f, 0.5f, 1.0f, 1.0f};
 
-	XTime XTime;
-	XTime.Restart();
-	RS_Initialize(Width, Height);
-	double ElapsedTime = 0.0;
-	double FPS = 1.0 / 60.0;
-	do
+	FrameScheduler Scheduler;
+	// three back buffers let rendering run two frames ahead of the window
+	RS_Initialize(Width, Height, 3, 2);
+	while (RS_IsOpen())
 	{
-		XTime.Signal();
-		ElapsedTime += XTime.Delta();
-		if (ElapsedTime > Frequency)
-		{
-			ElapsedTime = 0.0;
+		// sleeps until the frame is due
+		Scheduler.WaitForFrame();
 
-			RenderTarget.Clear();
-			RenderTarget.DepthEnable = TRUE;
+		// camera movement
+		// move forward
+		if (GetAsyncKeyState('W'))
+		{
+			Camera.World = Matrix_Matrix_Multiply(Camera.World, Matrix_Create_Rotation_X(1.0f));
+			Scheduler.Invalidate();
+		}
+		// move left
+		if (GetAsyncKeyState('A'))
+		{
+			Camera.World = Matrix_Matrix_Multiply(Camera.World, Matrix_Create_Rotation_Y(-1.0f));
+			Scheduler.Invalidate();
+		}
+		// move backwards
+		if (GetAsyncKeyState('S'))
+		{
+			Camera.World = Matrix_Matrix_Multiply(Camera.World, Matrix_Create_Rotation_X(-1.0f));
+			Scheduler.Invalidate();
+		}
+		// move right
+		if (GetAsyncKeyState('D'))
+		{
+			Camera.World = Matrix_Matrix_Multiply(Camera.World, Matrix_Create_Rotation_Y(1.0f));
+			Scheduler.Invalidate();
+		}
+		// reset values
+		if (GetAsyncKeyState('R') & 0x1)
+		{
+			Camera.World = Default;
+			Scheduler.Invalidate();
+		}
+		// toggle 4x MSAA
+		if (GetAsyncKeyState('M') & 0x1)
+		{
+			sampleCount = sampleCount > 1 ? 1 : 4;
+			CreateTarget();
+			Scheduler.Invalidate();
+		}
+		// toggle the visibility buffer
+		if (GetAsyncKeyState('V') & 0x1)
+		{
+			visibilityBuffer = !visibilityBuffer;
+			pRasterizer->SetVisibilityBuffer(visibilityBuffer);
+			if (visibilityBuffer && sampleCount > 1)
+			{
+				std::cout << "The visibility buffer is used once MSAA is off\n";
+			}
+			Scheduler.Invalidate();
+		}
+		if (Scheduler.BeginFrame())
+		{
+			// frames are rendered straight into the back buffers of the surface
+			UINT *pBackBuffer = RS_AcquireBackBuffer();
+			if (!pBackBuffer)
+			{
+				break;
+			}
+			pRenderTarget->SetBackBuffer(pBackBuffer);
+			pRenderTarget->Clear();
+			pRenderTarget->DepthEnable = TRUE;
 
 			// Set PSO
-			Rasterizer.VS = VertexShader;
+			pRasterizer->VS = VertexShader;
 
 			ConstantBuffer.World = Matrix_Identity();
 			for (auto &i : starField)
 			{
-				Rasterizer.DrawPoint(i);
+				pRasterizer->DrawPoint(i);
 			}
 
 			ConstantBuffer.pTexture = &stoneHenge;
-			Rasterizer.PS = PixelShader;
-			for (int i = 0; i < ARRAYSIZE(StoneHenge_indicies); i += 3)
-			{
-				Rasterizer.FillTriangleBetterBrute(
-					vertices[StoneHenge_indicies[i]],
-					vertices[StoneHenge_indicies[i + 1]],
-					vertices[StoneHenge_indicies[i + 2]]);
-			}
-			Rasterizer.PS = nullptr;
-
-			// camera movement
-			// move forward
-			if (GetAsyncKeyState('W'))
-			{
-				Camera.World = Matrix_Matrix_Multiply(Camera.World, Matrix_Create_Rotation_X(1.0f));
-			}
-			// move left
-			if (GetAsyncKeyState('A'))
-			{
-				Camera.World = Matrix_Matrix_Multiply(Camera.World, Matrix_Create_Rotation_Y(-1.0f));
-			}
-			// move backwards
-			if (GetAsyncKeyState('S'))
-			{
-				Camera.World = Matrix_Matrix_Multiply(Camera.World, Matrix_Create_Rotation_X(-1.0f));
-			}
-			// move right
-			if (GetAsyncKeyState('D'))
-			{
-				Camera.World = Matrix_Matrix_Multiply(Camera.World, Matrix_Create_Rotation_Y(1.0f));
-			}
-			// reset values
-			if (GetAsyncKeyState('R') & 0x1)
-			{
-				Camera.World = Default;
-			}
+			pRasterizer->PS = PixelShader;
+			pRasterizer->DrawIndexed(vertices, ARRAYSIZE(vertices), StoneHenge_indicies, ARRAYSIZE(StoneHenge_indicies));
+			pRasterizer->PS = nullptr;
+			pRasterizer->Flush();
 
 			if (ConstantBuffer.lightRadius > 10.0f)
 			{
@@ -148,9 +190,16 @@ int main(int argc, char **argv)
 			{
 				ConstantBuffer.lightRadius += 0.3f;
 			}
+
+			RS_Present();
+			// the scene animates, on demand pacing needs the next frame as well
+			Scheduler.Invalidate();
+			Scheduler.EndFrame();
 		}
-	} while (RS_Update(RenderTarget.RT1, RenderTarget.RT1.NumPixels));
+	}
+	// RT1 is a back buffer, save it before the surface releases them
+	int Result = Save(pRenderTarget->RT1, 3, argc > 1 ? argv[1] : nullptr);
 	RS_Shutdown();
 
-	return Save(RenderTarget.RT1, 3);
+	return Result;
 }
\ No newline at end of file
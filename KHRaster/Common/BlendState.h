@@ -0,0 +1,85 @@
+#pragma once
+
+///////////////////////////////////////////////////
+//	Factors a color is scaled by before the blend op, Src is
+//	the shaded color and Dst the one already in the target.
+//	Alpha factors apply the alpha to every channel
+///////////////////////////////////////////////////
+enum BLEND_FACTOR
+{
+	BlendZero,
+	BlendOne,
+	BlendSrcColor,
+	BlendInvSrcColor,
+	BlendSrcAlpha,
+	BlendInvSrcAlpha,
+	BlendDstColor,
+	BlendInvDstColor,
+	BlendDstAlpha,
+	BlendInvDstAlpha
+};
+
+///////////////////////////////////////////////////
+//	BlendAdd		: Src * SrcBlend + Dst * DstBlend
+//	BlendSubtract	: Src * SrcBlend - Dst * DstBlend
+//	BlendRevSubtract: Dst * DstBlend - Src * SrcBlend
+//	BlendMin		: min(Src, Dst), factors are ignored
+//	BlendMax		: max(Src, Dst), factors are ignored
+//	Every channel saturates to [0, 255]
+///////////////////////////////////////////////////
+enum BLEND_OP
+{
+	BlendAdd,
+	BlendSubtract,
+	BlendRevSubtract,
+	BlendMin,
+	BlendMax
+};
+
+// Channel bits of ARGB8 for BlendState::WriteMask
+static constexpr unsigned int WriteAlpha = 0xff000000;
+static constexpr unsigned int WriteRed = 0x00ff0000;
+static constexpr unsigned int WriteGreen = 0x0000ff00;
+static constexpr unsigned int WriteBlue = 0x000000ff;
+static constexpr unsigned int WriteAll = WriteAlpha | WriteRed | WriteGreen | WriteBlue;
+
+// How shaded colors are merged into the render target. The same factors and op apply to all four channels,
+// channels not in WriteMask keep the value of the target.
+struct BlendState
+{
+	bool BlendEnable = false;
+	BLEND_FACTOR SrcBlend = BlendOne;
+	BLEND_FACTOR DstBlend = BlendZero;
+	BLEND_OP BlendOp = BlendAdd;
+	unsigned int WriteMask = WriteAll;
+
+	bool operator==(const BlendState &) const = default;
+
+	// Colors replace the target, no blending needed
+	bool IsOpaque() const
+	{
+		return (!BlendEnable || (SrcBlend == BlendOne && DstBlend == BlendZero && BlendOp == BlendAdd)) && WriteMask == WriteAll;
+	}
+
+	// Src + Dst * (1 - Src alpha), colors with premultiplied alpha
+	bool IsPremultiplied() const
+	{
+		return BlendEnable && SrcBlend == BlendOne && DstBlend == BlendInvSrcAlpha && BlendOp == BlendAdd && WriteMask == WriteAll;
+	}
+
+	// Src * Src alpha + Dst * (1 - Src alpha), colors with straight alpha
+	static BlendState AlphaBlend()
+	{
+		return {true, BlendSrcAlpha, BlendInvSrcAlpha, BlendAdd, WriteAll};
+	}
+
+	static BlendState Premultiplied()
+	{
+		return {true, BlendOne, BlendInvSrcAlpha, BlendAdd, WriteAll};
+	}
+
+	static BlendState Additive()
+	{
+		return {true, BlendOne, BlendOne, BlendAdd, WriteAll};
+	}
+};
@@ -0,0 +1,77 @@
+#pragma once
+#include <emmintrin.h>
+
+// Color math on packed ARGB8 pixels with SSE2 integer ops. The 4 suffixed functions work on four pixels per
+// register, the others on one pixel with all of its channels in one register. Channels are widened to 16 bits
+// for products and narrowed back with saturation.
+
+// Per channel A * B / 255 rounded to nearest, (a * b + 128) * 257 >> 16 is exact for 8 bit channels
+inline __m128i ColorModulate4(__m128i A, __m128i B)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i half = _mm_set1_epi16(128);
+	const __m128i scale = _mm_set1_epi16(257);
+
+	__m128i low = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(A, zero), _mm_unpacklo_epi8(B, zero)), half);
+	__m128i high = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(A, zero), _mm_unpackhi_epi8(B, zero)), half);
+	return _mm_packus_epi16(_mm_mulhi_epu16(low, scale), _mm_mulhi_epu16(high, scale));
+}
+
+// Per channel A + B, clamped to 255
+inline __m128i ColorCombine4(__m128i A, __m128i B)
+{
+	return _mm_adds_epu8(A, B);
+}
+
+// Per channel A + (B - A) * Weight / 256 rounded to nearest, Weight holds one value in [0, 256] per pixel
+inline __m128i ColorLerp4(__m128i A, __m128i B, __m128i Weight)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi16(256);
+	const __m128i half = _mm_set1_epi16(128);
+
+	// copy the weight of each pixel to the four words its channels widen to
+	__m128i weight = _mm_or_si128(Weight, _mm_slli_epi32(Weight, 16));
+	__m128i weightLow = _mm_unpacklo_epi32(weight, weight);
+	__m128i weightHigh = _mm_unpackhi_epi32(weight, weight);
+
+	// a * (256 - w) + b * w + 128 is at most 65408, it fits the unsigned 16 bit words
+	__m128i low = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(A, zero), _mm_sub_epi16(one, weightLow)), _mm_mullo_epi16(_mm_unpacklo_epi8(B, zero), weightLow));
+	__m128i high = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(A, zero), _mm_sub_epi16(one, weightHigh)), _mm_mullo_epi16(_mm_unpackhi_epi8(B, zero), weightHigh));
+	return _mm_packus_epi16(_mm_srli_epi16(_mm_add_epi16(low, half), 8), _mm_srli_epi16(_mm_add_epi16(high, half), 8));
+}
+
+// Reverses the channel order of each pixel, BGRA8 to ARGB8 and back
+inline __m128i ColorSwapBGRA4(__m128i Pixels)
+{
+	__m128i swapped = _mm_or_si128(_mm_slli_epi16(Pixels, 8), _mm_srli_epi16(Pixels, 8));
+	return _mm_shufflehi_epi16(_mm_shufflelo_epi16(swapped, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+}
+
+// Moves alpha from the bottom channel to the top one, RGBA8 to ARGB8
+inline __m128i ColorAlphaToTop4(__m128i Pixels)
+{
+	return _mm_or_si128(_mm_srli_epi32(Pixels, 8), _mm_slli_epi32(Pixels, 24));
+}
+
+// Lerp weight of a ratio in [0, 1], written so that NaN takes A
+inline int ColorWeight(float Ratio)
+{
+	return Ratio > 0.0f ? static_cast<int>((Ratio < 1.0f ? Ratio : 1.0f) * 256.0f + 0.5f) : 0;
+}
+
+inline unsigned int ColorModulate(unsigned int a, unsigned int b)
+{
+	return static_cast<unsigned int>(_mm_cvtsi128_si32(ColorModulate4(_mm_cvtsi32_si128(static_cast<int>(a)), _mm_cvtsi32_si128(static_cast<int>(b)))));
+}
+
+inline unsigned int ColorCombine(unsigned int a, unsigned int b)
+{
+	return static_cast<unsigned int>(_mm_cvtsi128_si32(ColorCombine4(_mm_cvtsi32_si128(static_cast<int>(a)), _mm_cvtsi32_si128(static_cast<int>(b)))));
+}
+
+inline unsigned int ColorLerp(unsigned int a, unsigned int b, float ratio)
+{
+	__m128i weight = _mm_cvtsi32_si128(ColorWeight(ratio));
+	return static_cast<unsigned int>(_mm_cvtsi128_si32(ColorLerp4(_mm_cvtsi32_si128(static_cast<int>(a)), _mm_cvtsi32_si128(static_cast<int>(b)), weight)));
+}
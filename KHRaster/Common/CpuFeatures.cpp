@@ -0,0 +1,109 @@
+#include "CpuFeatures.h"
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+static void CpuId(int Leaf, int SubLeaf, unsigned int Registers[4])
+{
+#if defined(_MSC_VER)
+	__cpuidex(reinterpret_cast<int *>(Registers), Leaf, SubLeaf);
+#else
+	__cpuid_count(Leaf, SubLeaf, Registers[0], Registers[1], Registers[2], Registers[3]);
+#endif
+}
+
+// State components the OS saves on a context switch
+static unsigned long long XGetBV()
+{
+#if defined(_MSC_VER)
+	return _xgetbv(0);
+#else
+	unsigned int eax, edx;
+	__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return (static_cast<unsigned long long>(edx) << 32) | eax;
+#endif
+}
+
+static SIMD_LEVEL DetectSimdLevel()
+{
+	unsigned int registers[4] = {};
+	CpuId(0, 0, registers);
+	unsigned int maxLeaf = registers[0];
+
+	CpuId(1, 0, registers);
+	bool sse2 = (registers[3] & (1u << 26)) != 0;
+	bool osxsave = (registers[2] & (1u << 27)) != 0;
+	bool avx = (registers[2] & (1u << 28)) != 0;
+	if (!sse2)
+	{
+		return SimdScalar;
+	}
+
+	// the OS has to preserve the upper halves of the ymm registers
+	if (!osxsave || !avx || (XGetBV() & 0x6) != 0x6 || maxLeaf < 7)
+	{
+		return SimdSSE2;
+	}
+
+	CpuId(7, 0, registers);
+	bool avx2 = (registers[1] & (1u << 5)) != 0;
+	return avx2 ? SimdAVX2 : SimdSSE2;
+}
+
+static SIMD_LEVEL ApplyOverride(SIMD_LEVEL Detected)
+{
+	char value[16] = {};
+#if defined(_MSC_VER)
+	char *pValue = nullptr;
+	size_t length = 0;
+	if (_dupenv_s(&pValue, &length, "KHRASTER_SIMD") != 0 || pValue == nullptr)
+	{
+		return Detected;
+	}
+	strncpy_s(value, pValue, _TRUNCATE);
+	free(pValue);
+#else
+	const char *pValue = std::getenv("KHRASTER_SIMD");
+	if (pValue == nullptr)
+	{
+		return Detected;
+	}
+	strncpy(value, pValue, sizeof(value) - 1);
+#endif
+
+	for (SIMD_LEVEL level : {SimdScalar, SimdSSE2, SimdAVX2})
+	{
+		// a level the CPU lacks can't be forced, only lowered to
+		if (strcmp(value, GetSimdLevelName(level)) == 0 && level <= Detected)
+		{
+			return level;
+		}
+	}
+	return Detected;
+}
+
+SIMD_LEVEL GetSimdLevel()
+{
+	static const SIMD_LEVEL level = ApplyOverride(DetectSimdLevel());
+	return level;
+}
+
+const char *GetSimdLevelName(SIMD_LEVEL Level)
+{
+	switch (Level)
+	{
+	case SimdScalar:
+		return "scalar";
+	case SimdSSE2:
+		return "sse2";
+	case SimdAVX2:
+		return "avx2";
+	}
+	return "unknown";
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+///////////////////////////////////////////////////
+//	SimdScalar	: plain C++, reference path for validation
+//	SimdSSE2	: 4 lanes, baseline of every x64 CPU
+//	SimdAVX2	: 8 lanes
+///////////////////////////////////////////////////
+enum SIMD_LEVEL
+{
+	SimdScalar,
+	SimdSSE2,
+	SimdAVX2
+};
+
+// Functions using AVX2 intrinsics, MSVC emits them anywhere while GCC and Clang need the target enabled per function
+#if defined(_MSC_VER) && !defined(__clang__)
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// Widest level supported by the CPU and the OS, detected once.
+// KHRASTER_SIMD=scalar|sse2|avx2 in the environment lowers it for testing.
+SIMD_LEVEL GetSimdLevel();
+
+const char *GetSimdLevelName(SIMD_LEVEL Level);
@@ -1,43 +1,34 @@
 #include "Defines.h"
+#include "ImageExport.h"
 
-#define STBI_MSC_SECURE_CRT
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include <stb/stb_image_write.h>
+#include <cstdlib>
 
-int Save(const Texture2D<UINT> &Image, int NumChannels)
+int Save(const Texture2D<UINT> &Image, int NumChannels, const char *pPath)
 {
-	// Saves a input image as a png using stb
-	std::unique_ptr<BYTE[]> Pixels = std::make_unique<BYTE[]>(Image.Width * Image.Height * NumChannels);
-
-	BYTE *pDst = Pixels.get();
-
-	int index = 0;
-	for (int y = 0; y < int(Image.Height); ++y)
-	{
-		for (int x = 0; x < int(Image.Width); ++x)
-		{
-			auto color = Image.GetPixel(x, y);
-
-			unsigned int R = (color & 0x00ff0000) >> 16;
-			unsigned int G = (color & 0x0000ff00) >> 8;
-			unsigned int B = (color & 0x000000ff);
-
-			pDst[0] = R;
-			pDst[1] = G;
-			pDst[2] = B;
-			pDst += 3;
-		}
-	}
-
+	// Saves the top level of an image, the format follows the extension of the path
+	assert(Image.Compression == NoCompression);
 #ifdef _DEBUG
-	const char *Name = "Debug.png";
+	const char *DefaultPath = "Debug.png";
 #else
-	const char *Name = "Release.png";
+	const char *DefaultPath = "Release.png";
 #endif
-	if (stbi_write_png(Name, Image.Width, Image.Height, 3, Pixels.get(), Image.Width * NumChannels))
+	pPath = pPath ? pPath : DefaultPath;
+
+	ImageExportDesc Desc;
+	Desc.Format = GetImageFormat(pPath);
+	Desc.NumChannels = NumChannels;
+
+	// tiled levels are copied into rows first
+	TextureLevel<const UINT> Level = Image.GetLevel(0);
+	std::vector<UINT> Rows;
+	if (Level.TileShift != 0)
 	{
-		return EXIT_SUCCESS;
+		Rows.resize(size_t(Image.Width) * Image.Height);
+		CopyLevel<UINT>({Rows.data(), Image.Width, Image.Height, Image.Width, 0}, Level);
+		Level = {Rows.data(), Image.Width, Image.Height, Image.Width, 0};
 	}
 
-	return EXIT_FAILURE;
-}
\ No newline at end of file
+	// one thread, Export writes on this one without starting any
+	ImageExporter Exporter(1);
+	return Exporter.Export(Level.pTexels, Image.Width, Image.Height, Level.Pitch, pPath, Desc) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
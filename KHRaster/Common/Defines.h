@@ -1,7 +1,18 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring>
 #include <memory>
+#include <new>
+#include <type_traits>
 #include <vector>
-#include <Windows.h>
+
+#include "BlendState.h"
+#include "PixelFormat.h"
+#include "Platform.h"
+#include "SimdKernels.h"
+#include "TextureCompression.h"
 
 // colors
 #define RED 0xffff0000
@@ -14,33 +25,185 @@
 #define CYAN (BLUE | GREEN)
 #define PURPLE 0xff8a2be2
 
-static constexpr double ElapsedTime = 0.0;
-static constexpr double Frequency = 1 / 60.0f;
-
 inline int Flatten2DTo1D(int x, int y, int width)
 {
 	return y * width + x;
 }
 
+// Alignment in bytes of texture storage, one cache line
+static constexpr size_t TextureAlignment = 64;
+
+// Owner is cleared for arrays wrapping memory that belongs to someone else, they are left alone
+struct AlignedDelete
+{
+	bool Owner = true;
+
+	void operator()(void *p) const
+	{
+		if (Owner)
+		{
+			::operator delete[](p, std::align_val_t(TextureAlignment));
+		}
+	}
+};
+
+template <typename T>
+using AlignedArray = std::unique_ptr<T[], AlignedDelete>;
+
+// Zero initialized, TextureAlignment aligned array of Count elements
+template <typename T>
+AlignedArray<T> MakeAlignedArray(UINT64 Count)
+{
+	static_assert(std::is_trivially_copyable_v<T>, "texels are copied with memcpy");
+	size_t bytes = static_cast<size_t>(std::max<UINT64>(Count, 1) * sizeof(T));
+	void *p = ::operator new[](bytes, std::align_val_t(TextureAlignment));
+	memset(p, 0, bytes);
+	return AlignedArray<T>(static_cast<T *>(p));
+}
+
+///////////////////////////////////////////////////
+//	RowMajor	: texel (x, y) is at y * Pitch + x
+//	Tiled4x4	: 4x4 tiles stored one after the other, row major
+//				  inside a tile and across tiles. A tile of 32 bit
+//				  texels is exactly one cache line
+//	Tiled8x8	: same with 8x8 tiles
+///////////////////////////////////////////////////
+enum TEXTURE_LAYOUT
+{
+	RowMajor,
+	Tiled4x4,
+	Tiled8x8
+};
+
+// log2 of the tile size of a layout, 0 for row major
+inline UINT GetTileShift(TEXTURE_LAYOUT Layout)
+{
+	return Layout == Tiled4x4 ? 2 : Layout == Tiled8x8 ? 3 : 0;
+}
+
+// View of one mip level of a Texture2D. Block compressed levels have no texel addressing,
+// pTexels points at their 4x4 blocks and Pitch counts blocks per row.
+template <typename T>
+struct TextureLevel
+{
+	T *pTexels;
+	UINT Width, Height;
+	// texels per row, rounded up to whole tiles
+	UINT Pitch;
+	UINT TileShift;
+
+	// Texel (X, Y) is at RowOffset(Y) + ColumnOffset(X), the two parts are independent so a
+	// sampler can address rows and columns separately. With TileShift 0 this is Y * Pitch + X.
+	UINT64 RowOffset(UINT Y) const
+	{
+		UINT mask = (1u << TileShift) - 1;
+		return ((UINT64(Y >> TileShift) * Pitch) << TileShift) + ((Y & mask) << TileShift);
+	}
+
+	UINT ColumnOffset(UINT X) const
+	{
+		UINT mask = (1u << TileShift) - 1;
+		return ((X >> TileShift) << (2 * TileShift)) + (X & mask);
+	}
+
+	T *Texel(UINT X, UINT Y) const
+	{
+		return pTexels + RowOffset(Y) + ColumnOffset(X);
+	}
+
+	// Only row major levels have contiguous rows
+	T *Row(UINT Y) const
+	{
+		assert(TileShift == 0);
+		return pTexels + UINT64(Y) * Pitch;
+	}
+};
+
+// Copies the texels of Src into Dst, both have the same size but may differ in layout
+template <typename T>
+void CopyLevel(const TextureLevel<T> &Dst, const TextureLevel<const T> &Src)
+{
+	// texels stay contiguous in both layouts over the smallest tile width, or a whole row when neither is tiled
+	UINT run = Src.Width;
+	if (Dst.TileShift || Src.TileShift)
+	{
+		UINT shift = !Dst.TileShift ? Src.TileShift : !Src.TileShift ? Dst.TileShift : std::min(Dst.TileShift, Src.TileShift);
+		run = 1u << shift;
+	}
+
+	for (UINT y = 0; y < Src.Height; ++y)
+	{
+		for (UINT x = 0; x < Src.Width; x += run)
+		{
+			memcpy(Dst.Texel(x, y), Src.Texel(x, y), std::min(run, Src.Width - x) * sizeof(T));
+		}
+	}
+}
+
+///////////////////////////////////////////////////
+//	One allocation holds every mip level, level i is
+//	max(Width >> i, 1) x max(Height >> i, 1) texels starting
+//	at MiplevelOffsets[i]. Without pMipLevelOffsets the levels
+//	are packed one after the other. pData is always row major,
+//	tiled textures are swizzled from it at creation and their
+//	levels are padded to whole tiles. Color textures hold
+//	ARGB8, other formats are converted once when uploaded.
+///////////////////////////////////////////////////
 template <typename T>
 struct Texture2D
 {
-	Texture2D(UINT Width, UINT Height, UINT MipLevels = 1, const UINT *pMipLevelOffsets = nullptr, const T *pData = nullptr)
-		: Width(Width), Height(Height), MipLevels(MipLevels), NumPixels(UINT64(Width) * UINT64(Height)), MiplevelOffsets(MipLevels)
+	Texture2D(UINT Width, UINT Height, UINT MipLevels = 1, const UINT *pMipLevelOffsets = nullptr, const T *pData = nullptr, TEXTURE_LAYOUT Layout = RowMajor)
+		: Width(Width), Height(Height), MipLevels(std::max(MipLevels, 1u)), Layout(Layout), MiplevelOffsets(std::max(MipLevels, 1u))
 	{
-		if (pMipLevelOffsets)
+		// tiled levels never match the offsets of the row major source, they are packed instead
+		NumPixels = 0;
+		for (UINT i = 0; i < this->MipLevels; ++i)
 		{
-			for (UINT i = 0; i < MipLevels; ++i)
-			{
-				MiplevelOffsets[i] = pMipLevelOffsets[i];
-			}
+			MiplevelOffsets[i] = pMipLevelOffsets && Layout == RowMajor ? pMipLevelOffsets[i] : static_cast<UINT>(NumPixels);
+			NumPixels = std::max(NumPixels, MiplevelOffsets[i] + UINT64(GetLevelPitch(i)) * RoundUpToTile(GetLevelHeight(i)));
 		}
 
-		Pixels = std::make_unique<T[]>(NumPixels);
+		Pixels = MakeAlignedArray<T>(NumPixels);
 		if (pData)
 		{
-			memcpy(Pixels.get(), pData, NumPixels * sizeof(T));
+			Upload(pData, pMipLevelOffsets);
+		}
+	}
+
+	// pData holds texels of Format, pMipLevelOffsets counts texels of it
+	Texture2D(UINT Width, UINT Height, UINT MipLevels, const UINT *pMipLevelOffsets, const void *pData, PIXEL_FORMAT Format, TEXTURE_LAYOUT Layout = RowMajor)
+		: Texture2D(Width, Height, MipLevels, pMipLevelOffsets, nullptr, Layout)
+	{
+		static_assert(std::is_same_v<T, UINT>, "colors are converted to ARGB8");
+		if (!pData)
+		{
+			return;
+		}
+
+		// texels that are already ARGB8 are uploaded as they are
+		if (Format == ARGB8)
+		{
+			Upload(static_cast<const T *>(pData), pMipLevelOffsets);
+			return;
 		}
+
+		// row major levels are laid out like the source, the conversion writes them directly
+		if (Layout == RowMajor)
+		{
+			ConvertToARGB8(Pixels.get(), pData, Format, NumPixels);
+			return;
+		}
+
+		UINT64 numSourceTexels = 0;
+		for (UINT i = 0, offset = 0; i < this->MipLevels; ++i)
+		{
+			offset = pMipLevelOffsets ? pMipLevelOffsets[i] : offset;
+			offset += GetLevelWidth(i) * GetLevelHeight(i);
+			numSourceTexels = std::max<UINT64>(numSourceTexels, offset);
+		}
+		std::vector<T> converted(numSourceTexels);
+		ConvertToARGB8(converted.data(), pData, Format, numSourceTexels);
+		Upload(converted.data(), pMipLevelOffsets);
 	}
 
 	operator auto()
@@ -50,7 +213,7 @@ struct Texture2D
 
 	Texture2D<T> &operator=(const Texture2D<T> &rhs)
 	{
-		assert(NumPixels == rhs.NumPixels);
+		assert(NumPixels == rhs.NumPixels && Layout == rhs.Layout && Compression == rhs.Compression);
 		if (this != &rhs)
 		{
 			memcpy(Pixels.get(), rhs.Pixels.get(), NumPixels * sizeof(T));
@@ -59,6 +222,127 @@ struct Texture2D
 		return *this;
 	}
 
+	UINT GetLevelWidth(UINT Level) const
+	{
+		return std::max(Width >> Level, 1u);
+	}
+
+	UINT GetLevelHeight(UINT Level) const
+	{
+		return std::max(Height >> Level, 1u);
+	}
+
+	UINT RoundUpToTile(UINT Size) const
+	{
+		UINT mask = (1u << GetTileShift(Layout)) - 1;
+		return (Size + mask) & ~mask;
+	}
+
+	UINT GetLevelPitch(UINT Level) const
+	{
+		return Compression != NoCompression ? (GetLevelWidth(Level) + 3) / 4 : RoundUpToTile(GetLevelWidth(Level));
+	}
+
+	TextureLevel<T> GetLevel(UINT Level)
+	{
+		return {Pixels.get() + MiplevelOffsets[Level], GetLevelWidth(Level), GetLevelHeight(Level), GetLevelPitch(Level), GetTileShift(Layout)};
+	}
+
+	TextureLevel<const T> GetLevel(UINT Level) const
+	{
+		return {Pixels.get() + MiplevelOffsets[Level], GetLevelWidth(Level), GetLevelHeight(Level), GetLevelPitch(Level), GetTileShift(Layout)};
+	}
+
+	// Index in Pixels of texel (X, Y) of the top level
+	UINT64 GetTexelIndex(UINT X, UINT Y) const
+	{
+		assert(Compression == NoCompression);
+		if (Layout == RowMajor)
+		{
+			return UINT64(Y) * Width + X;
+		}
+		TextureLevel<const T> level = GetLevel(0);
+		return level.RowOffset(Y) + level.ColumnOffset(X);
+	}
+
+	// Replaces the mip levels below the top one with a full chain down to 1x1, each level is a 2x2 box filter of the one above
+	void GenerateMips()
+	{
+		static_assert(std::is_same_v<T, UINT>, "mips are generated for 8 bit per channel colors");
+		assert(Compression == NoCompression);
+
+		UINT levels = 1;
+		while ((Width >> levels) || (Height >> levels))
+		{
+			++levels;
+		}
+
+		// filtered in row major, then swizzled into the layout of the texture
+		Texture2D<T> chain(Width, Height, levels);
+		CopyLevel(chain.GetLevel(0), static_cast<const Texture2D<T> &>(*this).GetLevel(0));
+		for (UINT i = 1; i < levels; ++i)
+		{
+			TextureLevel<const T> src = static_cast<const Texture2D<T> &>(chain).GetLevel(i - 1);
+			TextureLevel<T> dst = chain.GetLevel(i);
+			// an odd sized source axis folds its last texel into the last destination texel, whose footprint is then
+			// 3 texels wide and goes through the box filter instead of the 2x2 kernel
+			UINT kernelWidth = src.Width & 1 ? dst.Width - 1 : dst.Width;
+			for (UINT y = 0; y < dst.Height; ++y)
+			{
+				UINT top = 2 * y;
+				UINT bottom = y + 1 == dst.Height ? src.Height : 2 * y + 2;
+				UINT x = 0;
+				if (bottom - top == 2)
+				{
+					DownsampleRow2x2(dst.Row(y), src.Row(top), src.Row(top + 1), kernelWidth);
+					x = kernelWidth;
+				}
+				for (; x < dst.Width; ++x)
+				{
+					UINT right = x + 1 == dst.Width ? src.Width : 2 * x + 2;
+					*dst.Texel(x, y) = AverageTexels(src, 2 * x, right, top, bottom);
+				}
+			}
+		}
+
+		Texture2D<T> *pResult = &chain;
+		std::unique_ptr<Texture2D<T>> pSwizzled;
+		if (Layout != RowMajor)
+		{
+			pSwizzled = std::make_unique<Texture2D<T>>(Width, Height, levels, chain.MiplevelOffsets.data(), chain.Pixels.get(), Layout);
+			pResult = pSwizzled.get();
+		}
+
+		Pixels = std::move(pResult->Pixels);
+		MipLevels = pResult->MipLevels;
+		NumPixels = pResult->NumPixels;
+		MiplevelOffsets = std::move(pResult->MiplevelOffsets);
+	}
+
+	// Rounded average of the texels in [Left, Right) x [Top, Bottom), per 8 bit channel
+	static T AverageTexels(const TextureLevel<const T> &Level, UINT Left, UINT Right, UINT Top, UINT Bottom)
+	{
+		UINT sums[4] = {};
+		for (UINT y = Top; y < Bottom; ++y)
+		{
+			for (UINT x = Left; x < Right; ++x)
+			{
+				UINT texel = *Level.Texel(x, y);
+				for (UINT c = 0; c < 4; ++c)
+				{
+					sums[c] += (texel >> (8 * c)) & 0xff;
+				}
+			}
+		}
+		UINT count = (Right - Left) * (Bottom - Top);
+		UINT texel = 0;
+		for (UINT c = 0; c < 4; ++c)
+		{
+			texel |= ((sums[c] + count / 2) / count) << (8 * c);
+		}
+		return texel;
+	}
+
 	T At(UINT Index)
 	{
 		if (Index >= 0 && Index < NumPixels)
@@ -68,12 +352,79 @@ struct Texture2D
 
 	void Clear(T Value = (T)0)
 	{
-		for (UINT64 i = 0; i < NumPixels; ++i)
+		if constexpr (sizeof(T) == sizeof(UINT))
+		{
+			UINT bits;
+			memcpy(&bits, &Value, sizeof(bits));
+			Fill32(Pixels.get(), bits, NumPixels);
+		}
+		else
 		{
-			Pixels[i] = Value;
+			for (UINT64 i = 0; i < NumPixels; ++i)
+			{
+				Pixels[i] = Value;
+			}
 		}
 	}
 
+	// Block compresses every mip level in place, the texels can then only be read through a Sampler.
+	// Blocks over the edge of a level repeat its last row and column.
+	void Compress(TEXTURE_COMPRESSION Compression)
+	{
+		static_assert(std::is_same_v<T, UINT>, "only 8 bit per channel colors are block compressed");
+		assert(this->Compression == NoCompression);
+		if (Compression == NoCompression)
+		{
+			return;
+		}
+
+		UINT blockSize = GetBlockSize(Compression);
+		std::vector<UINT> offsets(MipLevels);
+		UINT64 numBlockUnits = 0;
+		for (UINT i = 0; i < MipLevels; ++i)
+		{
+			offsets[i] = static_cast<UINT>(numBlockUnits);
+			numBlockUnits += UINT64((GetLevelWidth(i) + 3) / 4) * ((GetLevelHeight(i) + 3) / 4) * blockSize;
+		}
+
+		AlignedArray<T> blocks = MakeAlignedArray<T>(numBlockUnits);
+		for (UINT i = 0; i < MipLevels; ++i)
+		{
+			TextureLevel<const T> level = static_cast<const Texture2D<T> &>(*this).GetLevel(i);
+			UINT blocksX = (level.Width + 3) / 4;
+			UINT blocksY = (level.Height + 3) / 4;
+			for (UINT by = 0; by < blocksY; ++by)
+			{
+				for (UINT bx = 0; bx < blocksX; ++bx)
+				{
+					UINT texels[16];
+					for (UINT j = 0; j < 16; ++j)
+					{
+						texels[j] = *level.Texel(std::min(bx * 4 + j % 4, level.Width - 1), std::min(by * 4 + j / 4, level.Height - 1));
+					}
+
+					BYTE *pBlock = reinterpret_cast<BYTE *>(&blocks[offsets[i] + (UINT64(by) * blocksX + bx) * blockSize]);
+					if (Compression == BC1)
+					{
+						EncodeBC1Block(texels, pBlock);
+					}
+					else
+					{
+						EncodeBC3Block(texels, pBlock);
+					}
+				}
+			}
+		}
+
+		Pixels = std::move(blocks);
+		NumPixels = numBlockUnits;
+		MiplevelOffsets = std::move(offsets);
+		this->Compression = Compression;
+		// cached decoded blocks of an earlier texture at the same address are never matched
+		static std::atomic<UINT64> nextRevision = 1;
+		Revision = nextRevision++;
+	}
+
 	bool IsWithinBounds(UINT X, UINT Y) const
 	{
 		return (X >= 0 && X < Width) && (Y >= 0 && Y < Height);
@@ -83,7 +434,7 @@ struct Texture2D
 	{
 		if (IsWithinBounds(X, Y))
 		{
-			Pixels[Y * Width + X] = Color;
+			Pixels[GetTexelIndex(X, Y)] = Color;
 		}
 	}
 
@@ -91,70 +442,119 @@ struct Texture2D
 	{
 		if (IsWithinBounds(X, Y))
 		{
-			return Pixels[Y * Width + X];
+			return Pixels[GetTexelIndex(X, Y)];
 		}
 		return {};
 	}
 
-	void BLIT(const T *pSource, UINT SourceWidth, const RECT &BlockRect, UINT DstX, UINT DstY)
+	void BLIT(const Texture2D<T> &Source, const RECT &BlockRect, UINT DstX, UINT DstY)
 	{
-		UINT BlockWidth = BlockRect.right - BlockRect.left;
-		UINT BlockHeight = BlockRect.bottom - BlockRect.top;
+		static constexpr BlendState BlitBlend = {true, BlendSrcAlpha, BlendInvSrcAlpha, BlendAdd, WriteRed | WriteGreen | WriteBlue};
+
+		assert(Layout == RowMajor && Compression == NoCompression);
+		assert(Source.Layout == RowMajor && Source.Compression == NoCompression);
+		if (DstX >= Width || DstY >= Height)
+		{
+			return;
+		}
+
+		// clip the block to the destination
+		UINT BlockWidth = std::min<UINT>(BlockRect.right - BlockRect.left, Width - DstX);
+		UINT BlockHeight = std::min<UINT>(BlockRect.bottom - BlockRect.top, Height - DstY);
 
 		for (UINT y = 0; y < BlockHeight; y++)
 		{
-			for (UINT x = 0; x < BlockWidth; x++)
-			{
-				auto sourceIdx = Flatten2DTo1D((BlockRect.left + x), (BlockRect.top + y), SourceWidth);
-
-				// if alpha 0 dont blit
-				if (!IsWithinBounds(DstX + x, DstY + y))
-					continue;
-
-				T SrcPixel = pSource[sourceIdx];
-				T DstPixel = GetPixel(DstX + x, DstY + y);
-
-				// Color correction
-				// extract channel into 8 bit value from source
-				UINT SrcRed = (SrcPixel & 0x0000ff00) >> 8;
-				UINT SrcGreen = (SrcPixel & 0x00ff0000) >> 16;
-				UINT SrcBlue = (SrcPixel & 0xff000000) >> 24;
-				UINT SrcAlpha = SrcPixel & 0x000000ff;
-				// Alpha Blend
-				// extract channel into 8 bit value from raster
-				UINT DstRed = (DstPixel & 0x00ff0000) >> 16;
-				UINT DstGreen = (DstPixel & 0x0000ff00) >> 8;
-				UINT DstBlue = (DstPixel & 0x000000ff);
-
-				// Shrubberies
-				// rearranged formula from the previous formula: ((source * alpha) + (destination * (255 - alpha))) >> 8
-				// Explanation: if you rearrange the formula you will get a denominator of 255, which is equivalent to shifting 8 bits to the right
-				UINT NewRed = ((SrcRed * SrcAlpha) + (DstRed * (255 - SrcAlpha))) >> 8;
-				UINT NewGreen = ((SrcGreen * SrcAlpha) + (DstGreen * (255 - SrcAlpha))) >> 8;
-				UINT NewBlue = ((SrcBlue * SrcAlpha) + (DstBlue * (255 - SrcAlpha))) >> 8;
-				UINT NewColor = NewRed << 16 | NewGreen << 8 | NewBlue;
-				SetPixel(DstX + x, DstY + y, NewColor);
-			}
+			auto sourceIdx = Flatten2DTo1D(BlockRect.left, BlockRect.top + y, Source.Width);
+
+			// alpha blend the row by the source alpha, the destination keeps its own alpha
+			BlendSpan(&Pixels[(DstY + y) * Width + DstX], &Source.Pixels[sourceIdx], BlockWidth, BlitBlend);
+		}
+	}
+
+	// Copies the row major levels of pData into the layout of the texture
+	void Upload(const T *pData, const UINT *pMipLevelOffsets)
+	{
+		if (Layout == RowMajor)
+		{
+			memcpy(Pixels.get(), pData, NumPixels * sizeof(T));
+			return;
+		}
+
+		UINT64 sourceOffset = 0;
+		for (UINT i = 0; i < MipLevels; ++i)
+		{
+			sourceOffset = pMipLevelOffsets ? pMipLevelOffsets[i] : sourceOffset;
+			TextureLevel<const T> source = {pData + sourceOffset, GetLevelWidth(i), GetLevelHeight(i), GetLevelWidth(i), 0};
+			CopyLevel(GetLevel(i), source);
+			sourceOffset += UINT64(GetLevelWidth(i)) * GetLevelHeight(i);
 		}
 	}
 
-	std::unique_ptr<T[]> Pixels;
+	AlignedArray<T> Pixels;
 	UINT Width, Height, MipLevels;
+	TEXTURE_LAYOUT Layout;
+	TEXTURE_COMPRESSION Compression = NoCompression;
+	// identifies the blocks of a compressed texture, changes every time it is compressed
+	UINT64 Revision = 0;
+	// texels of every mip level, or 32 bit units of their blocks when compressed
 	UINT64 NumPixels;
 	std::vector<UINT> MiplevelOffsets;
 };
 
 struct RenderTarget
 {
-	RenderTarget(UINT Width, UINT Height)
-		: RT1(Width, Height), DepthBuffer(Width, Height), Width(Width), Height(Height), NumPixels(UINT64(Width) * UINT64(Height))
+	// Width and height in pixels of a hierarchical Z block
+	static constexpr UINT HiZBlockSize = 8;
+	// Width and height in pixels of the tiles a fast clear is tracked for
+	static constexpr UINT ClearTileSize = 64;
+	// VisibilityBuffer value of a pixel whose color in RT1 is final
+	static constexpr UINT NoPrimitive = UINT(-1);
+	// Formats of RT1 and DepthBuffer
+	static constexpr PIXEL_FORMAT ColorFormat = ARGB8;
+	static constexpr PIXEL_FORMAT DepthFormat = R32F;
+
+	///////////////////////////////////////////////////
+	//	SampleCount
+	//	1	: one color and depth per pixel, sampled at its
+	//		  integer coordinate
+	//	4	: four depth and color samples per pixel, the pixel
+	//		  shader still runs once per pixel. RT1 holds the
+	//		  resolved colors after Rasterizer::Flush
+	///////////////////////////////////////////////////
+	RenderTarget(UINT Width, UINT Height, UINT SampleCount = 1)
+		: RT1(Width, Height), DepthBuffer(Width * SampleCount, Height),
+		  HiZ((Width + HiZBlockSize - 1) / HiZBlockSize, (Height + HiZBlockSize - 1) / HiZBlockSize),
+		  HiZDirty((Width + HiZBlockSize - 1) / HiZBlockSize, (Height + HiZBlockSize - 1) / HiZBlockSize),
+		  VisibilityBuffer(Width, Height),
+		  ColorSamples(SampleCount > 1 ? Width * SampleCount : 0, SampleCount > 1 ? Height : 0),
+		  Compressed(SampleCount > 1 ? Width : 0, SampleCount > 1 ? Height : 0),
+		  ColorCleared((Width + ClearTileSize - 1) / ClearTileSize, (Height + ClearTileSize - 1) / ClearTileSize),
+		  DepthCleared((Width + ClearTileSize - 1) / ClearTileSize, (Height + ClearTileSize - 1) / ClearTileSize),
+		  Width(Width), Height(Height), SampleCount(SampleCount), NumPixels(UINT64(Width) * UINT64(Height))
 	{
+		assert(SampleCount == 1 || SampleCount == 4);
+		VisibilityBuffer.Clear(NoPrimitive);
+		Compressed.Clear(TRUE);
 	}
 
 	void SetPixel(UINT X, UINT Y, UINT Color, FLOAT Depth)
 	{
-		if (!RT1.IsWithinBounds(X, Y) && !DepthBuffer.IsWithinBounds(X, Y))
+		SetPixel(X, Y, Color, Depth, DepthEnable, Blend);
+	}
+
+	// Blend is applied to pixels that pass the depth test, the depth written is that of the pixel either way.
+	// The pixel covers all of its samples.
+	void SetPixel(UINT X, UINT Y, UINT Color, FLOAT Depth, BOOL DepthEnable, const BlendState &Blend)
+	{
+		if (!RT1.IsWithinBounds(X, Y))
+		{
+			return;
+		}
+		MaterializeClear({static_cast<LONG>(X), static_cast<LONG>(Y), static_cast<LONG>(X) + 1, static_cast<LONG>(Y) + 1}, DepthEnable);
+
+		if (SampleCount > 1)
 		{
+			SetSamples(X, Y, Color, Depth, DepthEnable, Blend);
 			return;
 		}
 
@@ -162,28 +562,276 @@ struct RenderTarget
 		{
 			if (Depth <= DepthBuffer.GetPixel(X, Y))
 			{
-				RT1.SetPixel(X, Y, Color);
+				MergeColor(RT1.Pixels[UINT64(Y) * Width + X], Color, Blend);
 				DepthBuffer.SetPixel(X, Y, Depth);
+				VisibilityBuffer.SetPixel(X, Y, NoPrimitive);
+				MarkHiZDirty(X / HiZBlockSize, Y / HiZBlockSize);
 			}
 		}
 		else
 		{
-			RT1.SetPixel(X, Y, Color);
+			MergeColor(RT1.Pixels[UINT64(Y) * Width + X], Color, Blend);
+			VisibilityBuffer.SetPixel(X, Y, NoPrimitive);
+		}
+	}
+
+	// SetPixel on a multisampled target
+	void SetSamples(UINT X, UINT Y, UINT Color, FLOAT Depth, BOOL DepthEnable, const BlendState &Blend)
+	{
+		UINT64 index = UINT64(Y) * Width + X;
+		int coverage = FullCoverage();
+		if (DepthEnable)
+		{
+			FLOAT *pDepth = &DepthBuffer.Pixels[index * SampleCount];
+			for (UINT i = 0; i < SampleCount; ++i)
+			{
+				if (Depth <= pDepth[i])
+				{
+					pDepth[i] = Depth;
+				}
+				else
+				{
+					coverage &= ~(1 << i);
+				}
+			}
+			if (coverage == 0)
+			{
+				return;
+			}
+			MarkHiZDirty(X / HiZBlockSize, Y / HiZBlockSize);
 		}
+		WriteSamples(index, Color, coverage, Blend);
 	}
 
+	// Merges Color into the samples of the pixel at Index set in Coverage. A pixel whose samples are all written
+	// with the same color is compressed back to the single color in RT1.
+	void WriteSamples(UINT64 Index, UINT Color, int Coverage, const BlendState &Blend)
+	{
+		UINT *pSamples = &ColorSamples.Pixels[Index * SampleCount];
+		if (Compressed.Pixels[Index])
+		{
+			// blending identical samples by the same color keeps them identical
+			if (Coverage == FullCoverage())
+			{
+				MergeColor(RT1.Pixels[Index], Color, Blend);
+				return;
+			}
+
+			// the samples diverge, give each of them the color of the pixel
+			for (UINT i = 0; i < SampleCount; ++i)
+			{
+				pSamples[i] = RT1.Pixels[Index];
+			}
+			Compressed.Pixels[Index] = FALSE;
+		}
+		else if (Coverage == FullCoverage() && Blend.IsOpaque())
+		{
+			RT1.Pixels[Index] = Color;
+			Compressed.Pixels[Index] = TRUE;
+			return;
+		}
+
+		for (UINT i = 0; i < SampleCount; ++i)
+		{
+			if (Coverage & (1 << i))
+			{
+				MergeColor(pSamples[i], Color, Blend);
+			}
+		}
+	}
+
+	// Brings RT1 up to date over Region for presenting: tiles still cleared are filled with the clear color, bypassing
+	// the caches, and the samples of multisampled pixels are averaged. Compressed pixels already hold their color.
+	// Cleared tiles stay flagged, drawing into them afterwards materializes the clear as usual.
+	void Resolve(const RECT &Region)
+	{
+		for (LONG y = Region.top; y < Region.bottom; ++y)
+		{
+			const BYTE *pCleared = &ColorCleared.Pixels[(y / ClearTileSize) * ColorCleared.Width];
+
+			// one tile wide segments of the row
+			for (LONG x = Region.left, end; x < Region.right; x = end)
+			{
+				end = std::min(Region.right, static_cast<LONG>((x / ClearTileSize + 1) * ClearTileSize));
+				UINT64 index = UINT64(y) * Width + x;
+				if (pCleared[x / ClearTileSize])
+				{
+					Fill32Stream(&RT1.Pixels[index], ClearColor, end - x);
+				}
+				else if (SampleCount > 1)
+				{
+					ResolveRow4x(&RT1.Pixels[index], &ColorSamples.Pixels[index * SampleCount], &Compressed.Pixels[index], end - x);
+				}
+			}
+		}
+	}
+
+	// Writes the pending fast clear into the tiles overlapping Region, the depth too when DepthEnable is set.
+	// Everything that writes RT1 or DepthBuffer directly calls it first.
+	void MaterializeClear(const RECT &Region, BOOL DepthEnable)
+	{
+		if (Region.left >= Region.right || Region.top >= Region.bottom)
+		{
+			return;
+		}
+
+		for (UINT tileY = Region.top / ClearTileSize; tileY <= (Region.bottom - 1) / ClearTileSize; ++tileY)
+		{
+			for (UINT tileX = Region.left / ClearTileSize; tileX <= (Region.right - 1) / ClearTileSize; ++tileX)
+			{
+				UINT index = tileY * ColorCleared.Width + tileX;
+				if (ColorCleared.Pixels[index] || (DepthEnable && DepthCleared.Pixels[index]))
+				{
+					MaterializeTile(tileX, tileY, DepthEnable);
+				}
+			}
+		}
+	}
+
+	void MaterializeTile(UINT TileX, UINT TileY, BOOL DepthEnable)
+	{
+		UINT index = TileY * ColorCleared.Width + TileX;
+		UINT startX = TileX * ClearTileSize;
+		UINT startY = TileY * ClearTileSize;
+		UINT width = std::min(startX + ClearTileSize, Width) - startX;
+		UINT endY = std::min(startY + ClearTileSize, Height);
+
+		if (ColorCleared.Pixels[index])
+		{
+			for (UINT y = startY; y < endY; ++y)
+			{
+				Fill32(&RT1.Pixels[UINT64(y) * Width + startX], ClearColor, width);
+				if (SampleCount > 1)
+				{
+					memset(&Compressed.Pixels[UINT64(y) * Width + startX], TRUE, width);
+				}
+			}
+			ColorCleared.Pixels[index] = FALSE;
+		}
+
+		if (DepthEnable && DepthCleared.Pixels[index])
+		{
+			UINT depth;
+			memcpy(&depth, &ClearDepth, sizeof(depth));
+			for (UINT y = startY; y < endY; ++y)
+			{
+				Fill32(&DepthBuffer.Pixels[(UINT64(y) * Width + startX) * SampleCount], depth, width * SampleCount);
+			}
+			DepthCleared.Pixels[index] = FALSE;
+		}
+	}
+
+	// Makes RT1 use Width * Height row major pixels owned elsewhere, like the back buffers of RS_AcquireBackBuffer,
+	// so that frames are rendered straight into them. Call it between frames, the pixels must outlive their use.
+	// They keep what was last rendered into them, Clear starts the frame over.
+	void SetBackBuffer(UINT *pPixels)
+	{
+		RT1.Pixels = AlignedArray<UINT>(pPixels, AlignedDelete{false});
+	}
+
+	// Coverage mask with every sample of a pixel set
+	int FullCoverage() const
+	{
+		return (1 << SampleCount) - 1;
+	}
+
+	// Merges Color into Target by Blend
+	static void MergeColor(UINT &Target, UINT Color, const BlendState &Blend)
+	{
+		if (Blend.IsOpaque())
+		{
+			Target = Color;
+		}
+		else
+		{
+			BlendSpan(&Target, &Color, 1, Blend);
+		}
+	}
+
+	// With FastClear set only the tiles are flagged, each one takes the values on its first use or in Resolve
 	void Clear(UINT Color = 0, FLOAT Depth = 1.0f)
 	{
+		ClearColor = Color;
+		ClearDepth = Depth;
+		HiZ.Clear(Depth);
+		HiZDirty.Clear();
+		ColorCleared.Clear(FastClear);
+		DepthCleared.Clear(FastClear);
+		if (FastClear)
+		{
+			return;
+		}
+
 		RT1.Clear(Color);
 		DepthBuffer.Clear(Depth);
+		// the color samples are left as they are, compressed pixels take theirs from RT1
+		Compressed.Clear(TRUE);
+	}
+
+	// Flags a block whose depth changed, its max is rebuilt on the next query
+	void MarkHiZDirty(UINT BlockX, UINT BlockY)
+	{
+		HiZDirty.Pixels[BlockY * HiZDirty.Width + BlockX] = TRUE;
+	}
+
+	// Conservative max depth of a block, nothing in it is farther than the returned value
+	FLOAT GetHiZ(UINT BlockX, UINT BlockY)
+	{
+		UINT index = BlockY * HiZ.Width + BlockX;
+		if (HiZDirty.Pixels[index])
+		{
+			UINT startX = BlockX * HiZBlockSize;
+			UINT startY = BlockY * HiZBlockSize;
+			UINT endX = std::min(startX + HiZBlockSize, Width);
+			UINT endY = std::min(startY + HiZBlockSize, Height);
+
+			// every sample of the block's pixels
+			UINT pitch = DepthBuffer.Width;
+			FLOAT maxDepth = DepthBuffer.Pixels[startY * pitch + startX * SampleCount];
+			for (UINT y = startY; y < endY; ++y)
+			{
+				for (UINT x = startX * SampleCount; x < endX * SampleCount; ++x)
+				{
+					maxDepth = std::max(maxDepth, DepthBuffer.Pixels[y * pitch + x]);
+				}
+			}
+
+			HiZ.Pixels[index] = maxDepth;
+			HiZDirty.Pixels[index] = FALSE;
+		}
+		return HiZ.Pixels[index];
 	}
 
 	BOOL DepthEnable = FALSE;
+	// output merger state of draws and SetPixel, opaque by default
+	BlendState Blend;
+	// Clear defers to the first use of each tile, RT1 and DepthBuffer must then only be written through
+	// SetPixel or a Rasterizer, and RT1 read after Rasterizer::Flush
+	BOOL FastClear = FALSE;
+	// values of the last Clear
+	UINT ClearColor = 0;
+	FLOAT ClearDepth = 1.0f;
 
 	Texture2D<UINT> RT1;
+	// SampleCount depths per pixel, the samples of a pixel are consecutive
 	Texture2D<FLOAT> DepthBuffer;
+	// max depth per HiZBlockSize x HiZBlockSize block of DepthBuffer, only valid for blocks not flagged in HiZDirty
+	Texture2D<FLOAT> HiZ;
+	Texture2D<BYTE> HiZDirty;
+	// index of the primitive that covers each pixel, written by the visibility pass and reset once the pixel is shaded
+	Texture2D<UINT> VisibilityBuffer;
+	// SampleCount colors per pixel laid out like DepthBuffer, only valid for pixels not flagged in Compressed
+	Texture2D<UINT> ColorSamples;
+	// TRUE for pixels whose samples all hold their color in RT1
+	Texture2D<BYTE> Compressed;
+	// TRUE per ClearTileSize x ClearTileSize tile of RT1 or DepthBuffer that still holds stale values in place of the last fast clear
+	Texture2D<BYTE> ColorCleared;
+	Texture2D<BYTE> DepthCleared;
 	UINT Width, Height;
+	UINT SampleCount;
 	UINT64 NumPixels;
 };
 
-int Save(const Texture2D<UINT> &Image, int NumChannels);
\ No newline at end of file
+// Writes the image to pPath as PNG, QOI, PPM or PFM by its extension, Debug.png or Release.png without a path.
+// NumChannels 4 keeps alpha in PNG and QOI. Returns EXIT_SUCCESS or EXIT_FAILURE.
+int Save(const Texture2D<UINT> &Image, int NumChannels, const char *pPath = nullptr);
\ No newline at end of file
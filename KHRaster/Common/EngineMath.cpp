@@ -1,4 +1,6 @@
 #include "EngineMath.h"
+#include "CpuFeatures.h"
+#include <immintrin.h>
 
 //////////////////////////////////////////////////////////////////////////
 // Common math functions
@@ -224,14 +226,15 @@ float Vector_Length(Vec4 v)
 Vec4 Vector_Normalize(Vec4 v)
 {
 	Vec4 normalizeVec = {};
-	if (IsZero(Vector_Length(v)))
+	float length = Vector_Length(v);
+	if (IsZero(length))
 	{
 		return normalizeVec;
 	}
 
 	for (size_t i = 0; i < 4; i++)
 	{
-		normalizeVec.e[i] = v.e[i] / Vector_Length(v);
+		normalizeVec.e[i] = v.e[i] / length;
 	}
 
 	return normalizeVec;
@@ -613,6 +616,30 @@ Vec4 Matrix_Vector_Multiply(Matrix4x4 m, Vec4 v)
 	return MVMultiply;
 }
 
+// Scalar reference of Vector_Matrix_Multiply
+static Vec4 Vector_Matrix_Multiply_Scalar(Vec4 v, Matrix4x4 m)
+{
+	// same as [m]^T*v, without building the transpose
+	Vec4 VMMultiply = {(v.x * m._e11) + (v.y * m._e21) + (v.z * m._e31) + (v.w * m._e41),
+					   (v.x * m._e12) + (v.y * m._e22) + (v.z * m._e32) + (v.w * m._e42),
+					   (v.x * m._e13) + (v.y * m._e23) + (v.z * m._e33) + (v.w * m._e43),
+					   (v.x * m._e14) + (v.y * m._e24) + (v.z * m._e34) + (v.w * m._e44)};
+	return VMMultiply;
+}
+
+// Sum of the rows of m scaled by the components of v, in the same order as the scalar version
+static Vec4 Vector_Matrix_Multiply_SSE2(Vec4 v, Matrix4x4 m)
+{
+	__m128 row = _mm_mul_ps(_mm_set1_ps(v.x), _mm_loadu_ps(&m.e[0]));
+	row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(v.y), _mm_loadu_ps(&m.e[4])));
+	row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(v.z), _mm_loadu_ps(&m.e[8])));
+	row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(v.w), _mm_loadu_ps(&m.e[12])));
+
+	Vec4 VMMultiply;
+	_mm_storeu_ps(VMMultiply.e, row);
+	return VMMultiply;
+}
+
 // Multipy a vector and a matrix
 //
 // IN:		v		The vector ( left hand side)
@@ -621,8 +648,59 @@ Vec4 Matrix_Vector_Multiply(Matrix4x4 m, Vec4 v)
 // RETURN:	v*[m]
 Vec4 Vector_Matrix_Multiply(Vec4 v, Matrix4x4 m)
 {
-	return Matrix_Vector_Multiply(Matrix_Transpose(m), v);
+	// a single row gains nothing from 8 lanes
+	static const auto kernel = GetSimdLevel() >= SimdSSE2 ? Vector_Matrix_Multiply_SSE2 : Vector_Matrix_Multiply_Scalar;
+	return kernel(v, m);
+}
+
+// Scalar reference of Matrix_Matrix_Multiply
+static Matrix4x4 Matrix_Matrix_Multiply_Scalar(Matrix4x4 m, Matrix4x4 n)
+{
+	Matrix4x4 matrixMultiply = {(m._e11 * n._e11) + (m._e12 * n._e21) + (m._e13 * n._e31) + (m._e14 * n._e41), (m._e11 * n._e12) + (m._e12 * n._e22) + (m._e13 * n._e32) + (m._e14 * n._e42), (m._e11 * n._e13) + (m._e12 * n._e23) + (m._e13 * n._e33) + (m._e14 * n._e43), (m._e11 * n._e14) + (m._e12 * n._e24) + (m._e13 * n._e34) + (m._e14 * n._e44),
+								(m._e21 * n._e11) + (m._e22 * n._e21) + (m._e23 * n._e31) + (m._e24 * n._e41), (m._e21 * n._e12) + (m._e22 * n._e22) + (m._e23 * n._e32) + (m._e24 * n._e42), (m._e21 * n._e13) + (m._e22 * n._e23) + (m._e23 * n._e33) + (m._e24 * n._e43), (m._e21 * n._e14) + (m._e22 * n._e24) + (m._e23 * n._e34) + (m._e24 * n._e44),
+								(m._e31 * n._e11) + (m._e32 * n._e21) + (m._e33 * n._e31) + (m._e34 * n._e41), (m._e31 * n._e12) + (m._e32 * n._e22) + (m._e33 * n._e32) + (m._e34 * n._e42), (m._e31 * n._e13) + (m._e32 * n._e23) + (m._e33 * n._e33) + (m._e34 * n._e43), (m._e31 * n._e14) + (m._e32 * n._e24) + (m._e33 * n._e34) + (m._e34 * n._e44),
+								(m._e41 * n._e11) + (m._e42 * n._e21) + (m._e43 * n._e31) + (m._e44 * n._e41), (m._e41 * n._e12) + (m._e42 * n._e22) + (m._e43 * n._e32) + (m._e44 * n._e42), (m._e41 * n._e13) + (m._e42 * n._e23) + (m._e43 * n._e33) + (m._e44 * n._e43), (m._e41 * n._e14) + (m._e42 * n._e24) + (m._e43 * n._e34) + (m._e44 * n._e44)};
+	return matrixMultiply;
+}
+
+// Each row of the result is the row of m multiplied by n
+static Matrix4x4 Matrix_Matrix_Multiply_SSE2(Matrix4x4 m, Matrix4x4 n)
+{
+	Matrix4x4 matrixMultiply;
+	for (int i = 0; i < 4; ++i)
+	{
+		Vec4 row = {m.e[i * 4 + 0], m.e[i * 4 + 1], m.e[i * 4 + 2], m.e[i * 4 + 3]};
+		Vec4 product = Vector_Matrix_Multiply_SSE2(row, n);
+		for (int j = 0; j < 4; ++j)
+		{
+			matrixMultiply.e[i * 4 + j] = product.e[j];
+		}
+	}
+	return matrixMultiply;
+}
+
+// Two rows of the result at a time, the upper lanes work on the odd row
+TARGET_AVX2 static Matrix4x4 Matrix_Matrix_Multiply_AVX2(Matrix4x4 m, Matrix4x4 n)
+{
+	__m256 n1 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(&n.e[0]));
+	__m256 n2 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(&n.e[4]));
+	__m256 n3 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(&n.e[8]));
+	__m256 n4 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(&n.e[12]));
+
+	Matrix4x4 matrixMultiply;
+	for (int i = 0; i < 4; i += 2)
+	{
+		const float *r0 = &m.e[i * 4];
+		const float *r1 = &m.e[i * 4 + 4];
+		__m256 rows = _mm256_mul_ps(_mm256_setr_ps(r0[0], r0[0], r0[0], r0[0], r1[0], r1[0], r1[0], r1[0]), n1);
+		rows = _mm256_add_ps(rows, _mm256_mul_ps(_mm256_setr_ps(r0[1], r0[1], r0[1], r0[1], r1[1], r1[1], r1[1], r1[1]), n2));
+		rows = _mm256_add_ps(rows, _mm256_mul_ps(_mm256_setr_ps(r0[2], r0[2], r0[2], r0[2], r1[2], r1[2], r1[2], r1[2]), n3));
+		rows = _mm256_add_ps(rows, _mm256_mul_ps(_mm256_setr_ps(r0[3], r0[3], r0[3], r0[3], r1[3], r1[3], r1[3], r1[3]), n4));
+		_mm256_storeu_ps(&matrixMultiply.e[i * 4], rows);
+	}
+	return matrixMultiply;
 }
+
 // Multiply a matrix by a matrix
 //
 // IN:		m		First Matrix (left hand side)
@@ -631,11 +709,9 @@ Vec4 Vector_Matrix_Multiply(Vec4 v, Matrix4x4 m)
 // RETURN:	[m]*[n]
 Matrix4x4 Matrix_Matrix_Multiply(Matrix4x4 m, Matrix4x4 n)
 {
-	Matrix4x4 matrixMultiply = {(m._e11 * n._e11) + (m._e12 * n._e21) + (m._e13 * n._e31) + (m._e14 * n._e41), (m._e11 * n._e12) + (m._e12 * n._e22) + (m._e13 * n._e32) + (m._e14 * n._e42), (m._e11 * n._e13) + (m._e12 * n._e23) + (m._e13 * n._e33) + (m._e14 * n._e43), (m._e11 * n._e14) + (m._e12 * n._e24) + (m._e13 * n._e34) + (m._e14 * n._e44),
-								(m._e21 * n._e11) + (m._e22 * n._e21) + (m._e23 * n._e31) + (m._e24 * n._e41), (m._e21 * n._e12) + (m._e22 * n._e22) + (m._e23 * n._e32) + (m._e24 * n._e42), (m._e21 * n._e13) + (m._e22 * n._e23) + (m._e23 * n._e33) + (m._e24 * n._e43), (m._e21 * n._e14) + (m._e22 * n._e24) + (m._e23 * n._e34) + (m._e24 * n._e44),
-								(m._e31 * n._e11) + (m._e32 * n._e21) + (m._e33 * n._e31) + (m._e34 * n._e41), (m._e31 * n._e12) + (m._e32 * n._e22) + (m._e33 * n._e32) + (m._e34 * n._e42), (m._e31 * n._e13) + (m._e32 * n._e23) + (m._e33 * n._e33) + (m._e34 * n._e43), (m._e31 * n._e14) + (m._e32 * n._e24) + (m._e33 * n._e34) + (m._e34 * n._e44),
-								(m._e41 * n._e11) + (m._e42 * n._e21) + (m._e43 * n._e31) + (m._e44 * n._e41), (m._e41 * n._e12) + (m._e42 * n._e22) + (m._e43 * n._e32) + (m._e44 * n._e42), (m._e41 * n._e13) + (m._e42 * n._e23) + (m._e43 * n._e33) + (m._e44 * n._e43), (m._e41 * n._e14) + (m._e42 * n._e24) + (m._e43 * n._e34) + (m._e44 * n._e44)};
-	return matrixMultiply;
+	static Matrix4x4 (*const kernels[])(Matrix4x4, Matrix4x4) = {Matrix_Matrix_Multiply_Scalar, Matrix_Matrix_Multiply_SSE2, Matrix_Matrix_Multiply_AVX2};
+	static const auto kernel = kernels[GetSimdLevel()];
+	return kernel(m, n);
 }
 
 ////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,162 @@
+#include "FrameScheduler.h"
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+
+#ifdef _WIN32
+#include <timeapi.h>
+#if defined(_MSC_VER)
+#pragma comment(lib, "winmm.lib")
+#endif
+#endif
+
+// Bounds of the spun stretch before a deadline. Sleeps that overshoot by more than the max make the frame late
+// instead of burning the core, Windows gets a 1 ms scheduler period so that they do not.
+static const long long MinSpinTicks = GetTimerFrequency() / 20000; // 50 us
+static const long long MaxSpinTicks = GetTimerFrequency() / 500;   // 2 ms
+
+static std::chrono::steady_clock::time_point ToTimePoint(long long Ticks)
+{
+	return std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(Ticks));
+}
+
+// KHRASTER_PACING and KHRASTER_FRAME_RATE replace the pacing given by the application
+static void ApplyOverride(FRAME_PACING &Pacing, double &TargetHz)
+{
+	char value[32] = {};
+	if (GetEnvironmentValue("KHRASTER_PACING", value, sizeof(value)))
+	{
+		static const struct
+		{
+			const char *pName;
+			FRAME_PACING Pacing;
+		} names[] = {{"fixed", FramePacingFixedRate}, {"uncapped", FramePacingUncapped}, {"ondemand", FramePacingOnDemand}};
+		bool known = false;
+		for (const auto &name : names)
+		{
+			if (strcmp(value, name.pName) == 0)
+			{
+				Pacing = name.Pacing;
+				known = true;
+			}
+		}
+		if (!known)
+		{
+			fprintf(stderr, "FrameScheduler: unknown KHRASTER_PACING '%s', expected fixed, uncapped or ondemand\n", value);
+		}
+	}
+
+	if (GetEnvironmentValue("KHRASTER_FRAME_RATE", value, sizeof(value)))
+	{
+		double rate = atof(value);
+		if (rate > 0.0)
+		{
+			TargetHz = rate;
+		}
+		else
+		{
+			fprintf(stderr, "FrameScheduler: KHRASTER_FRAME_RATE '%s' is not a positive rate\n", value);
+		}
+	}
+}
+
+FrameScheduler::FrameScheduler(FRAME_PACING Pacing, double TargetHz)
+	: SpinTicks(GetTimerFrequency() / 1000)
+{
+#ifdef _WIN32
+	timeBeginPeriod(1);
+#endif
+	ApplyOverride(Pacing, TargetHz);
+	SetPacing(Pacing, TargetHz);
+}
+
+FrameScheduler::~FrameScheduler()
+{
+#ifdef _WIN32
+	timeEndPeriod(1);
+#endif
+}
+
+void FrameScheduler::SetPacing(FRAME_PACING Pacing, double TargetHz)
+{
+	this->Pacing = Pacing;
+	this->TargetHz = std::max(TargetHz, 1.0);
+	Period = static_cast<long long>(double(GetTimerFrequency()) / this->TargetHz);
+	// the first frame is due right away
+	Deadline = GetTimerTicks();
+	Invalidate();
+}
+
+void FrameScheduler::WaitForFrame()
+{
+	if (Pacing == FramePacingUncapped)
+	{
+		return;
+	}
+
+	// on demand sleeps the same way, a scene invalidated every frame then animates at the fixed rate
+	SleepUntil(Deadline);
+
+	// a late frame moves the following ones instead of making them catch up
+	Deadline = std::max(Deadline + Period, GetTimerTicks());
+}
+
+void FrameScheduler::SleepUntil(long long Until)
+{
+	long long wakeUp = Until - SpinTicks;
+	if (GetTimerTicks() < wakeUp)
+	{
+		std::this_thread::sleep_until(ToTimePoint(wakeUp));
+		// follow a larger overshoot right away, let the margin shrink back slowly
+		long long overshoot = GetTimerTicks() - wakeUp;
+		SpinTicks = std::clamp(std::max(overshoot, SpinTicks - SpinTicks / 16), MinSpinTicks, MaxSpinTicks);
+	}
+
+	while (GetTimerTicks() < Until)
+	{
+		std::this_thread::yield();
+	}
+}
+
+bool FrameScheduler::BeginFrame()
+{
+	if (!Dirty.exchange(false) && Pacing == FramePacingOnDemand)
+	{
+		return false;
+	}
+
+	FrameStartTicks = GetTimerTicks();
+	FrameStartCpu = GetProcessCpuTime();
+	LastFrame.Delta = FrameCount ? double(FrameStartTicks - PreviousStartTicks) / double(GetTimerFrequency()) : 0.0;
+	PreviousStartTicks = FrameStartTicks;
+	return true;
+}
+
+void FrameScheduler::EndFrame()
+{
+	LastFrame.WallTime = double(GetTimerTicks() - FrameStartTicks) / double(GetTimerFrequency());
+	LastFrame.CpuTime = GetProcessCpuTime() - FrameStartCpu;
+
+	TotalTimes.Delta += LastFrame.Delta;
+	TotalTimes.WallTime += LastFrame.WallTime;
+	TotalTimes.CpuTime += LastFrame.CpuTime;
+	++FrameCount;
+}
+
+void FrameScheduler::Invalidate()
+{
+	Dirty = true;
+}
+
+FrameTimes FrameScheduler::GetAverage() const
+{
+	FrameTimes average;
+	if (FrameCount)
+	{
+		// the first frame has no delta
+		average.Delta = FrameCount > 1 ? TotalTimes.Delta / double(FrameCount - 1) : 0.0;
+		average.WallTime = TotalTimes.WallTime / double(FrameCount);
+		average.CpuTime = TotalTimes.CpuTime / double(FrameCount);
+	}
+	return average;
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include <atomic>
+
+#include "Platform.h"
+
+///////////////////////////////////////////////////
+//	FramePacingFixedRate	: frames start TargetHz times a second,
+//							  the thread sleeps until each start
+//	FramePacingUncapped		: frames start as soon as the previous
+//							  one has ended
+//	FramePacingOnDemand		: frames start at most TargetHz times
+//							  a second and only after Invalidate,
+//							  WaitForFrame still wakes at that rate
+//							  so that inputs are polled. Animated
+//							  scenes invalidate every frame
+///////////////////////////////////////////////////
+enum FRAME_PACING
+{
+	FramePacingFixedRate,
+	FramePacingUncapped,
+	FramePacingOnDemand
+};
+
+// Wall and CPU times of frames in seconds. CPU time counts every thread of the process, the rasterizer
+// workers included, so it can exceed the wall time.
+struct FrameTimes
+{
+	// start of the frame to the start of the previous one
+	double Delta = 0.0;
+	// BeginFrame to EndFrame
+	double WallTime = 0.0;
+	double CpuTime = 0.0;
+};
+
+// Paces a render loop without spinning on the clock:
+//
+//	while (Running)
+//	{
+//		Scheduler.WaitForFrame();
+//		// poll inputs, Invalidate when they change
+//		if (Scheduler.BeginFrame())
+//		{
+//			// render and present
+//			Scheduler.EndFrame();
+//		}
+//	}
+//
+// KHRASTER_PACING=fixed|uncapped|ondemand and KHRASTER_FRAME_RATE=<Hz> in the environment override the
+// pacing the scheduler is created with.
+class FrameScheduler
+{
+public:
+	explicit FrameScheduler(FRAME_PACING Pacing = FramePacingFixedRate, double TargetHz = 60.0);
+	~FrameScheduler();
+
+	FrameScheduler(const FrameScheduler &) = delete;
+	FrameScheduler &operator=(const FrameScheduler &) = delete;
+
+	void SetPacing(FRAME_PACING Pacing, double TargetHz);
+
+	// Sleeps until the next frame is due. The last stretch before the deadline is spun, only as long as
+	// sleeping has been seen to overshoot.
+	void WaitForFrame();
+
+	// Starts timing a frame, false on demand when nothing was invalidated since the last frame
+	bool BeginFrame();
+
+	void EndFrame();
+
+	// Asks for a frame with on demand pacing, callable from any thread
+	void Invalidate();
+
+	FRAME_PACING GetPacing() const { return Pacing; }
+	double GetTargetHz() const { return TargetHz; }
+
+	const FrameTimes &GetLastFrame() const { return LastFrame; }
+	// average over every frame so far
+	FrameTimes GetAverage() const;
+	unsigned long long GetFrameCount() const { return FrameCount; }
+
+private:
+	void SleepUntil(long long Until);
+
+	FRAME_PACING Pacing;
+	double TargetHz;
+	// ticks of GetTimerTicks between frames
+	long long Period = 0;
+	// start of the next frame
+	long long Deadline = 0;
+
+	// how far sleeping has recently overshot its wake up, that much is spun instead
+	long long SpinTicks = 0;
+
+	std::atomic_bool Dirty = true;
+
+	long long FrameStartTicks = 0;
+	long long PreviousStartTicks = 0;
+	double FrameStartCpu = 0.0;
+	FrameTimes LastFrame;
+	FrameTimes TotalTimes;
+	unsigned long long FrameCount = 0;
+};
@@ -0,0 +1,768 @@
+#include "ImageExport.h"
+#include "SimdKernels.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+
+// Rows of a PNG strip or of a raw repack task are chosen by bytes so that a strip is worth a task
+static constexpr size_t StripBytes = 256 * 1024;
+
+static UINT GetRowsPerStrip(size_t RowBytes)
+{
+	return static_cast<UINT>(std::max<size_t>(StripBytes / std::max<size_t>(RowBytes, 1), 1));
+}
+
+static FILE *OpenFile(const char *pPath)
+{
+#if defined(_MSC_VER)
+	FILE *pFile = nullptr;
+	return fopen_s(&pFile, pPath, "wb") == 0 ? pFile : nullptr;
+#else
+	return fopen(pPath, "wb");
+#endif
+}
+
+static void StoreBigEndian(BYTE *p, UINT Value)
+{
+	p[0] = static_cast<BYTE>(Value >> 24);
+	p[1] = static_cast<BYTE>(Value >> 16);
+	p[2] = static_cast<BYTE>(Value >> 8);
+	p[3] = static_cast<BYTE>(Value);
+}
+
+static void PackPixels(BYTE *pDst, const UINT *pSrc, size_t Count, UINT NumChannels)
+{
+	if (NumChannels == 4)
+	{
+		PackRGBA8(pDst, pSrc, Count);
+	}
+	else
+	{
+		PackRGB8(pDst, pSrc, Count);
+	}
+}
+
+IMAGE_FORMAT GetImageFormat(const char *pPath)
+{
+	const char *pExtension = pPath ? strrchr(pPath, '.') : nullptr;
+	if (!pExtension)
+	{
+		return ImageFormatPNG;
+	}
+
+	char extension[8] = {};
+	for (size_t i = 0; i + 1 < sizeof(extension) && pExtension[i]; ++i)
+	{
+		extension[i] = static_cast<char>(tolower(static_cast<unsigned char>(pExtension[i])));
+	}
+	static const struct
+	{
+		const char *pExtension;
+		IMAGE_FORMAT Format;
+	} formats[] = {{".qoi", ImageFormatQOI}, {".ppm", ImageFormatPPM}, {".pfm", ImageFormatPFM}};
+	for (const auto &format : formats)
+	{
+		if (strcmp(extension, format.pExtension) == 0)
+		{
+			return format.Format;
+		}
+	}
+	return ImageFormatPNG;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Checksums
+//////////////////////////////////////////////////////////////////////////
+
+static UINT UpdateCrc(UINT Crc, const BYTE *p, size_t Count)
+{
+	static const struct CrcTable
+	{
+		UINT Values[256];
+		CrcTable()
+		{
+			for (UINT i = 0; i < 256; ++i)
+			{
+				UINT c = i;
+				for (int k = 0; k < 8; ++k)
+				{
+					c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+				}
+				Values[i] = c;
+			}
+		}
+	} table;
+
+	Crc = ~Crc;
+	for (size_t i = 0; i < Count; ++i)
+	{
+		Crc = table.Values[(Crc ^ p[i]) & 0xff] ^ (Crc >> 8);
+	}
+	return ~Crc;
+}
+
+static constexpr UINT AdlerBase = 65521;
+
+static UINT UpdateAdler(UINT Adler, const BYTE *p, size_t Count)
+{
+	UINT a = Adler & 0xffff;
+	UINT b = Adler >> 16;
+	while (Count)
+	{
+		// the most bytes before b can overflow 32 bits
+		size_t block = std::min<size_t>(Count, 5552);
+		Count -= block;
+		for (size_t i = 0; i < block; ++i)
+		{
+			a += p[i];
+			b += a;
+		}
+		p += block;
+		a %= AdlerBase;
+		b %= AdlerBase;
+	}
+	return (b << 16) | a;
+}
+
+// Adler-32 of two byte ranges put together, from the sums of each and the length of the second
+static UINT CombineAdler(UINT Adler1, UINT Adler2, size_t Length2)
+{
+	UINT remainder = static_cast<UINT>(Length2 % AdlerBase);
+	UINT a = (Adler1 & 0xffff) + (Adler2 & 0xffff) + AdlerBase - 1;
+	UINT b = static_cast<UINT>((uint64_t(remainder) * (Adler1 & 0xffff)) % AdlerBase) + (Adler1 >> 16) + (Adler2 >> 16) + AdlerBase - remainder;
+	return ((b % AdlerBase) << 16) | (a % AdlerBase);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Deflate
+//////////////////////////////////////////////////////////////////////////
+
+// Writes bits from the least significant one up, Huffman codes are reversed ahead of time
+struct BitWriter
+{
+	BYTE *p;
+	uint64_t Bits = 0;
+	int Count = 0;
+
+	// at most 32 bits at a time
+	void Put(UINT Value, int NumBits)
+	{
+		Bits |= uint64_t(Value) << Count;
+		Count += NumBits;
+		if (Count >= 32)
+		{
+			for (int i = 0; i < 4; ++i)
+			{
+				*p++ = static_cast<BYTE>(Bits >> (i * 8));
+			}
+			Bits >>= 32;
+			Count -= 32;
+		}
+	}
+
+	void AlignToByte()
+	{
+		while (Count > 0)
+		{
+			*p++ = static_cast<BYTE>(Bits);
+			Bits >>= 8;
+			Count -= 8;
+		}
+		Bits = 0;
+		Count = 0;
+	}
+};
+
+// Codes of the fixed Huffman tables with their extra bits folded in, ready for BitWriter
+struct FixedCodes
+{
+	static constexpr int MinMatch = 4;
+	static constexpr int MaxMatch = 258;
+	static constexpr int MaxDistance = 32768;
+
+	UINT Literal[257];
+	int LiteralBits[257];
+	// indexed by length, 3 to 258
+	UINT Length[MaxMatch + 1];
+	int LengthBits[MaxMatch + 1];
+	// indexed by distance - 1 up to 256, then by (distance - 1) >> 7
+	BYTE DistanceCode[512];
+
+	static UINT Reverse(UINT Code, int NumBits)
+	{
+		UINT reversed = 0;
+		for (int i = 0; i < NumBits; ++i)
+		{
+			reversed |= ((Code >> i) & 1) << (NumBits - 1 - i);
+		}
+		return reversed;
+	}
+
+	static void LiteralCode(UINT Symbol, UINT &Code, int &NumBits)
+	{
+		if (Symbol < 144)
+		{
+			Code = 0x30 + Symbol, NumBits = 8;
+		}
+		else if (Symbol < 256)
+		{
+			Code = 0x190 + Symbol - 144, NumBits = 9;
+		}
+		else if (Symbol < 280)
+		{
+			Code = Symbol - 256, NumBits = 7;
+		}
+		else
+		{
+			Code = 0xc0 + Symbol - 280, NumBits = 8;
+		}
+		Code = Reverse(Code, NumBits);
+	}
+
+	FixedCodes()
+	{
+		for (UINT symbol = 0; symbol < 257; ++symbol)
+		{
+			LiteralCode(symbol, Literal[symbol], LiteralBits[symbol]);
+		}
+
+		for (UINT symbol = 0, length = 3; symbol < 29; ++symbol)
+		{
+			UINT extra = symbol < 8 || symbol == 28 ? 0 : (symbol - 4) / 4;
+			UINT count = symbol == 28 ? 1 : 1u << extra;
+			// 258 has a symbol of its own, the extra bits of the one before stop short of it
+			for (UINT i = 0; i < count && length <= MaxMatch; ++i, ++length)
+			{
+				if (symbol == 27 && length == MaxMatch)
+				{
+					break;
+				}
+				UINT code;
+				int bits;
+				LiteralCode(257 + symbol, code, bits);
+				Length[length] = code | (i << bits);
+				LengthBits[length] = bits + static_cast<int>(extra);
+			}
+		}
+
+		for (UINT symbol = 0, distance = 0; symbol < 30; ++symbol)
+		{
+			UINT extra = symbol < 4 ? 0 : (symbol - 2) / 2;
+			for (UINT i = 0; i < (1u << extra); ++i, ++distance)
+			{
+				if (distance < 256)
+				{
+					DistanceCode[distance] = static_cast<BYTE>(symbol);
+				}
+				else
+				{
+					DistanceCode[256 + (distance >> 7)] = static_cast<BYTE>(symbol);
+				}
+			}
+		}
+	}
+
+	void PutDistance(BitWriter &Writer, UINT Distance) const
+	{
+		static const UINT bases[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+									   257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+		UINT d = Distance - 1;
+		UINT symbol = d < 256 ? DistanceCode[d] : DistanceCode[256 + (d >> 7)];
+		int extra = symbol < 4 ? 0 : static_cast<int>(symbol - 2) / 2;
+		Writer.Put(Reverse(symbol, 5) | ((Distance - bases[symbol]) << 5), 5 + extra);
+	}
+};
+
+static UINT Load32(const BYTE *p)
+{
+	UINT value;
+	memcpy(&value, p, 4);
+	return value;
+}
+
+// Largest deflate output of Count bytes, fixed codes spend at most 9 bits on a byte
+static size_t GetDeflateBound(size_t Count)
+{
+	return Count + Count / 8 + (Count / 65535 + 1) * 5 + 16;
+}
+
+// One deflate block with fixed codes. Matches are found with one probe of a hash table of the last position of
+// every 4 bytes, which finds the long runs of repeated rows and flat color that rendered frames are made of.
+static BYTE *DeflateFast(BYTE *pDst, const BYTE *pSrc, size_t Count, bool Final)
+{
+	static const FixedCodes codes;
+	static constexpr int HashBits = 14;
+	std::vector<int> head(size_t(1) << HashBits, -FixedCodes::MaxDistance - 1);
+
+	BitWriter writer = {pDst};
+	writer.Put(Final ? 3 : 2, 3);
+
+	size_t i = 0;
+	while (i + FixedCodes::MinMatch <= Count)
+	{
+		UINT value = Load32(pSrc + i);
+		UINT hash = (value * 2654435761u) >> (32 - HashBits);
+		int candidate = head[hash];
+		head[hash] = static_cast<int>(i);
+
+		size_t distance = i - candidate;
+		if (distance <= FixedCodes::MaxDistance && Load32(pSrc + candidate) == value)
+		{
+			size_t length = FixedCodes::MinMatch;
+			size_t maxLength = std::min<size_t>(FixedCodes::MaxMatch, Count - i);
+			while (length < maxLength && pSrc[candidate + length] == pSrc[i + length])
+			{
+				++length;
+			}
+			writer.Put(codes.Length[length], codes.LengthBits[length]);
+			codes.PutDistance(writer, static_cast<UINT>(distance));
+			i += length;
+		}
+		else
+		{
+			writer.Put(codes.Literal[pSrc[i]], codes.LiteralBits[pSrc[i]]);
+			++i;
+		}
+	}
+	for (; i < Count; ++i)
+	{
+		writer.Put(codes.Literal[pSrc[i]], codes.LiteralBits[pSrc[i]]);
+	}
+	// end of block
+	writer.Put(codes.Literal[256], codes.LiteralBits[256]);
+
+	// an empty stored block ends the strip on a byte so that the next one can be appended as it is
+	if (!Final)
+	{
+		writer.Put(0, 3);
+		writer.AlignToByte();
+		const BYTE empty[4] = {0x00, 0x00, 0xff, 0xff};
+		memcpy(writer.p, empty, 4);
+		return writer.p + 4;
+	}
+	writer.AlignToByte();
+	return writer.p;
+}
+
+static BYTE *DeflateStored(BYTE *pDst, const BYTE *pSrc, size_t Count, bool Final)
+{
+	do
+	{
+		size_t block = std::min<size_t>(Count, 65535);
+		Count -= block;
+		pDst[0] = Final && Count == 0 ? 1 : 0;
+		pDst[1] = static_cast<BYTE>(block);
+		pDst[2] = static_cast<BYTE>(block >> 8);
+		pDst[3] = static_cast<BYTE>(~block);
+		pDst[4] = static_cast<BYTE>(~block >> 8);
+		memcpy(pDst + 5, pSrc, block);
+		pDst += 5 + block;
+		pSrc += block;
+	} while (Count);
+	return pDst;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// ImageExporter
+//////////////////////////////////////////////////////////////////////////
+
+ImageExporter::ImageExporter(UINT NumThreads, UINT MaxPending)
+	: Pool(std::max(NumThreads, 1u)), MaxPending(std::max(MaxPending, 1u))
+{
+}
+
+ImageExporter::~ImageExporter()
+{
+	{
+		std::unique_lock<std::mutex> lock(Mutex);
+		Exit = true;
+	}
+	JobQueued.notify_all();
+	if (Encoder.joinable())
+	{
+		Encoder.join();
+	}
+}
+
+bool ImageExporter::ExportAsync(const UINT *pPixels, UINT Width, UINT Height, UINT Pitch, const char *pPath, const ImageExportDesc &Desc)
+{
+	Job job;
+	{
+		std::unique_lock<std::mutex> lock(Mutex);
+		JobDone.wait(lock, [&]()
+					 { return Pending < MaxPending || Failed; });
+		if (Failed)
+		{
+			return false;
+		}
+		++Pending;
+		if (!Encoder.joinable())
+		{
+			Encoder = std::thread(&ImageExporter::EncoderLoop, this);
+		}
+	}
+
+	// the caller may render into the pixels as soon as this returns
+	FillJob(job, pPixels, Width, Height, Pitch, pPath, Desc);
+
+	{
+		std::unique_lock<std::mutex> lock(Mutex);
+		Queue.push_back(std::move(job));
+	}
+	JobQueued.notify_one();
+	return true;
+}
+
+bool ImageExporter::Flush()
+{
+	std::unique_lock<std::mutex> lock(Mutex);
+	JobDone.wait(lock, [&]()
+				 { return Pending == 0; });
+	bool succeeded = !Failed;
+	Failed = false;
+	return succeeded;
+}
+
+bool ImageExporter::Export(const UINT *pPixels, UINT Width, UINT Height, UINT Pitch, const char *pPath, const ImageExportDesc &Desc)
+{
+	{
+		// the encoder thread, if there is one, is idle once nothing is pending
+		std::unique_lock<std::mutex> lock(Mutex);
+		JobDone.wait(lock, [&]()
+					 { return Pending == 0 || Failed; });
+		if (Failed)
+		{
+			return false;
+		}
+	}
+
+	Job job;
+	FillJob(job, pPixels, Width, Height, Pitch, pPath, Desc);
+	bool written = Encode(job);
+
+	std::unique_lock<std::mutex> lock(Mutex);
+	FreeBuffers.push_back(std::move(job.Pixels));
+	return written;
+}
+
+void ImageExporter::FillJob(Job &Job, const UINT *pPixels, UINT Width, UINT Height, UINT Pitch, const char *pPath, const ImageExportDesc &Desc)
+{
+	{
+		std::unique_lock<std::mutex> lock(Mutex);
+		if (!FreeBuffers.empty())
+		{
+			Job.Pixels = std::move(FreeBuffers.back());
+			FreeBuffers.pop_back();
+		}
+	}
+
+	Job.Pixels.resize(size_t(Width) * Height);
+	for (UINT y = 0; y < Height; ++y)
+	{
+		memcpy(&Job.Pixels[size_t(y) * Width], pPixels + size_t(y) * Pitch, Width * sizeof(UINT));
+	}
+	Job.Width = Width;
+	Job.Height = Height;
+	Job.Path = pPath;
+	Job.Desc = Desc;
+}
+
+void ImageExporter::EncoderLoop()
+{
+	std::unique_lock<std::mutex> lock(Mutex);
+	while (true)
+	{
+		JobQueued.wait(lock, [&]()
+					   { return !Queue.empty() || Exit; });
+		// pending images are written before exiting
+		if (Queue.empty())
+		{
+			return;
+		}
+
+		Job job = std::move(Queue.front());
+		Queue.pop_front();
+		lock.unlock();
+		bool written = Encode(job);
+		lock.lock();
+
+		FreeBuffers.push_back(std::move(job.Pixels));
+		Failed = Failed || !written;
+		--Pending;
+		JobDone.notify_all();
+	}
+}
+
+bool ImageExporter::Encode(const Job &Job)
+{
+	FILE *pFile = OpenFile(Job.Path.c_str());
+	if (!pFile)
+	{
+		return false;
+	}
+
+	bool written = false;
+	switch (Job.Desc.Format)
+	{
+	case ImageFormatPNG:
+		written = EncodePNG(Job, pFile);
+		break;
+	case ImageFormatQOI:
+		written = EncodeQOI(Job, pFile);
+		break;
+	case ImageFormatPPM:
+	case ImageFormatPFM:
+		written = EncodeRaw(Job, pFile);
+		break;
+	}
+
+	written = fclose(pFile) == 0 && written;
+	if (!written)
+	{
+		// do not leave a truncated image behind
+		remove(Job.Path.c_str());
+	}
+	return written;
+}
+
+static bool WriteChunk(FILE *pFile, const char *pType, const BYTE *pData, UINT Size, UINT Crc)
+{
+	BYTE header[8];
+	StoreBigEndian(header, Size);
+	memcpy(header + 4, pType, 4);
+	BYTE crc[4];
+	StoreBigEndian(crc, Crc);
+	// IEND has no data and no pointer to it
+	return fwrite(header, 1, 8, pFile) == 8 && (Size == 0 || fwrite(pData, 1, Size, pFile) == Size) && fwrite(crc, 1, 4, pFile) == 4;
+}
+
+static bool WriteChunk(FILE *pFile, const char *pType, const BYTE *pData, UINT Size)
+{
+	return WriteChunk(pFile, pType, pData, Size, UpdateCrc(UpdateCrc(0, reinterpret_cast<const BYTE *>(pType), 4), pData, Size));
+}
+
+bool ImageExporter::EncodePNG(const Job &Job, FILE *pFile)
+{
+	const UINT numChannels = Job.Desc.NumChannels == 4 ? 4 : 3;
+	const size_t rowBytes = size_t(Job.Width) * numChannels;
+	const UINT rowsPerStrip = GetRowsPerStrip(rowBytes);
+	const UINT numStrips = (Job.Height + rowsPerStrip - 1) / rowsPerStrip;
+	const bool fast = Job.Desc.PngCompression == PngCompressionFast;
+	if (Strips.size() < numStrips)
+	{
+		Strips.resize(numStrips);
+	}
+
+	// every strip is an IDAT chunk of its own, the zlib header leads the first and the Adler-32 of all of them
+	// follows in one more
+	auto encodeStrip = [&](unsigned int Index)
+	{
+		Strip &strip = Strips[Index];
+		UINT firstRow = Index * rowsPerStrip;
+		UINT numRows = std::min(rowsPerStrip, Job.Height - firstRow);
+		const UINT *pPixels = Job.Pixels.data();
+
+		// filter type byte and the row, then the unfiltered row above and the current one
+		size_t filteredBytes = numRows * (rowBytes + 1);
+		strip.Rows.resize(filteredBytes + 2 * rowBytes);
+		BYTE *pAbove = strip.Rows.data() + filteredBytes;
+		BYTE *pRow = pAbove + rowBytes;
+		if (fast && firstRow > 0)
+		{
+			PackPixels(pAbove, pPixels + size_t(firstRow - 1) * Job.Width, Job.Width, numChannels);
+		}
+
+		for (UINT r = 0; r < numRows; ++r)
+		{
+			UINT y = firstRow + r;
+			BYTE *pFiltered = strip.Rows.data() + r * (rowBytes + 1);
+			if (!fast || y == 0)
+			{
+				pFiltered[0] = 0;
+				PackPixels(pFiltered + 1, pPixels + size_t(y) * Job.Width, Job.Width, numChannels);
+				if (fast)
+				{
+					memcpy(pAbove, pFiltered + 1, rowBytes);
+				}
+				continue;
+			}
+
+			// up filter, rows repeated from the one above become zeros
+			PackPixels(pRow, pPixels + size_t(y) * Job.Width, Job.Width, numChannels);
+			pFiltered[0] = 2;
+			for (size_t i = 0; i < rowBytes; ++i)
+			{
+				pFiltered[i + 1] = static_cast<BYTE>(pRow[i] - pAbove[i]);
+			}
+			std::swap(pAbove, pRow);
+		}
+		strip.Adler = UpdateAdler(1, strip.Rows.data(), filteredBytes);
+
+		strip.Data.resize(GetDeflateBound(filteredBytes) + 2);
+		BYTE *pData = strip.Data.data();
+		if (Index == 0)
+		{
+			// deflate with a 32 KiB window, fastest compression
+			*pData++ = 0x78;
+			*pData++ = 0x01;
+		}
+		bool final = Index + 1 == numStrips;
+		pData = fast ? DeflateFast(pData, strip.Rows.data(), filteredBytes, final) : DeflateStored(pData, strip.Rows.data(), filteredBytes, final);
+		strip.Data.resize(pData - strip.Data.data());
+		strip.Crc = UpdateCrc(UpdateCrc(0, reinterpret_cast<const BYTE *>("IDAT"), 4), strip.Data.data(), strip.Data.size());
+	};
+	Pool.ParallelFor(numStrips, encodeStrip);
+
+	static const BYTE signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+	BYTE header[13] = {};
+	StoreBigEndian(header, Job.Width);
+	StoreBigEndian(header + 4, Job.Height);
+	header[8] = 8;
+	// truecolor, with alpha for 4 channels
+	header[9] = numChannels == 4 ? 6 : 2;
+	bool written = fwrite(signature, 1, sizeof(signature), pFile) == sizeof(signature) && WriteChunk(pFile, "IHDR", header, sizeof(header));
+
+	UINT adler = 1;
+	for (UINT i = 0; i < numStrips && written; ++i)
+	{
+		const Strip &strip = Strips[i];
+		UINT numRows = std::min(rowsPerStrip, Job.Height - i * rowsPerStrip);
+		adler = CombineAdler(adler, strip.Adler, numRows * (rowBytes + 1));
+		written = WriteChunk(pFile, "IDAT", strip.Data.data(), static_cast<UINT>(strip.Data.size()), strip.Crc);
+	}
+	BYTE trailer[4];
+	StoreBigEndian(trailer, adler);
+	return written && WriteChunk(pFile, "IDAT", trailer, sizeof(trailer)) && WriteChunk(pFile, "IEND", nullptr, 0);
+}
+
+bool ImageExporter::EncodeQOI(const Job &Job, FILE *pFile)
+{
+	const UINT numChannels = Job.Desc.NumChannels == 4 ? 4 : 3;
+	const size_t numPixels = size_t(Job.Width) * Job.Height;
+	// every pixel fits in its channels and a tag, plus the header and the end marker
+	Output.resize(14 + numPixels * (numChannels + 1) + 8);
+	BYTE *p = Output.data();
+
+	memcpy(p, "qoif", 4);
+	StoreBigEndian(p + 4, Job.Width);
+	StoreBigEndian(p + 8, Job.Height);
+	p[12] = static_cast<BYTE>(numChannels);
+	// sRGB
+	p[13] = 0;
+	p += 14;
+
+	// pixels stay ARGB8, three channels read as opaque
+	const UINT alphaMask = numChannels == 4 ? 0 : 0xff000000;
+	UINT index[64] = {};
+	UINT previous = 0xff000000;
+	UINT run = 0;
+	for (size_t i = 0; i < numPixels; ++i)
+	{
+		UINT pixel = Job.Pixels[i] | alphaMask;
+		if (pixel == previous)
+		{
+			if (++run == 62 || i + 1 == numPixels)
+			{
+				*p++ = static_cast<BYTE>(0xc0 | (run - 1));
+				run = 0;
+			}
+			continue;
+		}
+		if (run)
+		{
+			*p++ = static_cast<BYTE>(0xc0 | (run - 1));
+			run = 0;
+		}
+
+		UINT r = (pixel >> 16) & 0xff, g = (pixel >> 8) & 0xff, b = pixel & 0xff, a = pixel >> 24;
+		UINT slot = (r * 3 + g * 5 + b * 7 + a * 11) % 64;
+		if (index[slot] == pixel)
+		{
+			*p++ = static_cast<BYTE>(slot);
+		}
+		else
+		{
+			index[slot] = pixel;
+			if ((pixel >> 24) == (previous >> 24))
+			{
+				int dr = static_cast<signed char>(r - ((previous >> 16) & 0xff));
+				int dg = static_cast<signed char>(g - ((previous >> 8) & 0xff));
+				int db = static_cast<signed char>(b - (previous & 0xff));
+				int drg = dr - dg;
+				int dbg = db - dg;
+				if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+				{
+					*p++ = static_cast<BYTE>(0x40 | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2));
+				}
+				else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7)
+				{
+					*p++ = static_cast<BYTE>(0x80 | (dg + 32));
+					*p++ = static_cast<BYTE>(((drg + 8) << 4) | (dbg + 8));
+				}
+				else
+				{
+					*p++ = 0xfe;
+					*p++ = static_cast<BYTE>(r);
+					*p++ = static_cast<BYTE>(g);
+					*p++ = static_cast<BYTE>(b);
+				}
+			}
+			else
+			{
+				*p++ = 0xff;
+				*p++ = static_cast<BYTE>(r);
+				*p++ = static_cast<BYTE>(g);
+				*p++ = static_cast<BYTE>(b);
+				*p++ = static_cast<BYTE>(a);
+			}
+		}
+		previous = pixel;
+	}
+
+	static const BYTE end[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+	memcpy(p, end, sizeof(end));
+	p += sizeof(end);
+
+	size_t size = p - Output.data();
+	return fwrite(Output.data(), 1, size, pFile) == size;
+}
+
+bool ImageExporter::EncodeRaw(const Job &Job, FILE *pFile)
+{
+	const bool pfm = Job.Desc.Format == ImageFormatPFM;
+	const size_t rowBytes = size_t(Job.Width) * 3 * (pfm ? sizeof(float) : 1);
+
+	// a scale of -1 marks little endian floats
+	char header[64];
+	int headerSize = snprintf(header, sizeof(header), pfm ? "PF\n%u %u\n-1.0\n" : "P6\n%u %u\n255\n", Job.Width, Job.Height);
+	Output.resize(headerSize + rowBytes * Job.Height);
+	memcpy(Output.data(), header, headerSize);
+	BYTE *pBody = Output.data() + headerSize;
+
+	const UINT rowsPerStrip = GetRowsPerStrip(rowBytes);
+	auto packStrip = [&](unsigned int Index)
+	{
+		UINT firstRow = Index * rowsPerStrip;
+		UINT lastRow = std::min(firstRow + rowsPerStrip, Job.Height);
+		for (UINT y = firstRow; y < lastRow; ++y)
+		{
+			const UINT *pRow = Job.Pixels.data() + size_t(y) * Job.Width;
+			if (!pfm)
+			{
+				PackRGB8(pBody + y * rowBytes, pRow, Job.Width);
+				continue;
+			}
+
+			// PFM rows go from the bottom up. The header length varies, so the floats are copied to unaligned addresses
+			BYTE *pDst = pBody + size_t(Job.Height - 1 - y) * rowBytes;
+			for (UINT x = 0; x < Job.Width; ++x)
+			{
+				float rgb[3] = {float((pRow[x] >> 16) & 0xff) / 255.0f, float((pRow[x] >> 8) & 0xff) / 255.0f, float(pRow[x] & 0xff) / 255.0f};
+				memcpy(pDst + x * sizeof(rgb), rgb, sizeof(rgb));
+			}
+		}
+	};
+	Pool.ParallelFor((Job.Height + rowsPerStrip - 1) / rowsPerStrip, packStrip);
+
+	return fwrite(Output.data(), 1, Output.size(), pFile) == Output.size();
+}
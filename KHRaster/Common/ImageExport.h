@@ -0,0 +1,127 @@
+#pragma once
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Platform.h"
+#include "ThreadPool.h"
+
+///////////////////////////////////////////////////
+//	ImageFormatPNG	: 8 bit RGB or RGBA, deflated in strips
+//					  of rows on the thread pool
+//	ImageFormatQOI	: 8 bit RGB or RGBA, lossless in a
+//					  single pass, much faster than PNG
+//	ImageFormatPPM	: binary 8 bit RGB, not compressed
+//	ImageFormatPFM	: 32 bit float RGB with channels in
+//					  [0, 1], not compressed
+///////////////////////////////////////////////////
+enum IMAGE_FORMAT
+{
+	ImageFormatPNG,
+	ImageFormatQOI,
+	ImageFormatPPM,
+	ImageFormatPFM
+};
+
+///////////////////////////////////////////////////
+//	PngCompressionStored	: deflate without compression,
+//							  for when disk is cheaper than
+//							  time
+//	PngCompressionFast		: each row is filtered by the one
+//							  above, then deflated with fixed
+//							  Huffman codes and one hash probe
+//							  per match
+///////////////////////////////////////////////////
+enum PNG_COMPRESSION
+{
+	PngCompressionStored,
+	PngCompressionFast
+};
+
+struct ImageExportDesc
+{
+	IMAGE_FORMAT Format = ImageFormatPNG;
+	// 3 drops alpha, 4 keeps it. PPM and PFM always have 3
+	UINT NumChannels = 3;
+	PNG_COMPRESSION PngCompression = PngCompressionFast;
+};
+
+// Format of an output path by its extension, .qoi, .ppm and .pfm in any case, PNG for anything else
+IMAGE_FORMAT GetImageFormat(const char *pPath);
+
+// Writes ARGB8 images to files on a background thread so that the next frame renders meanwhile. PNG strips and
+// the repacking of the other formats are spread over a thread pool. Strips have a fixed size, so the bytes
+// written do not depend on the number of threads.
+class ImageExporter
+{
+public:
+	// MaxPending images may be accepted and not written yet before ExportAsync blocks. The encoder thread starts
+	// with the first ExportAsync, a pool of one thread has no workers, so ImageExporter(1) only writes with Export.
+	explicit ImageExporter(UINT NumThreads = std::thread::hardware_concurrency(), UINT MaxPending = 2);
+	// Writes every pending image
+	~ImageExporter();
+
+	ImageExporter(const ImageExporter &) = delete;
+	ImageExporter &operator=(const ImageExporter &) = delete;
+
+	// Copies Height rows of Width pixels, Pitch pixels apart, and returns while they are encoded to pPath.
+	// Blocks only while MaxPending images are pending. Returns false without queuing once an export has failed,
+	// until Flush reports it.
+	bool ExportAsync(const UINT *pPixels, UINT Width, UINT Height, UINT Pitch, const char *pPath, const ImageExportDesc &Desc);
+
+	// Waits until every pending image is written, false if one of them or an earlier one failed
+	bool Flush();
+
+	// Writes the image on the calling thread once the pending ones are written, false if it failed. Like
+	// ExportAsync, returns false without writing once an earlier export has failed, until Flush reports it.
+	bool Export(const UINT *pPixels, UINT Width, UINT Height, UINT Pitch, const char *pPath, const ImageExportDesc &Desc);
+
+private:
+	struct Job
+	{
+		std::vector<UINT> Pixels;
+		UINT Width, Height;
+		std::string Path;
+		ImageExportDesc Desc;
+	};
+
+	// compressed bytes of a strip of rows, with the CRC of the PNG chunk that holds them
+	struct Strip
+	{
+		std::vector<BYTE> Data;
+		std::vector<BYTE> Rows;
+		UINT Crc;
+		UINT Adler;
+	};
+
+	// copies the pixels into a job, with a buffer of a written image when there is one
+	void FillJob(Job &Job, const UINT *pPixels, UINT Width, UINT Height, UINT Pitch, const char *pPath, const ImageExportDesc &Desc);
+	void EncoderLoop();
+	bool Encode(const Job &Job);
+	bool EncodePNG(const Job &Job, FILE *pFile);
+	bool EncodeQOI(const Job &Job, FILE *pFile);
+	bool EncodeRaw(const Job &Job, FILE *pFile);
+
+	ThreadPool Pool;
+	std::thread Encoder;
+	std::mutex Mutex;
+	std::condition_variable JobQueued;
+	std::condition_variable JobDone;
+
+	std::deque<Job> Queue;
+	// pixel buffers of written images, reused by the next ones
+	std::vector<std::vector<UINT>> FreeBuffers;
+	const UINT MaxPending;
+	// accepted and not written yet
+	UINT Pending = 0;
+	bool Failed = false;
+	bool Exit = false;
+
+	// only touched by the encoder thread
+	std::vector<Strip> Strips;
+	std::vector<BYTE> Output;
+};
@@ -13,6 +13,9 @@ struct Vertex
 	unsigned int color = 0;
 	Vec2 uv = {};
 	Vec4 normal = {};
+	// screen space derivatives of uv, only filled in by the rasterizer for the pixel shader
+	Vec2 ddx = {};
+	Vec2 ddy = {};
 };
 
 float LinearInterpolation(float Src, float Dst, float Ratio)
@@ -117,6 +120,33 @@ Vec3 BarycentricCoordinates(Vec4 a, Vec4 b, Vec4 c, Vec4 p)
 	return {subA / maxA, subB / maxB, subC / maxC};
 }
 
+///////////////////////////////////////////////////
+//	Raster positions are snapped to 28.4 fixed point
+//	(1/16th of a pixel) before edge setup so that edge
+//	functions can be evaluated exactly with integers
+///////////////////////////////////////////////////
+static constexpr int SubpixelBits = 4;
+static constexpr int SubpixelScale = 1 << SubpixelBits;
+
+int ToFixedPoint(float Value)
+{
+	return static_cast<int>(lroundf(Value * SubpixelScale));
+}
+
+// Edge function of a fixed point edge AB evaluated at P, positive when P lies to the right of AB in raster space
+long long EdgeFunction(int Ax, int Ay, int Bx, int By, long long Px, long long Py)
+{
+	return static_cast<long long>(Bx - Ax) * (Py - Ay) - static_cast<long long>(By - Ay) * (Px - Ax);
+}
+
+// Top-left fill rule, a pixel sitting exactly on an edge is only owned by top and left edges
+bool IsTopLeftEdge(int Ax, int Ay, int Bx, int By)
+{
+	int dx = Bx - Ax;
+	int dy = By - Ay;
+	return dy < 0 || (dy == 0 && dx > 0);
+}
+
 void NDCToRaster(Vec4 &NDC, unsigned int Width, unsigned int Height)
 {
 	NDC.x = (NDC.x + 1.0f) * (Width >> 1);
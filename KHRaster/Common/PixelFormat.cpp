@@ -0,0 +1,103 @@
+#include "PixelFormat.h"
+#include "ColorMath.h"
+#include <cmath>
+#include <cstring>
+
+static unsigned int PackARGB(unsigned int A, unsigned int R, unsigned int G, unsigned int B)
+{
+	return (A << 24) | (R << 16) | (G << 8) | B;
+}
+
+static unsigned int UnitToByte(float Value)
+{
+	// written so that NaN becomes 0
+	return Value > 0.0f ? static_cast<unsigned int>(std::fmin(Value, 1.0f) * 255.0f + 0.5f) : 0;
+}
+
+static float HalfToFloat(unsigned short Half)
+{
+	unsigned int sign = (Half >> 15) & 1;
+	unsigned int exponent = (Half >> 10) & 0x1f;
+	unsigned int mantissa = Half & 0x3ff;
+
+	float value;
+	if (exponent == 0)
+	{
+		// zero or denormal
+		value = std::ldexp(static_cast<float>(mantissa), -24);
+	}
+	else if (exponent == 31)
+	{
+		value = mantissa ? NAN : INFINITY;
+	}
+	else
+	{
+		value = std::ldexp(static_cast<float>(mantissa | 0x400), static_cast<int>(exponent) - 25);
+	}
+	return sign ? -value : value;
+}
+
+// Four texels per register, the remainder is padded into a last one
+template <__m128i (*Swizzle)(__m128i)>
+static void SwizzleTexels(unsigned int *pDst, const unsigned char *pSrc, size_t Count)
+{
+	size_t i = 0;
+	for (; i + 4 <= Count; i += 4)
+	{
+		__m128i texels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pSrc + i * 4));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(pDst + i), Swizzle(texels));
+	}
+	if (i < Count)
+	{
+		unsigned int texels[4] = {};
+		memcpy(texels, pSrc + i * 4, (Count - i) * 4);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(texels), Swizzle(_mm_loadu_si128(reinterpret_cast<const __m128i *>(texels))));
+		memcpy(pDst + i, texels, (Count - i) * 4);
+	}
+}
+
+void ConvertToARGB8(unsigned int *pDst, const void *pSrc, PIXEL_FORMAT Format, size_t Count)
+{
+	const unsigned char *pBytes = static_cast<const unsigned char *>(pSrc);
+	switch (Format)
+	{
+	case ARGB8:
+		memcpy(pDst, pSrc, Count * sizeof(unsigned int));
+		break;
+	case BGRA8:
+		SwizzleTexels<ColorSwapBGRA4>(pDst, pBytes, Count);
+		break;
+	case RGBA8:
+		SwizzleTexels<ColorAlphaToTop4>(pDst, pBytes, Count);
+		break;
+	case RGB565:
+		for (size_t i = 0; i < Count; ++i)
+		{
+			unsigned short texel;
+			memcpy(&texel, pBytes + i * 2, 2);
+			unsigned int r = (texel >> 11) & 0x1f;
+			unsigned int g = (texel >> 5) & 0x3f;
+			unsigned int b = texel & 0x1f;
+			// the top bits are repeated in the bottom ones so that the full range maps to 0-255
+			pDst[i] = PackARGB(255, (r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2));
+		}
+		break;
+	case R32F:
+		for (size_t i = 0; i < Count; ++i)
+		{
+			float red;
+			memcpy(&red, pBytes + i * 4, 4);
+			pDst[i] = PackARGB(255, UnitToByte(red), 0, 0);
+		}
+		break;
+	case RGBA16F:
+		for (size_t i = 0; i < Count; ++i)
+		{
+			unsigned short texel[4];
+			memcpy(texel, pBytes + i * 8, 8);
+			pDst[i] = PackARGB(UnitToByte(HalfToFloat(texel[3])), UnitToByte(HalfToFloat(texel[0])),
+							   UnitToByte(HalfToFloat(texel[1])), UnitToByte(HalfToFloat(texel[2])));
+		}
+		break;
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstddef>
+
+///////////////////////////////////////////////////
+//	Formats are named from the most significant bits of a
+//	texel down.
+//	ARGB8	: 0xAARRGGBB, the format colors are in once they
+//			  are uploaded. Render targets, textures and
+//			  shaders all work in it
+//	BGRA8	: 0xBBGGRRAA, the bundled texture headers
+//	RGBA8	: 0xRRGGBBAA
+//	RGB565	: 16 bit, opaque
+//	R32F	: one float of red, green and blue are 0 and
+//			  alpha 1
+//	RGBA16F	: four half floats, red first in memory
+///////////////////////////////////////////////////
+enum PIXEL_FORMAT
+{
+	ARGB8,
+	BGRA8,
+	RGBA8,
+	RGB565,
+	R32F,
+	RGBA16F
+};
+
+// Size in bytes of a texel
+inline unsigned int GetPixelFormatSize(PIXEL_FORMAT Format)
+{
+	switch (Format)
+	{
+	case RGB565:
+		return 2;
+	case RGBA16F:
+		return 8;
+	default:
+		return 4;
+	}
+}
+
+// Converts Count texels of pSrc from Format to ARGB8. Float channels are clamped to [0, 1].
+void ConvertToARGB8(unsigned int *pDst, const void *pSrc, PIXEL_FORMAT Format, size_t Count);
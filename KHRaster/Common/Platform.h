@@ -0,0 +1,106 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+
+// Everything the rasterizer needs from the OS. Windows gets it from Windows.h, other platforms get the same
+// names defined here so Common and the samples build unchanged.
+#ifdef _WIN32
+// std::min/std::max are used throughout, keep Windows.h from defining the macros
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <cstdint>
+#include <ctime>
+
+typedef unsigned int UINT;
+typedef uint64_t UINT64;
+typedef int BOOL;
+typedef float FLOAT;
+typedef unsigned char BYTE;
+typedef int32_t LONG;
+typedef uint32_t DWORD;
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+struct RECT
+{
+	LONG left;
+	LONG top;
+	LONG right;
+	LONG bottom;
+};
+
+#define ARRAYSIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+// There is no keyboard without a window, keys always read as up
+inline short GetAsyncKeyState(int)
+{
+	return 0;
+}
+#endif
+
+// Source annotations are only understood by MSVC
+#ifndef _In_range_
+#define _In_range_(Low, High)
+#endif
+#ifndef _In_reads_
+#define _In_reads_(Count)
+#endif
+
+// Monotonic clock for timing, steady_clock is QueryPerformanceCounter on Windows and CLOCK_MONOTONIC elsewhere
+inline long long GetTimerTicks()
+{
+	return std::chrono::steady_clock::now().time_since_epoch().count();
+}
+
+// Ticks per second of GetTimerTicks
+inline long long GetTimerFrequency()
+{
+	return std::chrono::steady_clock::period::den / std::chrono::steady_clock::period::num;
+}
+
+// CPU time in seconds used so far by every thread of the process
+inline double GetProcessCpuTime()
+{
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+	{
+		return 0.0;
+	}
+	// 100 ns units
+	ULARGE_INTEGER kernelTime = {{kernel.dwLowDateTime, kernel.dwHighDateTime}};
+	ULARGE_INTEGER userTime = {{user.dwLowDateTime, user.dwHighDateTime}};
+	return double(kernelTime.QuadPart + userTime.QuadPart) * 1e-7;
+#else
+	timespec time;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+	return double(time.tv_sec) + double(time.tv_nsec) * 1e-9;
+#endif
+}
+
+// Copies the value of an environment variable into pValue, false if it is not set or does not fit
+inline bool GetEnvironmentValue(const char *pName, char *pValue, size_t Size)
+{
+#if defined(_MSC_VER)
+	size_t length = 0;
+	return getenv_s(&length, pValue, Size, pName) == 0 && length > 0;
+#else
+	const char *pSource = std::getenv(pName);
+	if (pSource == nullptr || strlen(pSource) >= Size)
+	{
+		return false;
+	}
+	strcpy(pValue, pSource);
+	return true;
+#endif
+}
@@ -1,10 +1,10 @@
 #include "RasterSurface.h" // definitions
+#include "Swapchain.h"
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
 #include <wingdi.h>
 #include <thread>
-#include <future>
-#include <mutex>
+#include <memory>
 #include <atomic>
 
 HWND window = nullptr;
@@ -12,13 +12,10 @@ HDC windowDC = nullptr;
 std::thread windowHandler;
 DWORD windowHandlerID = -1;
 std::atomic_bool windowClosed;
-unsigned int *bitmap = nullptr;
-unsigned int bitmapWidth = 0;
-unsigned int bitmapHeight = 0;
-std::mutex bitmapMutex;
-std::condition_variable bitmapRedraw;
-std::future<unsigned int *> bitmapAllocator;
-std::atomic_bool bitmapPresent;
+std::unique_ptr<Swapchain> swapchain;
+RS_FRAME_CONSUMER frameConsumer = nullptr;
+void *frameConsumerData = nullptr;
+unsigned int frameIndex = 0;
 
 // Handles all windows messages (Messages may arrive cross-thread without a valid HWND)
 // hWnd may be set artifically due to cross-thread message posting (NULL HWNDs are ignored)
@@ -28,8 +25,8 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 	{
 	case (WM_DESTROY):
 	{
-		windowClosed = true;	   // window closing, updates disabled
-		bitmapRedraw.notify_one(); // tell main to stop waiting for a redraw and exit
+		windowClosed = true; // window closing, updates disabled
+		swapchain->Close();	 // tell main to stop waiting for a present and exit
 		// close down the window
 		window = nullptr; // dont stall get message
 		PostQuitMessage(0);
@@ -39,39 +36,46 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 	return DefWindowProcW(hWnd, message, wParam, lParam);
 }
 
-// This function transfers the internal block of pixels to the screen
+// This function transfers a back buffer to the screen and signals its fence
 // It will also update the title bar FPS once every second
-bool PresentFrame()
+bool PresentFrame(const unsigned int *frame)
 {
 	// update screen contents & increment frame count
-	if (bitmap && window && windowDC) // bitmap should be allocated at this point
+	if (window && windowDC)
 	{
-		// lock down the bitmap object and use it to paint to the window surface
-		std::unique_lock<std::mutex> pixelLock(bitmapMutex);
 		// SetDIBitsToDevice version
 		BITMAPINFO toDraw;
 		ZeroMemory(&toDraw, sizeof(BITMAPINFO));
 		toDraw.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
-		toDraw.bmiHeader.biWidth = bitmapWidth;
-		toDraw.bmiHeader.biHeight = -int(bitmapHeight); // flip
+		toDraw.bmiHeader.biWidth = swapchain->Width;
+		toDraw.bmiHeader.biHeight = -int(swapchain->Height); // flip
 		toDraw.bmiHeader.biPlanes = 1;
 		toDraw.bmiHeader.biBitCount = 32;
 		toDraw.bmiHeader.biCompression = BI_RGB;
-		// Draw to frontbuffer
-		SetDIBitsToDevice(windowDC, 0, 0, bitmapWidth, bitmapHeight, 0, 0, 0,
-						  bitmapHeight, bitmap, &toDraw, DIB_RGB_COLORS);
-		// increase frame count and notify render thread to continue
-		bitmapPresent = false;	   // increase frame count
-		bitmapRedraw.notify_one(); // tell main thread to continue rendering
-		// Update visible frame rate every second
+		// Draw to frontbuffer straight from the back buffer
+		SetDIBitsToDevice(windowDC, 0, 0, swapchain->Width, swapchain->Height, 0, 0, 0,
+						  swapchain->Height, frame, &toDraw, DIB_RGB_COLORS);
+		// hand the frame to the consumer, it may ask for the window to close
+		bool keepOpen = !frameConsumer || frameConsumer(frame, swapchain->Width, swapchain->Height, frameIndex, frameConsumerData);
+		++frameIndex;
+		// the back buffer can be rendered into again
+		swapchain->EndPresent();
+		if (!keepOpen)
+		{
+			DestroyWindow(window);
+			return true;
+		}
+		// Update visible frame rate and present latency every second
 		static ULONGLONG frameCount = 0;
 		++frameCount;
 		static ULONGLONG framesPast = frameCount;
-		static ULONGLONG prevCount = GetTickCount();
+		static ULONGLONG prevCount = GetTickCount64();
 		if (GetTickCount64() - prevCount > 1000) // only update every second
 		{
+			RS_PRESENT_STATS stats = swapchain->GetPresentStats();
 			char buffer[256];
-			sprintf_s(buffer, "Raster Surface. FPS: %d", static_cast<int>(frameCount - framesPast));
+			sprintf_s(buffer, "Raster Surface. FPS: %d, present latency: %.2f ms", static_cast<int>(frameCount - framesPast),
+					  stats.lastLatency * 1000.0);
 			SetWindowTextA(window, buffer);
 			framesPast = frameCount;
 			prevCount = GetTickCount64();
@@ -82,14 +86,8 @@ bool PresentFrame()
 }
 
 // This thread will handle all updates to the window
-void ProcessRasterSurface(unsigned int _width, unsigned int _height,
-						  std::promise<unsigned int *> bitmapInit)
+void ProcessRasterSurface(unsigned int _width, unsigned int _height)
 {
-	// DIB pixel buffers may not be fragmented across heaps
-	// VirtualAlloc garuntees true memory contiguity (needed by SetDIBitsToDevice)
-	unsigned int *frontbuffer = (unsigned int *)VirtualAlloc(nullptr, (_width * _height) << 2,
-															 MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
-	bitmapInit.set_value(frontbuffer); // fufill promise
 	// Create a win32 window and manage it on this thread
 	WNDCLASSEX wndClass;
 	ZeroMemory(&wndClass, sizeof(WNDCLASSEX));
@@ -131,14 +129,14 @@ void ProcessRasterSurface(unsigned int _width, unsigned int _height,
 				DispatchMessageW(&msg);
 			}
 			// If any frames are ready to be presented we should do so
-			// This operation is synchronized with "RS_Update"
-			if (bitmapPresent)
-				PresentFrame();
+			// This operation is synchronized with "RS_Present"
+			if (const unsigned int *frame = swapchain->BeginPresent(false))
+				PresentFrame(frame);
 		}
 	}
-	// delete the front buffer "aka: bitmap" (before thread shuts down)
-	VirtualFree(frontbuffer, 0, MEM_RELEASE);
-	bitmap = nullptr;
+	// no more frames will be presented, release the render thread
+	windowClosed = true;
+	swapchain->Close();
 	// deallocate window
 	UnregisterClassW(L"RasterSurfaceApplication", GetModuleHandleW(0));
 }
@@ -148,54 +146,55 @@ BOOL WINAPI ConsoleCtrlHandler(DWORD ctrlCode);
 
 // Spawns & manages a win32 window of the requested size. (the "RasterSurface")
 bool RS_Initialize(_In_range_(1, 0xFFFF) unsigned int _width,
-				   _In_range_(1, 0xFFFF) unsigned int _height)
+				   _In_range_(1, 0xFFFF) unsigned int _height,
+				   _In_range_(2, 3) unsigned int _bufferCount,
+				   _In_range_(1, 2) unsigned int _maxFramesInFlight)
 {
 	// Create a win32 window and manage it on another thread
-	bitmapPresent = false;	// no bitmap is available yet
-	windowClosed = false;	// window is being created
-	bitmapWidth = _width;	// save x size
-	bitmapHeight = _height; // save y size
-	// bitmap creation will be fufilled on secondary thread. (allow immediate drawing)
-	std::promise<unsigned int *> bitmapGen;
-	bitmapAllocator = bitmapGen.get_future();
+	windowClosed = false; // window is being created
+	frameIndex = 0;
+	// back buffers are ready right away (allow immediate drawing)
+	swapchain = std::make_unique<Swapchain>(_width, _height, _bufferCount, _maxFramesInFlight);
 	// handle messages & buffer updates on dedicated thread
-	windowHandler = std::thread(ProcessRasterSurface, _width, _height, std::move(bitmapGen));
+	windowHandler = std::thread(ProcessRasterSurface, _width, _height);
 	windowHandlerID = GetThreadId(static_cast<HANDLE>(windowHandler.native_handle())); // what is the new thread's ID?
 	// allows gracefull exit when console window is closed
 	SetConsoleCtrlHandler(ConsoleCtrlHandler, TRUE);
 	return true;
 }
 
+// Returns the next back buffer once the window is done presenting it.
+unsigned int *RS_AcquireBackBuffer()
+{
+	if (!swapchain || windowClosed)
+		return nullptr;
+	return swapchain->AcquireBackBuffer();
+}
+
+// Queues the acquired back buffer for the window thread.
+bool RS_Present()
+{
+	if (!swapchain || windowClosed)
+		return false;
+	return swapchain->Present();
+}
+
+bool RS_IsOpen()
+{
+	return swapchain && !windowClosed;
+}
+
 // Updates the RasterSurface with a block of raw XRGB pixel data.
 // Incoming data must 32bit pixels 8 bits per channel.
 bool RS_Update(_In_reads_(_numPixels) const unsigned int *_argbPixels,
 			   _In_range_(1, 0xFFFFFFFF) unsigned int _numPixels)
 {
-	// Wait for the drawing surface to intialize
-	if (bitmapAllocator.valid())
-		bitmap = bitmapAllocator.get(); // retreive allocated value (blocking)
-	// begin transfer
-	if (bitmap)
-	{ // track the current frame being rendered
-		static unsigned int internalCount = 0;
-		// if we have a valid window, lets transfer the memory block to the screen
-		{
-			std::unique_lock<std::mutex> pixelLock(bitmapMutex); // protect bitmap
-			// wait for last paint to occur if we are ahead
-			bitmapRedraw.wait(pixelLock, [&]()
-							  { return !bitmapPresent || windowClosed; });
-			// if the window has been closed, allow no more updates
-			if (windowClosed)
-				return false;
-			// copy bitmap data so we can continue to
-			// draw while it is transfered to frontbuffer
-			memcpy_s(bitmap, _numPixels << 2, _argbPixels, _numPixels << 2);
-			// notify win32 thread we are ready to present the new image
-			bitmapPresent = true;
-		}
-		return true;
-	}
-	return false;
+	unsigned int *backBuffer = RS_AcquireBackBuffer();
+	if (!backBuffer)
+		return false;
+	// copy bitmap data so we can continue to draw while it is transfered to frontbuffer
+	memcpy_s(backBuffer, (swapchain->Width * swapchain->Height) << 2, _argbPixels, _numPixels << 2);
+	return RS_Present();
 }
 
 // Deallocates the RasterSurface and cleans up any leftover memory.
@@ -205,10 +204,10 @@ bool RS_Shutdown()
 	PostThreadMessageW(windowHandlerID, WM_DESTROY, 0, 0);
 	// wait for thread to yeild
 	windowHandler.join();
-	// the bitmap is released by the window
 	window = nullptr;
 	windowDC = nullptr;
-	bitmap = nullptr;
+	// release the back buffers
+	swapchain.reset();
 	return true;
 }
 // Handles unexpected termination of the console window.
@@ -220,4 +219,19 @@ BOOL WINAPI ConsoleCtrlHandler(DWORD ctrlCode)
 		RS_Shutdown(); // kill window and wait for shutdown
 	// allow other handlers to end process
 	return FALSE;
+}
+
+// Sets the frame consumer, nullptr removes it.
+void RS_SetFrameConsumer(RS_FRAME_CONSUMER _consumer, void *_userData)
+{
+	frameConsumer = _consumer;
+	frameConsumerData = _userData;
+}
+
+bool RS_GetPresentStats(RS_PRESENT_STATS *_stats)
+{
+	if (!swapchain || !_stats)
+		return false;
+	*_stats = swapchain->GetPresentStats();
+	return true;
 }
\ No newline at end of file
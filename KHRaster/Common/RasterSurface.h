@@ -1,14 +1,57 @@
 #pragma once
-#include <sal.h>
+#include "Platform.h"
 
 // Spawns & manages a win32 window of the requested size. (the "RasterSurface")
+// The headless backend opens no window, frames go to the consumer below and to
+// KHRASTER_FRAME_DIR as numbered images when that variable is set, PPM unless
+// KHRASTER_FRAME_FORMAT names another extension (png, qoi, pfm).
+// KHRASTER_FRAME_COUNT closes the headless surface after that many frames.
+// Frames are presented from a swapchain of _bufferCount (2 or 3) back buffers,
+// rendering runs up to _maxFramesInFlight frames ahead of presentation.
 bool RS_Initialize(_In_range_(1, 0xFFFF) unsigned int _width,
-				   _In_range_(1, 0xFFFF) unsigned int _height);
+				   _In_range_(1, 0xFFFF) unsigned int _height,
+				   _In_range_(2, 3) unsigned int _bufferCount = 2,
+				   _In_range_(1, 2) unsigned int _maxFramesInFlight = 1);
+
+// Returns the back buffer to render the next frame into, _width * _height XRGB pixels row by row.
+// Waits only if the frame last rendered into it is still being presented. nullptr once the surface is closed.
+// The buffer keeps the frame it presented _bufferCount frames ago.
+unsigned int *RS_AcquireBackBuffer();
+
+// Presents the acquired back buffer without copying it. Waits only while more than _maxFramesInFlight frames
+// are queued. Returns false once the surface has been closed.
+bool RS_Present();
+
+// False before RS_Initialize and once the window has been closed, or the headless surface has stopped.
+bool RS_IsOpen();
 
 // Updates the RasterSurface with a block of raw XRGB pixel data.
 // Incoming data must 32bit pixels 8 bits per channel.
+// Copies into a back buffer and presents it, rendering into RS_AcquireBackBuffer saves the copy.
+// Returns false once the surface has been closed.
 bool RS_Update(_In_reads_(_numPixels) const unsigned int *_xrgbPixels,
 			   _In_range_(1, 0xFFFFFFFF) unsigned int _numPixels);
 
-// Deallocates the RasterSurface and cleans up any leftover memory.
-bool RS_Shutdown();
\ No newline at end of file
+// Deallocates the RasterSurface and cleans up any leftover memory, back buffers included.
+bool RS_Shutdown();
+
+// Receives every presented frame on the surface thread, rendering continues meanwhile.
+// The pixels are only valid during the call. Returning false closes the surface.
+typedef bool (*RS_FRAME_CONSUMER)(const unsigned int *_xrgbPixels, unsigned int _width,
+								  unsigned int _height, unsigned int _frameIndex, void *_userData);
+
+// Sets the frame consumer, nullptr removes it. Call before RS_Initialize.
+void RS_SetFrameConsumer(RS_FRAME_CONSUMER _consumer, void *_userData);
+
+// Presentation statistics, latencies are in seconds from RS_Present to the frame being shown
+struct RS_PRESENT_STATS
+{
+	unsigned long long framesPresented;
+	unsigned int framesInFlight;
+	double lastLatency;
+	double averageLatency;
+	double maxLatency;
+};
+
+// Fills _stats, false if the surface is not initialized
+bool RS_GetPresentStats(RS_PRESENT_STATS *_stats);
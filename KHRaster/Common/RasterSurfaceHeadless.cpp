@@ -0,0 +1,161 @@
+#include "RasterSurface.h" // definitions
+#include "ImageExport.h"
+#include "Swapchain.h"
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+
+// Headless RasterSurface, frames are handed to a consumer thread instead of a window.
+// The thread sleeps until the swapchain queues a frame and signals its fence once consumed.
+
+std::thread frameHandler;
+std::unique_ptr<Swapchain> swapchain;
+std::atomic_bool surfaceClosed;
+RS_FRAME_CONSUMER frameConsumer = nullptr;
+void *frameConsumerData = nullptr;
+std::string frameDirectory;
+std::string frameExtension;
+std::unique_ptr<ImageExporter> frameExporter; // encodes frames while the next ones are consumed
+unsigned int frameLimit = 0; // 0 keeps the surface open until shutdown
+bool printStats = false; // present statistics on stdout at shutdown, RS_GetPresentStats returns them otherwise
+
+// Consumes frames as they are presented, sleeps while there are none
+void ProcessRasterSurface()
+{
+	unsigned int frameIndex = 0;
+	while (const unsigned int *frame = swapchain->BeginPresent(true))
+	{
+		bool keepOpen = true;
+		if (frameExporter)
+		{
+			char name[32];
+			snprintf(name, sizeof(name), "/frame_%05u.", frameIndex);
+			std::string path = frameDirectory + name + frameExtension;
+			ImageExportDesc desc;
+			desc.Format = GetImageFormat(path.c_str());
+			if (!frameExporter->ExportAsync(frame, swapchain->Width, swapchain->Height, swapchain->Width, path.c_str(), desc))
+			{
+				fprintf(stderr, "RasterSurface: could not write frames to %s\n", frameDirectory.c_str());
+				frameExporter.reset();
+				keepOpen = false;
+			}
+		}
+		if (frameConsumer && !frameConsumer(frame, swapchain->Width, swapchain->Height, frameIndex, frameConsumerData))
+			keepOpen = false;
+		++frameIndex;
+		if (frameLimit && frameIndex >= frameLimit)
+			keepOpen = false;
+
+		swapchain->EndPresent();
+		if (!keepOpen)
+		{
+			surfaceClosed = true;
+			swapchain->Close(); // frames still queued are dropped like on a closed window
+		}
+	}
+}
+
+// Stands in for the window being closed, lets the sample finish its loop and save
+void SignalHandler(int)
+{
+	surfaceClosed = true;
+}
+
+// Starts the consumer thread for frames of the requested size.
+bool RS_Initialize(_In_range_(1, 0xFFFF) unsigned int _width,
+				   _In_range_(1, 0xFFFF) unsigned int _height,
+				   _In_range_(2, 3) unsigned int _bufferCount,
+				   _In_range_(1, 2) unsigned int _maxFramesInFlight)
+{
+	surfaceClosed = false;
+	swapchain = std::make_unique<Swapchain>(_width, _height, _bufferCount, _maxFramesInFlight);
+
+	char value[260] = {};
+	frameDirectory = GetEnvironmentValue("KHRASTER_FRAME_DIR", value, sizeof(value)) ? value : "";
+	frameExtension = GetEnvironmentValue("KHRASTER_FRAME_FORMAT", value, sizeof(value)) ? value : "ppm";
+	if (!frameDirectory.empty())
+		frameExporter = std::make_unique<ImageExporter>();
+	frameLimit = GetEnvironmentValue("KHRASTER_FRAME_COUNT", value, sizeof(value)) ? static_cast<unsigned int>(strtoul(value, nullptr, 10)) : 0;
+	printStats = GetEnvironmentValue("KHRASTER_VERBOSE", value, sizeof(value));
+
+	frameHandler = std::thread(ProcessRasterSurface);
+	// allows gracefull exit when the job is interrupted
+	signal(SIGINT, SignalHandler);
+	signal(SIGTERM, SignalHandler);
+	return true;
+}
+
+unsigned int *RS_AcquireBackBuffer()
+{
+	if (!swapchain || surfaceClosed)
+		return nullptr;
+	return swapchain->AcquireBackBuffer();
+}
+
+bool RS_Present()
+{
+	if (!swapchain || surfaceClosed)
+		return false;
+	return swapchain->Present();
+}
+
+bool RS_IsOpen()
+{
+	return swapchain && !surfaceClosed;
+}
+
+// Copies the frame into a back buffer and presents it.
+bool RS_Update(_In_reads_(_numPixels) const unsigned int *_xrgbPixels,
+			   _In_range_(1, 0xFFFFFFFF) unsigned int _numPixels)
+{
+	unsigned int *backBuffer = RS_AcquireBackBuffer();
+	if (!backBuffer)
+		return false;
+	memcpy(backBuffer, _xrgbPixels, size_t(std::min(_numPixels, swapchain->Width * swapchain->Height)) << 2);
+	return RS_Present();
+}
+
+// Presents the frames still queued and stops the consumer thread.
+bool RS_Shutdown()
+{
+	if (!frameHandler.joinable())
+		return false;
+	swapchain->Shutdown();
+	frameHandler.join();
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	// frames still being encoded are written before returning
+	if (frameExporter && !frameExporter->Flush())
+		fprintf(stderr, "RasterSurface: could not write frames to %s\n", frameDirectory.c_str());
+	frameExporter.reset();
+
+	if (printStats)
+	{
+		RS_PRESENT_STATS stats = swapchain->GetPresentStats();
+		printf("RasterSurface: %llu frames, present latency %.3f ms average, %.3f ms max\n", stats.framesPresented,
+			   stats.averageLatency * 1000.0, stats.maxLatency * 1000.0);
+	}
+	swapchain.reset();
+	return true;
+}
+
+bool RS_GetPresentStats(RS_PRESENT_STATS *_stats)
+{
+	if (!swapchain || !_stats)
+		return false;
+	*_stats = swapchain->GetPresentStats();
+	return true;
+}
+
+// Sets the frame consumer, nullptr removes it.
+void RS_SetFrameConsumer(RS_FRAME_CONSUMER _consumer, void *_userData)
+{
+	frameConsumer = _consumer;
+	frameConsumerData = _userData;
+}
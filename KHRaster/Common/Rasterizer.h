@@ -1,20 +1,250 @@
 #pragma once
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
 #include "MathFunction.h"
+#include "Simd.h"
+#include "ThreadPool.h"
 
 struct Rasterizer
 {
 	using PFN_VS = void (*)(Vertex &);
 	using PFN_PS = void (*)(UINT &, Vertex &);
 
+	// Width and height in pixels of a bin when rendering with worker threads
+	static constexpr int TileSize = 64;
+	// a fast clear tile is then always materialized by the thread owning its bin
+	static_assert(TileSize % RenderTarget::ClearTileSize == 0, "bins must cover whole fast clear tiles");
+
+	// Extent of the guard band in NDC units, triangles inside of it are never clipped against x and y.
+	// Bounded by the 28.4 fixed point range of the edge functions.
+	static constexpr float GuardBand = 16.0f;
+	static constexpr int ClipPlanesMask = 0x3f;
+	// a triangle clipped by 6 planes gains at most one vertex per plane
+	static constexpr int MaxClipVertices = 9;
+
+	// Slack on the hierarchical Z test, interpolated depth can land slightly outside of the vertex depths
+	static constexpr float HiZEpsilon = 1e-5f;
+
+	// Sample positions of 4x multisampled targets in subpixels from the integer coordinate of the pixel, the
+	// rotated grid of the standard D3D pattern. No sample is farther than MaxSampleOffset on either axis.
+	static constexpr int SampleOffsetX[4] = {-2, 6, -6, 2};
+	static constexpr int SampleOffsetY[4] = {-6, -2, 2, 6};
+	static constexpr int MaxSampleOffset = 6;
+
+	enum PRIMITIVE_TYPE
+	{
+		Point,
+		Line,
+		Triangle
+	};
+
+	///////////////////////////////////////////////////
+	//	Primitive after vertex shading and setup, in raster space.
+	//	Point	: V[0] holds the shaded pixel
+	//	Line	: V[0], V[1] hold the clipped end points
+	//	Triangle: V[0..2] hold the vertices with uv pre-divided by w,
+	//			  X/Y the snapped 28.4 positions and Area is positive
+	///////////////////////////////////////////////////
+	struct Primitive
+	{
+		PRIMITIVE_TYPE Type;
+		UINT Index;
+		UINT StateIndex;
+		Vertex V[3];
+		float rZ[3];
+		int X[3], Y[3];
+		long long Area;
+		RECT Bounds;
+	};
+
+	using PFN_RASTERIZE_TRIANGLE = void (Rasterizer::*)(const Primitive &, const RECT &, PFN_PS, const BlendState &);
+	using PFN_SHADE_FRAGMENT = UINT (*)(const Primitive &, const Vec3 &, const Vec2 &, const Vec2 &, PFN_PS, Vertex &);
+
+	///////////////////////////////////////////////////
+	//	How a triangle kernel invokes the pixel shader
+	//	NoPixelShader		: keeps the interpolated vertex color
+	//	StaticPixelShader	: the shader is known at compile time and inlined
+	//	DynamicPixelShader	: indirect call through the bound pointer
+	//	VisibilityPass		: no shading, the kernel stores the primitive
+	//						  index and ResolveVisibility shades it later
+	///////////////////////////////////////////////////
+	struct NoPixelShader
+	{
+		static void Shade(PFN_PS, UINT &, Vertex &) {}
+	};
+
+	template <PFN_PS Shader>
+	struct StaticPixelShader
+	{
+		static void Shade(PFN_PS, UINT &Color, Vertex &V) { Shader(Color, V); }
+	};
+
+	struct DynamicPixelShader
+	{
+		static void Shade(PFN_PS PS, UINT &Color, Vertex &V) { PS(Color, V); }
+	};
+
+	struct VisibilityPass
+	{
+		static void Shade(PFN_PS, UINT &, Vertex &) {}
+	};
+
+	///////////////////////////////////////////////////
+	//	DepthOff	: no depth test or write
+	//	DepthEarly	: depth is tested before the pixel shader runs
+	//	DepthLate	: depth is tested after the pixel shader, for
+	//				  shaders that move the fragment (PSWritesDepth)
+	///////////////////////////////////////////////////
+	enum DEPTH_MODE
+	{
+		DepthOff,
+		DepthEarly,
+		DepthLate
+	};
+
+	// Pixel shader, depth and blend state along with the kernel specialized for them
+	struct PipelineState
+	{
+		PFN_PS PS;
+		BOOL DepthEnable;
+		BOOL PSWritesDepth;
+		BlendState Blend;
+		PFN_RASTERIZE_TRIANGLE RasterizeTriangle;
+		PFN_SHADE_FRAGMENT ShadeFragment;
+
+		bool operator==(const PipelineState &) const = default;
+	};
+
+	// Snapshot of everything a pixel depends on at the time of a draw
+	struct DrawState
+	{
+		PipelineState Pipeline;
+		struct ConstantBuffer Constants;
+		struct Camera Camera;
+
+		// Member by member, so that padding never tells equal states apart. Matrices, vertices and the camera
+		// have no padding and are compared bitwise, a member added to ConstantBuffer has to be added here.
+		bool operator==(const DrawState &Other) const
+		{
+			static_assert(sizeof(Vertex) == 15 * sizeof(float), "Vertex is compared bitwise");
+			static_assert(sizeof(struct Camera) == sizeof(Matrix4x4) + 4 * sizeof(float), "Camera is compared bitwise");
+			auto same = [](const auto &A, const auto &B)
+			{ return memcmp(&A, &B, sizeof(A)) == 0; };
+
+			const struct ConstantBuffer &a = Constants, &b = Other.Constants;
+			return Pipeline == Other.Pipeline && same(a.World, b.World) && a.pTexture == b.pTexture && a.Sampler == b.Sampler &&
+				   same(a.light, b.light) && same(a.pointLight, b.pointLight) && same(a.lightRadius, b.lightRadius) && same(Camera, Other.Camera);
+		}
+	};
+
 	Rasterizer(RenderTarget *pRenderTarget)
 		: pRenderTarget(pRenderTarget)
 	{
 	}
 
+	///////////////////////////////////////////////////
+	//	0	: Draw calls rasterize immediately on the calling thread
+	//	N	: Draw calls are binned into tiles, Flush rasterizes the
+	//		  tiles on N threads (including the calling thread)
+	///////////////////////////////////////////////////
+	void SetThreadCount(UINT NumThreads)
+	{
+		Flush();
+
+		if (NumThreads == 0)
+		{
+			pThreadPool.reset();
+			return;
+		}
+
+		pThreadPool = std::make_unique<ThreadPool>(NumThreads);
+		NumTilesX = (pRenderTarget->Width + TileSize - 1) / TileSize;
+		NumTilesY = (pRenderTarget->Height + TileSize - 1) / TileSize;
+		Bins.resize(NumTilesX * NumTilesY);
+	}
+
+	///////////////////////////////////////////////////
+	//	FALSE	: Triangles are shaded as they are rasterized
+	//	TRUE	: Triangles only write their index and depth into
+	//			  RenderTarget::VisibilityBuffer, Flush then runs the
+	//			  pixel shader once per visible pixel. Shaders that
+	//			  write depth, draws that blend and multisampled
+	//			  targets are still shaded as they are rasterized.
+	//			  Blended draws, points and lines shade the deferred
+	//			  pixels they cover first
+	///////////////////////////////////////////////////
+	void SetVisibilityBuffer(BOOL Enable)
+	{
+		Flush();
+
+		VisibilityBufferEnable = Enable;
+		// the kernels depend on the mode, select them again on the next draw
+		Pipeline = {};
+	}
+
+	///////////////////////////////////////////////////
+	//	Selects the triangle kernels of the following draws, levels
+	//	the CPU lacks fall back to the best one it has
+	//	SimdScalar	: one pixel at a time, reference path for validation
+	//	SimdSSE2	: 2x2 quads
+	//	SimdAVX2	: 4x2 blocks
+	//	Multisampled targets have a single kernel for every level
+	///////////////////////////////////////////////////
+	void SetSimdLevel(SIMD_LEVEL Level)
+	{
+		Flush();
+
+		SimdLevel = std::min(Level, GetSimdLevel());
+		Pipeline = {};
+	}
+
+	// Rasterizes every binned primitive, each tile is owned by a single thread so no pixel is shared.
+	// Primitives are processed in submission order within a tile, making the result identical to immediate mode.
+	// With the visibility buffer enabled this also shades the visible pixels, call it before clearing the render target.
+	// Multisampled targets are resolved into RT1.
+	void Flush()
+	{
+		RECT viewport = {0, 0, static_cast<LONG>(pRenderTarget->Width), static_cast<LONG>(pRenderTarget->Height)};
+		if (Primitives.empty())
+		{
+			// nothing binned, immediate mode rasterizes primitives as they are drawn. Only the resolve is left.
+			pRenderTarget->Resolve(viewport);
+			return;
+		}
+
+		// workers overwrite the per thread constants, including the ones of this thread
+		struct ConstantBuffer SavedConstants = ConstantBuffer;
+		struct Camera SavedCamera = Camera;
+
+		if (pThreadPool)
+		{
+			pThreadPool->ParallelFor(NumTilesX * NumTilesY, [this](unsigned int TileIndex)
+									 { RasterizeTile(TileIndex); });
+		}
+		else
+		{
+			// immediate mode only records primitives for the visibility buffer, they are already rasterized
+			ResolveVisibility(viewport);
+			pRenderTarget->Resolve(viewport);
+		}
+
+		ConstantBuffer = SavedConstants;
+		Camera = SavedCamera;
+
+		Primitives.clear();
+		States.clear();
+	}
+
 	void DrawPoint(Vertex V)
 	{
 		if (VS)
 		{
+			CompileConstants();
 			VS(V);
 		}
 
@@ -32,13 +262,21 @@ struct Rasterizer
 			PS(V.color, V);
 		}
 
-		pRenderTarget->SetPixel(static_cast<int>(V.position.x), static_cast<int>(V.position.y), V.color, V.position.z);
+		Primitive primitive = {};
+		primitive.Type = Point;
+		primitive.V[0] = V;
+		primitive.Bounds.left = static_cast<int>(V.position.x);
+		primitive.Bounds.top = static_cast<int>(V.position.y);
+		primitive.Bounds.right = primitive.Bounds.left + 1;
+		primitive.Bounds.bottom = primitive.Bounds.top + 1;
+		SubmitPrimitive(primitive);
 	}
 
 	void DrawParametricLine(Vertex Src, Vertex Dst)
 	{
 		if (VS)
 		{
+			CompileConstants();
 			VS(Src);
 			VS(Dst);
 		}
@@ -56,28 +294,22 @@ struct Rasterizer
 		NDCToRaster(Src.position, pRenderTarget->Width, pRenderTarget->Height);
 		NDCToRaster(Dst.position, pRenderTarget->Width, pRenderTarget->Height);
 
-		// x = (B - A) * R + A
-		float dx = fabs(Dst.position.x - Src.position.x);
-		float dy = fabs(Dst.position.y - Src.position.y);
-		int tp = static_cast<int>(fmaxf(dx, dy));
-
-		// loop
-		for (int i = 0; i < tp; ++i)
-		{
-			float r = i / static_cast<float>(tp);
-			int px = static_cast<int>(floor(((Dst.position.x - Src.position.x) * r + Src.position.x) + 0.5f));
-			int py = static_cast<int>(floor(((Dst.position.y - Src.position.y) * r + Src.position.y) + 0.5f));
-			float depth = LinearInterpolation(Src.position.w, Dst.position.w, r);
-			unsigned int color = ColorBlend(Src, Dst, r);
-
-			pRenderTarget->SetPixel(px, py, color, depth);
-		}
+		Primitive primitive = {};
+		primitive.Type = Line;
+		primitive.V[0] = Src;
+		primitive.V[1] = Dst;
+		primitive.Bounds.left = static_cast<LONG>(floor(Min(Src.position.x, Dst.position.x) + 0.5f));
+		primitive.Bounds.top = static_cast<LONG>(floor(Min(Src.position.y, Dst.position.y) + 0.5f));
+		primitive.Bounds.right = static_cast<LONG>(floor(Max(Src.position.x, Dst.position.x) + 0.5f)) + 1;
+		primitive.Bounds.bottom = static_cast<LONG>(floor(Max(Src.position.y, Dst.position.y) + 0.5f)) + 1;
+		SubmitPrimitive(primitive);
 	}
 
 	void FillTriangleBetterBrute(Vertex V0, Vertex V1, Vertex V2)
 	{
 		if (VS)
 		{
+			CompileConstants();
 			VS(V0);
 			VS(V1);
 			VS(V2);
@@ -104,6 +336,16 @@ struct Rasterizer
 		float startY = Min(Min(V0.position.y, V1.position.y), V2.position.y);
 		float endX = Max(Max(V0.position.x, V1.position.x), V2.position.x);
 		float endY = Max(Max(V0.position.y, V1.position.y), V2.position.y);
+
+		// perspective correct uv at a pixel, the 2x2 quad of each pixel gives its uv derivatives
+		auto uvAt = [&](int x, int y)
+		{
+			Vec3 barycentrics = BarycentricCoordinates(V0.position, V1.position, V2.position, {static_cast<float>(x), static_cast<float>(y), 0, 0});
+			float rZ = BarycentricInterpolation(rZA, rZB, rZC, barycentrics);
+			Vec2 uv = BarycentricInterpolation(V0.uv, V1.uv, V2.uv, barycentrics);
+			return Vec2{uv.x / rZ, uv.y / rZ};
+		};
+
 		// Fill triangle using barycentric coordinates
 		for (int y = static_cast<int>(startY); y <= endY; y++)
 		{
@@ -120,8 +362,11 @@ struct Rasterizer
 					unsigned int color = ColorBlend(V0, V1, V2, barycentrics);
 					float depth = v.position.z;
 
-					float mipLevel = (depth - Camera.Near) / (Camera.Far - Camera.Near) * ConstantBuffer.pTexture->MipLevels;
-					ConstantBuffer.SelectedMip = mipLevel;
+					Vec2 quadUV = uvAt(x & ~1, y & ~1);
+					Vec2 rightUV = uvAt((x & ~1) + 1, y & ~1);
+					Vec2 bottomUV = uvAt(x & ~1, (y & ~1) + 1);
+					v.ddx = {rightUV.x - quadUV.x, rightUV.y - quadUV.y};
+					v.ddy = {bottomUV.x - quadUV.x, bottomUV.y - quadUV.y};
 
 					if (PS)
 					{
@@ -134,44 +379,1463 @@ struct Rasterizer
 		}
 	}
 
+
+	void FillTriangle(Vertex V0, Vertex V1, Vertex V2)
+	{
+		if (VS)
+		{
+			CompileConstants();
+			VS(V0);
+			VS(V1);
+			VS(V2);
+		}
+
+		ClipAndSetupTriangle(V0, V1, V2);
+	}
+
+	// Draws a triangle list, every vertex referenced by the index buffer is shaded once per draw
+	void DrawIndexed(const Vertex *pVertexBuffer, size_t VertexCount, const uint32_t *pIndexBuffer, size_t IndexCount)
+	{
+		// post transform buffer, TransformedVertices[i] is valid once IsTransformed[i] is set
+		TransformedVertices.resize(VertexCount);
+		IsTransformed.assign(VertexCount, false);
+
+		if (VS)
+		{
+			CompileConstants();
+		}
+
+		auto fetch = [&](uint32_t Index) -> const Vertex &
+		{
+			assert(Index < VertexCount);
+			if (!IsTransformed[Index])
+			{
+				TransformedVertices[Index] = pVertexBuffer[Index];
+				if (VS)
+				{
+					VS(TransformedVertices[Index]);
+				}
+				IsTransformed[Index] = true;
+			}
+			return TransformedVertices[Index];
+		};
+
+		for (size_t i = 0; i + 2 < IndexCount; i += 3)
+		{
+			const Vertex &V0 = fetch(pIndexBuffer[i]);
+			const Vertex &V1 = fetch(pIndexBuffer[i + 1]);
+			const Vertex &V2 = fetch(pIndexBuffer[i + 2]);
+			ClipAndSetupTriangle(V0, V1, V2);
+		}
+	}
+
+	// Culls, clips and submits a triangle whose vertices are already in clip space
+	void ClipAndSetupTriangle(const Vertex &V0, const Vertex &V1, const Vertex &V2)
+	{
+		int clipCode0 = ClipCode(V0.position);
+		int clipCode1 = ClipCode(V1.position);
+		int clipCode2 = ClipCode(V2.position);
+
+		// every vertex is outside of the same plane
+		if (clipCode0 & clipCode1 & clipCode2)
+		{
+			return;
+		}
+
+		// within near/far and the guard band, no clipping needed
+		if (((clipCode0 | clipCode1 | clipCode2) & ClipPlanesMask) == 0)
+		{
+			SetupTriangle(V0, V1, V2);
+			return;
+		}
+
+		Vertex polygon[MaxClipVertices];
+		int numVertices = ClipTriangle(V0, V1, V2, polygon);
+		for (int i = 1; i + 1 < numVertices; ++i)
+		{
+			SetupTriangle(polygon[0], polygon[i], polygon[i + 1]);
+		}
+	}
+
 	///////////////////////////////////////////////////
-	//	0 : Line is hidden behind near plane
-	//	1 : One vertex is clipped
-	//	2 : Both vertex is present in the view frustrum
+	//	Clip space outcodes, a set bit means the position is outside of
+	//	0 - 5 : near, far and the guard band planes (require clipping)
+	//	6 - 9 : the viewport planes (only used for trivial rejection)
 	///////////////////////////////////////////////////
-	int NearPlaneLineClipping(Vertex &Src, Vertex &Dst)
+	static int ClipCode(const Vec4 &Position)
 	{
-		// both vertex is hidden
-		if (Src.position.z < 0.0f &&
-			Dst.position.z < 0.0f)
-			return 0;
-		// both vertex is present
-		if (Src.position.z >= 0.0f &&
-			Dst.position.z >= 0.0f)
-			return 2;
-		float zBehindNearP = 0.0f;
-		float deltaZ = fabs(Dst.position.z - Src.position.z);
-		float zRatio = 1.0f;
-		// if vertex a.z is behind the near plane
-		if (Src.position.z < 0.0f)
+		int code = 0;
+		code |= (Position.z < 0.0f) << 0;
+		code |= (Position.z > Position.w) << 1;
+		code |= (Position.x > GuardBand * Position.w) << 2;
+		code |= (Position.x < -GuardBand * Position.w) << 3;
+		code |= (Position.y > GuardBand * Position.w) << 4;
+		code |= (Position.y < -GuardBand * Position.w) << 5;
+		code |= (Position.x > Position.w) << 6;
+		code |= (Position.x < -Position.w) << 7;
+		code |= (Position.y > Position.w) << 8;
+		code |= (Position.y < -Position.w) << 9;
+		return code;
+	}
+
+	// Sutherland-Hodgman clipping of a clip space triangle against the near, far and guard band planes.
+	// Every vertex attribute is interpolated linearly in clip space, returns the vertex count of the convex result.
+	int ClipTriangle(const Vertex &V0, const Vertex &V1, const Vertex &V2, Vertex *pPolygon)
+	{
+		// plane . position >= 0 is inside
+		static const Vec4 planes[] = {
+			{0.0f, 0.0f, 1.0f, 0.0f},		// near, z >= 0
+			{0.0f, 0.0f, -1.0f, 1.0f},		// far, z <= w
+			{-1.0f, 0.0f, 0.0f, GuardBand}, // x <= GuardBand * w
+			{1.0f, 0.0f, 0.0f, GuardBand},	// x >= -GuardBand * w
+			{0.0f, -1.0f, 0.0f, GuardBand}, // y <= GuardBand * w
+			{0.0f, 1.0f, 0.0f, GuardBand}}; // y >= -GuardBand * w
+
+		Vertex scratch[MaxClipVertices];
+		Vertex *pSrc = pPolygon;
+		Vertex *pDst = scratch;
+		pSrc[0] = V0;
+		pSrc[1] = V1;
+		pSrc[2] = V2;
+		int numVertices = 3;
+
+		for (const Vec4 &plane : planes)
 		{
-			zBehindNearP = fabs(Src.position.z);
-			zRatio = zBehindNearP / deltaZ;
-			LerpAllAttributes(Src, Dst, zRatio);
-			return 1;
+			int numClipped = 0;
+			for (int i = 0; i < numVertices; ++i)
+			{
+				const Vertex &a = pSrc[i];
+				const Vertex &b = pSrc[(i + 1) % numVertices];
+				float da = Vector_Dot(plane, a.position);
+				float db = Vector_Dot(plane, b.position);
+
+				if (da >= 0.0f)
+				{
+					pDst[numClipped++] = a;
+				}
+				// edge crosses the plane
+				if ((da >= 0.0f) != (db >= 0.0f))
+				{
+					Vertex intersection = a;
+					Vertex end = b;
+					LerpAllAttributes(intersection, end, da / (da - db));
+					pDst[numClipped++] = intersection;
+				}
+			}
+
+			std::swap(pSrc, pDst);
+			numVertices = numClipped;
+			if (numVertices < 3)
+			{
+				return 0;
+			}
 		}
-		// if vertex b.z is behind near plane
-		else if (Dst.position.z < 0.0f)
+
+		if (pSrc != pPolygon)
 		{
-			zBehindNearP = fabs(Dst.position.z);
-			zRatio = zBehindNearP / deltaZ;
-			LerpAllAttributes(Dst, Src, zRatio);
-			return 1;
+			std::copy(pSrc, pSrc + numVertices, pPolygon);
 		}
-		return -1;
+		return numVertices;
 	}
 
-	RenderTarget *pRenderTarget = nullptr;
-	PFN_VS VS = nullptr;
-	PFN_PS PS = nullptr;
+	// Projects a clipped triangle to raster space and submits it
+	void SetupTriangle(Vertex V0, Vertex V1, Vertex V2)
+	{
+		// perspective correct interpolation
+		float rZA = 1.0f / V0.position.w;
+		float rZB = 1.0f / V1.position.w;
+		float rZC = 1.0f / V2.position.w;
+		V0.uv = {V0.uv.x / V0.position.w, V0.uv.y / V0.position.w};
+		V1.uv = {V1.uv.x / V1.position.w, V1.uv.y / V1.position.w};
+		V2.uv = {V2.uv.x / V2.position.w, V2.uv.y / V2.position.w};
+		// perspective divide
+		PerspectiveDivide(V0.position);
+		PerspectiveDivide(V1.position);
+		PerspectiveDivide(V2.position);
+
+		// conversion from NDC coord to raster
+		NDCToRaster(V0.position, pRenderTarget->Width, pRenderTarget->Height);
+		NDCToRaster(V1.position, pRenderTarget->Width, pRenderTarget->Height);
+		NDCToRaster(V2.position, pRenderTarget->Width, pRenderTarget->Height);
+
+		// snap to subpixel grid
+		int X0 = ToFixedPoint(V0.position.x), Y0 = ToFixedPoint(V0.position.y);
+		int X1 = ToFixedPoint(V1.position.x), Y1 = ToFixedPoint(V1.position.y);
+		int X2 = ToFixedPoint(V2.position.x), Y2 = ToFixedPoint(V2.position.y);
+
+		// both windings are drawn, flip the triangle so that the inside of every edge is positive
+		long long area = EdgeFunction(X0, Y0, X1, Y1, X2, Y2);
+		if (area == 0)
+		{
+			return;
+		}
+		if (area < 0)
+		{
+			std::swap(V1, V2);
+			std::swap(rZB, rZC);
+			std::swap(X1, X2);
+			std::swap(Y1, Y2);
+			area = -area;
+		}
+
+		Primitive primitive = {};
+		primitive.Type = Triangle;
+		primitive.V[0] = V0;
+		primitive.V[1] = V1;
+		primitive.V[2] = V2;
+		primitive.rZ[0] = rZA;
+		primitive.rZ[1] = rZB;
+		primitive.rZ[2] = rZC;
+		primitive.X[0] = X0;
+		primitive.X[1] = X1;
+		primitive.X[2] = X2;
+		primitive.Y[0] = Y0;
+		primitive.Y[1] = Y1;
+		primitive.Y[2] = Y2;
+		primitive.Area = area;
+		// bounding box in whole pixels, pixels are sampled at their integer coordinate or the sample positions around it
+		int extent = pRenderTarget->SampleCount > 1 ? MaxSampleOffset : 0;
+		primitive.Bounds.left = (std::min({X0, X1, X2}) - extent + SubpixelScale - 1) >> SubpixelBits;
+		primitive.Bounds.top = (std::min({Y0, Y1, Y2}) - extent + SubpixelScale - 1) >> SubpixelBits;
+		primitive.Bounds.right = ((std::max({X0, X1, X2}) + extent) >> SubpixelBits) + 1;
+		primitive.Bounds.bottom = ((std::max({Y0, Y1, Y2}) + extent) >> SubpixelBits) + 1;
+		SubmitPrimitive(primitive);
+	}
+
+	// Rasterizes right away on this thread or records the primitive into every tile it overlaps
+	void SubmitPrimitive(Primitive Primitive)
+	{
+		// clamp to the viewport, nothing outside of it is ever walked
+		RECT viewport = {0, 0, static_cast<LONG>(pRenderTarget->Width), static_cast<LONG>(pRenderTarget->Height)};
+		LONG left = std::max(Primitive.Bounds.left, viewport.left);
+		LONG top = std::max(Primitive.Bounds.top, viewport.top);
+		LONG right = std::min(Primitive.Bounds.right, viewport.right);
+		LONG bottom = std::min(Primitive.Bounds.bottom, viewport.bottom);
+		if (left >= right || top >= bottom)
+		{
+			return;
+		}
+		Primitive.Bounds = {left, top, right, bottom};
+
+		if (!pThreadPool && !VisibilityBufferEnable)
+		{
+			RasterizePrimitive(Primitive, viewport, BindPipeline());
+			return;
+		}
+
+		// the visibility buffer refers back to the primitive when shading
+		UINT primitiveIndex = static_cast<UINT>(Primitives.size());
+		Primitive.Index = primitiveIndex;
+		Primitive.StateIndex = CaptureDrawState();
+		Primitives.push_back(Primitive);
+
+		if (!pThreadPool)
+		{
+			RasterizePrimitive(Primitives.back(), viewport, States.back().Pipeline);
+			return;
+		}
+
+		for (LONG tileY = top / TileSize; tileY <= (bottom - 1) / TileSize; ++tileY)
+		{
+			for (LONG tileX = left / TileSize; tileX <= (right - 1) / TileSize; ++tileX)
+			{
+				Bins[tileY * NumTilesX + tileX].push_back(primitiveIndex);
+			}
+		}
+	}
+
+	// Returns the index of the draw state matching the current pipeline, consecutive draws with the same state share it
+	UINT CaptureDrawState()
+	{
+		DrawState state = {};
+		state.Pipeline = BindPipeline();
+		state.Constants = ConstantBuffer;
+		state.Camera = Camera;
+
+		if (States.empty() || States.back() != state)
+		{
+			States.push_back(state);
+		}
+		return static_cast<UINT>(States.size() - 1);
+	}
+
+	// Returns the pipeline of the currently bound pixel shader, depth and blend state
+	const PipelineState &BindPipeline()
+	{
+		if (Pipeline.RasterizeTriangle == nullptr || Pipeline.PS != PS || Pipeline.DepthEnable != pRenderTarget->DepthEnable || Pipeline.PSWritesDepth != PSWritesDepth ||
+			Pipeline.Blend != pRenderTarget->Blend)
+		{
+			Pipeline.PS = PS;
+			Pipeline.DepthEnable = pRenderTarget->DepthEnable;
+			Pipeline.PSWritesDepth = PSWritesDepth;
+			Pipeline.Blend = pRenderTarget->Blend;
+			SelectKernels(Pipeline, VisibilityBufferEnable, SimdLevel, pRenderTarget->SampleCount);
+		}
+		return Pipeline;
+	}
+
+	// Triangle kernels of a pixel shader, indexed by SIMD_LEVEL then DEPTH_MODE
+	using TriangleKernelTable = PFN_RASTERIZE_TRIANGLE[3][3];
+	// Multisampled triangle kernels of a pixel shader, indexed by DEPTH_MODE
+	using MultisampleKernelTable = PFN_RASTERIZE_TRIANGLE[3];
+
+	// Kernels specialized for one pixel shader
+	struct ShaderKernels
+	{
+		const TriangleKernelTable *RasterizeTriangle;
+		const MultisampleKernelTable *RasterizeTriangleMultisample;
+		PFN_SHADE_FRAGMENT ShadeFragment;
+	};
+
+	template <typename ShaderPolicy>
+	static const TriangleKernelTable &TriangleKernels()
+	{
+		static const TriangleKernelTable kernels = {
+			{&Rasterizer::RasterizeTriangle<ShaderPolicy, DepthOff>,
+			 &Rasterizer::RasterizeTriangle<ShaderPolicy, DepthEarly>,
+			 &Rasterizer::RasterizeTriangle<ShaderPolicy, DepthLate>},
+			{&Rasterizer::RasterizeTriangleSSE2<ShaderPolicy, DepthOff>,
+			 &Rasterizer::RasterizeTriangleSSE2<ShaderPolicy, DepthEarly>,
+			 &Rasterizer::RasterizeTriangleSSE2<ShaderPolicy, DepthLate>},
+			{&Rasterizer::RasterizeTriangleAVX2<ShaderPolicy, DepthOff>,
+			 &Rasterizer::RasterizeTriangleAVX2<ShaderPolicy, DepthEarly>,
+			 &Rasterizer::RasterizeTriangleAVX2<ShaderPolicy, DepthLate>}};
+		return kernels;
+	}
+
+	template <typename ShaderPolicy>
+	static const MultisampleKernelTable &MultisampleKernels()
+	{
+		static const MultisampleKernelTable kernels = {
+			&Rasterizer::RasterizeTriangleMultisample<ShaderPolicy, DepthOff>,
+			&Rasterizer::RasterizeTriangleMultisample<ShaderPolicy, DepthEarly>,
+			&Rasterizer::RasterizeTriangleMultisample<ShaderPolicy, DepthLate>};
+		return kernels;
+	}
+
+	template <typename ShaderPolicy>
+	static ShaderKernels KernelsOf()
+	{
+		return {&TriangleKernels<ShaderPolicy>(), &MultisampleKernels<ShaderPolicy>(), &Rasterizer::ShadeFragment<ShaderPolicy>};
+	}
+
+	// Maps the pixel shader and depth state of a pipeline to pre-instantiated kernels, shaders not in the table go through DynamicPixelShader
+	static void SelectKernels(PipelineState &Pipeline, BOOL VisibilityBuffer, SIMD_LEVEL SimdLevel, UINT SampleCount)
+	{
+		DEPTH_MODE depthMode = !Pipeline.DepthEnable ? DepthOff : (Pipeline.PSWritesDepth ? DepthLate : DepthEarly);
+
+		struct
+		{
+			PFN_PS PS;
+			ShaderKernels Kernels;
+		} static const kernelTable[] = {
+			{nullptr, KernelsOf<NoPixelShader>()},
+			{PixelShader, KernelsOf<StaticPixelShader<PixelShader>>()},
+			{PS_White, KernelsOf<StaticPixelShader<PS_White>>()},
+			{PS_Red, KernelsOf<StaticPixelShader<PS_Red>>()},
+			{PS_Green, KernelsOf<StaticPixelShader<PS_Green>>()},
+			{PS_Blue, KernelsOf<StaticPixelShader<PS_Blue>>()},
+			{PS_Purple, KernelsOf<StaticPixelShader<PS_Purple>>()},
+			{PS_Texture, KernelsOf<StaticPixelShader<PS_Texture>>()}};
+
+		ShaderKernels kernels = KernelsOf<DynamicPixelShader>();
+		for (const auto &entry : kernelTable)
+		{
+			if (entry.PS == Pipeline.PS)
+			{
+				kernels = entry.Kernels;
+				break;
+			}
+		}
+
+		Pipeline.ShadeFragment = kernels.ShadeFragment;
+		if (SampleCount > 1)
+		{
+			Pipeline.RasterizeTriangle = (*kernels.RasterizeTriangleMultisample)[depthMode];
+			return;
+		}
+
+		// the depth a shader writes is only known after shading and blending needs every covered fragment in draw order,
+		// such triangles can't be deferred
+		if (VisibilityBuffer && depthMode != DepthLate && Pipeline.Blend.IsOpaque())
+		{
+			Pipeline.RasterizeTriangle = TriangleKernels<VisibilityPass>()[SimdLevel][depthMode];
+		}
+		else
+		{
+			Pipeline.RasterizeTriangle = (*kernels.RasterizeTriangle)[SimdLevel][depthMode];
+		}
+	}
+
+	void RasterizeTile(UINT TileIndex)
+	{
+		RECT tile = {};
+		tile.left = static_cast<LONG>((TileIndex % NumTilesX) * TileSize);
+		tile.top = static_cast<LONG>((TileIndex / NumTilesX) * TileSize);
+		tile.right = std::min(tile.left + TileSize, static_cast<LONG>(pRenderTarget->Width));
+		tile.bottom = std::min(tile.top + TileSize, static_cast<LONG>(pRenderTarget->Height));
+
+		UINT boundState = UINT(-1);
+		for (UINT primitiveIndex : Bins[TileIndex])
+		{
+			const Primitive &primitive = Primitives[primitiveIndex];
+			const DrawState &state = States[primitive.StateIndex];
+			if (primitive.StateIndex != boundState)
+			{
+				ConstantBuffer = state.Constants;
+				Camera = state.Camera;
+				boundState = primitive.StateIndex;
+			}
+
+			RasterizePrimitive(primitive, tile, state.Pipeline);
+		}
+		Bins[TileIndex].clear();
+
+		if (VisibilityBufferEnable)
+		{
+			ResolveVisibility(tile);
+		}
+		pRenderTarget->Resolve(tile);
+	}
+
+	// Shades every pixel of the region covered by a triangle of the visibility pass, then marks it as resolved
+	void ResolveVisibility(const RECT &Region)
+	{
+		UINT *pColor = pRenderTarget->RT1.Pixels.get();
+		UINT *pVisibility = pRenderTarget->VisibilityBuffer.Pixels.get();
+		UINT pitch = pRenderTarget->Width;
+
+		UINT boundState = UINT(-1);
+		for (LONG y = Region.top; y < Region.bottom; ++y)
+		{
+			// neighbouring pixels of a quad usually belong to the same primitive, reuse its derivatives
+			UINT derivativePrimitive = RenderTarget::NoPrimitive;
+			LONG derivativeX = 0;
+			Vec2 ddx = {}, ddy = {};
+			for (LONG x = Region.left; x < Region.right; ++x)
+			{
+				UINT index = y * pitch + x;
+				UINT primitiveIndex = pVisibility[index];
+				if (primitiveIndex == RenderTarget::NoPrimitive)
+				{
+					continue;
+				}
+				pVisibility[index] = RenderTarget::NoPrimitive;
+
+				const Primitive &primitive = Primitives[primitiveIndex];
+				const DrawState &state = States[primitive.StateIndex];
+				if (primitive.StateIndex != boundState)
+				{
+					ConstantBuffer = state.Constants;
+					Camera = state.Camera;
+					boundState = primitive.StateIndex;
+				}
+
+				// same integer edge functions as the visibility pass, the barycentrics match it exactly
+				const int *X = primitive.X;
+				const int *Y = primitive.Y;
+				long long px = static_cast<long long>(x) * SubpixelScale;
+				long long py = static_cast<long long>(y) * SubpixelScale;
+				float rArea = 1.0f / static_cast<float>(primitive.Area);
+				Vec3 barycentrics = {EdgeFunction(X[1], Y[1], X[2], Y[2], px, py) * rArea,
+									 EdgeFunction(X[2], Y[2], X[0], Y[0], px, py) * rArea,
+									 EdgeFunction(X[0], Y[0], X[1], Y[1], px, py) * rArea};
+
+				if (primitiveIndex != derivativePrimitive || (x & ~1) != derivativeX)
+				{
+					QuadDerivatives(primitive, x & ~1, y & ~1, ddx, ddy);
+					derivativePrimitive = primitiveIndex;
+					derivativeX = x & ~1;
+				}
+
+				Vertex v;
+				pColor[index] = state.Pipeline.ShadeFragment(primitive, barycentrics, ddx, ddy, state.Pipeline.PS, v);
+			}
+		}
+	}
+
+	// Writes every pixel of the primitive that falls inside the scissor rectangle
+	void RasterizePrimitive(const Primitive &Primitive, const RECT &Scissor, const PipelineState &Pipeline)
+	{
+		// the kernels write the targets directly, the first draw into a fast cleared tile fills it in
+		RECT region = {std::max(Primitive.Bounds.left, Scissor.left), std::max(Primitive.Bounds.top, Scissor.top),
+					   std::min(Primitive.Bounds.right, Scissor.right), std::min(Primitive.Bounds.bottom, Scissor.bottom)};
+		pRenderTarget->MaterializeClear(region, Pipeline.DepthEnable);
+
+		// only opaque triangles go through the visibility pass or clear the entries they cover. Anything else written
+		// in place first shades the deferred pixels below it, so blending reads their color and the resolve doesn't
+		// overwrite it later.
+		if (VisibilityBufferEnable && (Primitive.Type != Triangle || !Pipeline.Blend.IsOpaque()))
+		{
+			struct ConstantBuffer SavedConstants = ConstantBuffer;
+			struct Camera SavedCamera = Camera;
+			ResolveVisibility(region);
+			ConstantBuffer = SavedConstants;
+			Camera = SavedCamera;
+		}
+
+		switch (Primitive.Type)
+		{
+		case Point:
+		{
+			LONG x = Primitive.Bounds.left;
+			LONG y = Primitive.Bounds.top;
+			if (x >= Scissor.left && x < Scissor.right && y >= Scissor.top && y < Scissor.bottom)
+			{
+				pRenderTarget->SetPixel(x, y, Primitive.V[0].color, Primitive.V[0].position.z, Pipeline.DepthEnable, Pipeline.Blend);
+			}
+			break;
+		}
+		case Line:
+			RasterizeLine(Primitive, Scissor, Pipeline.DepthEnable, Pipeline.Blend);
+			break;
+		case Triangle:
+			(this->*Pipeline.RasterizeTriangle)(Primitive, Scissor, Pipeline.PS, Pipeline.Blend);
+			break;
+		}
+	}
+
+	void RasterizeLine(const Primitive &Primitive, const RECT &Scissor, BOOL DepthEnable, const BlendState &Blend)
+	{
+		const Vertex &Src = Primitive.V[0];
+		const Vertex &Dst = Primitive.V[1];
+
+		// x = (B - A) * R + A
+		float dx = fabs(Dst.position.x - Src.position.x);
+		float dy = fabs(Dst.position.y - Src.position.y);
+		int tp = static_cast<int>(fmaxf(dx, dy));
+
+		// loop
+		for (int i = 0; i < tp; ++i)
+		{
+			float r = i / static_cast<float>(tp);
+			int px = static_cast<int>(floor(((Dst.position.x - Src.position.x) * r + Src.position.x) + 0.5f));
+			int py = static_cast<int>(floor(((Dst.position.y - Src.position.y) * r + Src.position.y) + 0.5f));
+			if (px < Scissor.left || px >= Scissor.right || py < Scissor.top || py >= Scissor.bottom)
+			{
+				continue;
+			}
+
+			float depth = LinearInterpolation(Src.position.w, Dst.position.w, r);
+			unsigned int color = ColorBlend(Src, Dst, r);
+
+			pRenderTarget->SetPixel(px, py, color, depth, DepthEnable, Blend);
+		}
+	}
+
+	template <typename ShaderPolicy, DEPTH_MODE DepthMode>
+	void RasterizeTriangle(const Primitive &Primitive, const RECT &Scissor, PFN_PS PS, const BlendState &Blend)
+	{
+		const Vertex &V0 = Primitive.V[0];
+		const Vertex &V1 = Primitive.V[1];
+		const Vertex &V2 = Primitive.V[2];
+		const int *X = Primitive.X;
+		const int *Y = Primitive.Y;
+
+		int startX = std::max(Primitive.Bounds.left, Scissor.left);
+		int startY = std::max(Primitive.Bounds.top, Scissor.top);
+		int endX = std::min(Primitive.Bounds.right, Scissor.right) - 1;
+		int endY = std::min(Primitive.Bounds.bottom, Scissor.bottom) - 1;
+
+		// edge functions at the first pixel, w0 is the weight of V0 and is opposite of it
+		long long px = static_cast<long long>(startX) * SubpixelScale;
+		long long py = static_cast<long long>(startY) * SubpixelScale;
+		long long w0Origin = EdgeFunction(X[1], Y[1], X[2], Y[2], px, py);
+		long long w1Origin = EdgeFunction(X[2], Y[2], X[0], Y[0], px, py);
+		long long w2Origin = EdgeFunction(X[0], Y[0], X[1], Y[1], px, py);
+
+		// per pixel increments
+		long long w0StepX = -static_cast<long long>(Y[2] - Y[1]) * SubpixelScale, w0StepY = static_cast<long long>(X[2] - X[1]) * SubpixelScale;
+		long long w1StepX = -static_cast<long long>(Y[0] - Y[2]) * SubpixelScale, w1StepY = static_cast<long long>(X[0] - X[2]) * SubpixelScale;
+		long long w2StepX = -static_cast<long long>(Y[1] - Y[0]) * SubpixelScale, w2StepY = static_cast<long long>(X[1] - X[0]) * SubpixelScale;
+
+		// pixels exactly on an edge are rejected unless the edge is a top or left edge
+		long long w0Min = IsTopLeftEdge(X[1], Y[1], X[2], Y[2]) ? 0 : 1;
+		long long w1Min = IsTopLeftEdge(X[2], Y[2], X[0], Y[0]) ? 0 : 1;
+		long long w2Min = IsTopLeftEdge(X[0], Y[0], X[1], Y[1]) ? 0 : 1;
+
+		// the scissor keeps every pixel in bounds, write the targets directly
+		UINT *pColor = pRenderTarget->RT1.Pixels.get();
+		FLOAT *pDepth = pRenderTarget->DepthBuffer.Pixels.get();
+		UINT *pVisibility = pRenderTarget->VisibilityBuffer.Pixels.get();
+		UINT pitch = pRenderTarget->Width;
+
+		float rArea = 1.0f / static_cast<float>(Primitive.Area);
+
+		// screen space depth is linear, no fragment is closer than the nearest vertex (give or take rounding of the barycentrics)
+		float minDepth = std::min({V0.position.z, V1.position.z, V2.position.z}) - HiZEpsilon;
+
+		// walk the bounding box one hierarchical Z block at a time
+		constexpr int BlockSize = RenderTarget::HiZBlockSize;
+		for (int blockY = startY / BlockSize; blockY <= endY / BlockSize; ++blockY)
+		{
+			for (int blockX = startX / BlockSize; blockX <= endX / BlockSize; ++blockX)
+			{
+				// everything already in the block is closer than the triangle
+				if constexpr (DepthMode == DepthEarly)
+				{
+					if (minDepth > pRenderTarget->GetHiZ(blockX, blockY))
+					{
+						continue;
+					}
+				}
+
+				int blockStartX = std::max(startX, blockX * BlockSize);
+				int blockStartY = std::max(startY, blockY * BlockSize);
+				int blockEndX = std::min(endX, blockX * BlockSize + BlockSize - 1);
+				int blockEndY = std::min(endY, blockY * BlockSize + BlockSize - 1);
+
+				long long w0Row = w0Origin + (blockStartX - startX) * w0StepX + (blockStartY - startY) * w0StepY;
+				long long w1Row = w1Origin + (blockStartX - startX) * w1StepX + (blockStartY - startY) * w1StepY;
+				long long w2Row = w2Origin + (blockStartX - startX) * w2StepX + (blockStartY - startY) * w2StepY;
+
+				bool depthWritten = false;
+				for (int y = blockStartY; y <= blockEndY; y++)
+				{
+					long long w0 = w0Row;
+					long long w1 = w1Row;
+					long long w2 = w2Row;
+					// derivatives of the quad last shaded on this row
+					int derivativeX = INT_MIN;
+					Vec2 ddx = {}, ddy = {};
+					for (int x = blockStartX; x <= blockEndX; x++, w0 += w0StepX, w1 += w1StepX, w2 += w2StepX)
+					{
+						if (w0 < w0Min || w1 < w1Min || w2 < w2Min)
+						{
+							continue;
+						}
+
+						Vec3 barycentrics = {w0 * rArea, w1 * rArea, w2 * rArea};
+						UINT index = y * pitch + x;
+						float depth = BarycentricInterpolation(V0.position.z, V1.position.z, V2.position.z, barycentrics);
+
+						// occluded fragments never reach the pixel shader
+						if constexpr (DepthMode == DepthEarly)
+						{
+							if (!(depth <= pDepth[index]))
+							{
+								continue;
+							}
+						}
+
+						if constexpr (std::is_same_v<ShaderPolicy, VisibilityPass>)
+						{
+							pVisibility[index] = Primitive.Index;
+						}
+						else
+						{
+							if ((x & ~1) != derivativeX)
+							{
+								QuadDerivatives(Primitive, x & ~1, y & ~1, ddx, ddy);
+								derivativeX = x & ~1;
+							}
+
+							Vertex v;
+							UINT color = ShadeFragment<ShaderPolicy>(Primitive, barycentrics, ddx, ddy, PS, v);
+
+							// the shader may have moved the fragment, test what it wrote
+							if constexpr (DepthMode == DepthLate)
+							{
+								depth = v.position.z;
+								if (!(depth <= pDepth[index]))
+								{
+									continue;
+								}
+								// overrides whatever the visibility pass stored
+								pVisibility[index] = RenderTarget::NoPrimitive;
+							}
+
+							if (Blend.IsOpaque())
+							{
+								pColor[index] = color;
+							}
+							else
+							{
+								BlendSpan(pColor + index, &color, 1, Blend);
+							}
+						}
+
+						if constexpr (DepthMode != DepthOff)
+						{
+							pDepth[index] = depth;
+							depthWritten = true;
+						}
+					}
+
+					w0Row += w0StepY;
+					w1Row += w1StepY;
+					w2Row += w2StepY;
+				}
+
+				if (depthWritten)
+				{
+					pRenderTarget->MarkHiZDirty(blockX, blockY);
+				}
+			}
+		}
+	}
+
+	// RasterizeTriangle on multisampled targets: coverage and depth are evaluated at every sample, the pixel shader
+	// runs once per covered pixel at its integer coordinate and its color goes to the covered samples that pass the depth test.
+	// Shaders that write depth replace the depth of every covered sample.
+	template <typename ShaderPolicy, DEPTH_MODE DepthMode>
+	void RasterizeTriangleMultisample(const Primitive &Primitive, const RECT &Scissor, PFN_PS PS, const BlendState &Blend)
+	{
+		const Vertex &V0 = Primitive.V[0];
+		const Vertex &V1 = Primitive.V[1];
+		const Vertex &V2 = Primitive.V[2];
+		const int *X = Primitive.X;
+		const int *Y = Primitive.Y;
+
+		int startX = std::max(Primitive.Bounds.left, Scissor.left);
+		int startY = std::max(Primitive.Bounds.top, Scissor.top);
+		int endX = std::min(Primitive.Bounds.right, Scissor.right) - 1;
+		int endY = std::min(Primitive.Bounds.bottom, Scissor.bottom) - 1;
+
+		// edge functions at the first pixel, w0 is the weight of V0 and is opposite of it
+		long long px = static_cast<long long>(startX) * SubpixelScale;
+		long long py = static_cast<long long>(startY) * SubpixelScale;
+		long long w0Origin = EdgeFunction(X[1], Y[1], X[2], Y[2], px, py);
+		long long w1Origin = EdgeFunction(X[2], Y[2], X[0], Y[0], px, py);
+		long long w2Origin = EdgeFunction(X[0], Y[0], X[1], Y[1], px, py);
+
+		// per subpixel increments
+		long long w0dX = -static_cast<long long>(Y[2] - Y[1]), w0dY = static_cast<long long>(X[2] - X[1]);
+		long long w1dX = -static_cast<long long>(Y[0] - Y[2]), w1dY = static_cast<long long>(X[0] - X[2]);
+		long long w2dX = -static_cast<long long>(Y[1] - Y[0]), w2dY = static_cast<long long>(X[1] - X[0]);
+
+		// samples exactly on an edge are rejected unless the edge is a top or left edge
+		long long w0Min = IsTopLeftEdge(X[1], Y[1], X[2], Y[2]) ? 0 : 1;
+		long long w1Min = IsTopLeftEdge(X[2], Y[2], X[0], Y[0]) ? 0 : 1;
+		long long w2Min = IsTopLeftEdge(X[0], Y[0], X[1], Y[1]) ? 0 : 1;
+
+		float rArea = 1.0f / static_cast<float>(Primitive.Area);
+
+		// offsets of the edge functions from the integer coordinate of a pixel to each of its samples, a pixel whose
+		// edge functions clear the largest offset has every sample inside
+		long long w0Sample[4], w1Sample[4], w2Sample[4];
+		long long w0Spread = 0, w1Spread = 0, w2Spread = 0;
+		for (int i = 0; i < 4; ++i)
+		{
+			w0Sample[i] = w0dX * SampleOffsetX[i] + w0dY * SampleOffsetY[i];
+			w1Sample[i] = w1dX * SampleOffsetX[i] + w1dY * SampleOffsetY[i];
+			w2Sample[i] = w2dX * SampleOffsetX[i] + w2dY * SampleOffsetY[i];
+			w0Spread = std::max(w0Spread, -w0Sample[i]);
+			w1Spread = std::max(w1Spread, -w1Sample[i]);
+			w2Spread = std::max(w2Spread, -w2Sample[i]);
+		}
+		__m128 b0Sample = _mm_setr_ps(w0Sample[0] * rArea, w0Sample[1] * rArea, w0Sample[2] * rArea, w0Sample[3] * rArea);
+		__m128 b1Sample = _mm_setr_ps(w1Sample[0] * rArea, w1Sample[1] * rArea, w1Sample[2] * rArea, w1Sample[3] * rArea);
+		__m128 b2Sample = _mm_setr_ps(w2Sample[0] * rArea, w2Sample[1] * rArea, w2Sample[2] * rArea, w2Sample[3] * rArea);
+
+		// the scissor keeps every pixel in bounds, write the depth samples directly
+		FLOAT *pDepth = pRenderTarget->DepthBuffer.Pixels.get();
+		UINT pitch = pRenderTarget->Width;
+		const int fullCoverage = pRenderTarget->FullCoverage();
+
+		// screen space depth is linear, no sample is closer than the nearest vertex (give or take rounding of the barycentrics)
+		float minDepth = std::min({V0.position.z, V1.position.z, V2.position.z}) - HiZEpsilon;
+
+		// walk the bounding box one hierarchical Z block at a time
+		constexpr int BlockSize = RenderTarget::HiZBlockSize;
+		for (int blockY = startY / BlockSize; blockY <= endY / BlockSize; ++blockY)
+		{
+			for (int blockX = startX / BlockSize; blockX <= endX / BlockSize; ++blockX)
+			{
+				// everything already in the block is closer than the triangle
+				if constexpr (DepthMode == DepthEarly)
+				{
+					if (minDepth > pRenderTarget->GetHiZ(blockX, blockY))
+					{
+						continue;
+					}
+				}
+
+				int blockStartX = std::max(startX, blockX * BlockSize);
+				int blockStartY = std::max(startY, blockY * BlockSize);
+				int blockEndX = std::min(endX, blockX * BlockSize + BlockSize - 1);
+				int blockEndY = std::min(endY, blockY * BlockSize + BlockSize - 1);
+
+				long long w0Row = w0Origin + ((blockStartX - startX) * w0dX + (blockStartY - startY) * w0dY) * SubpixelScale;
+				long long w1Row = w1Origin + ((blockStartX - startX) * w1dX + (blockStartY - startY) * w1dY) * SubpixelScale;
+				long long w2Row = w2Origin + ((blockStartX - startX) * w2dX + (blockStartY - startY) * w2dY) * SubpixelScale;
+
+				bool depthWritten = false;
+				for (int y = blockStartY; y <= blockEndY; y++)
+				{
+					long long w0 = w0Row;
+					long long w1 = w1Row;
+					long long w2 = w2Row;
+					// derivatives of the quad last shaded on this row
+					int derivativeX = INT_MIN;
+					Vec2 ddx = {}, ddy = {};
+					for (int x = blockStartX; x <= blockEndX; x++, w0 += w0dX * SubpixelScale, w1 += w1dX * SubpixelScale, w2 += w2dX * SubpixelScale)
+					{
+						int coverage = fullCoverage;
+						if (w0 - w0Spread < w0Min || w1 - w1Spread < w1Min || w2 - w2Spread < w2Min)
+						{
+							coverage = 0;
+							for (int i = 0; i < 4; ++i)
+							{
+								bool inside = w0 + w0Sample[i] >= w0Min && w1 + w1Sample[i] >= w1Min && w2 + w2Sample[i] >= w2Min;
+								coverage |= inside << i;
+							}
+							if (coverage == 0)
+							{
+								continue;
+							}
+						}
+
+						UINT index = y * pitch + x;
+						FLOAT *pSampleDepth = pDepth + index * 4;
+						Vec3 barycentrics = {w0 * rArea, w1 * rArea, w2 * rArea};
+						__m128 depth = BarycentricInterpolation4(V0.position.z, V1.position.z, V2.position.z,
+																 _mm_add_ps(_mm_set1_ps(barycentrics.x), b0Sample),
+																 _mm_add_ps(_mm_set1_ps(barycentrics.y), b1Sample),
+																 _mm_add_ps(_mm_set1_ps(barycentrics.z), b2Sample));
+
+						// occluded pixels never reach the pixel shader
+						__m128 stored = _mm_setzero_ps();
+						if constexpr (DepthMode == DepthEarly)
+						{
+							stored = _mm_loadu_ps(pSampleDepth);
+							coverage &= _mm_movemask_ps(_mm_cmple_ps(depth, stored));
+							if (coverage == 0)
+							{
+								continue;
+							}
+						}
+
+						if ((x & ~1) != derivativeX)
+						{
+							QuadDerivatives(Primitive, x & ~1, y & ~1, ddx, ddy);
+							derivativeX = x & ~1;
+						}
+
+						Vertex v;
+						UINT color = ShadeFragment<ShaderPolicy>(Primitive, barycentrics, ddx, ddy, PS, v);
+
+						// the shader may have moved the fragment, test what it wrote
+						if constexpr (DepthMode == DepthLate)
+						{
+							depth = _mm_set1_ps(v.position.z);
+							stored = _mm_loadu_ps(pSampleDepth);
+							coverage &= _mm_movemask_ps(_mm_cmple_ps(depth, stored));
+							if (coverage == 0)
+							{
+								continue;
+							}
+						}
+
+						pRenderTarget->WriteSamples(index, color, coverage, Blend);
+
+						if constexpr (DepthMode != DepthOff)
+						{
+							__m128 written = LaneMask4(coverage);
+							_mm_storeu_ps(pSampleDepth, _mm_or_ps(_mm_and_ps(written, depth), _mm_andnot_ps(written, stored)));
+							depthWritten = true;
+						}
+					}
+
+					w0Row += w0dY * SubpixelScale;
+					w1Row += w1dY * SubpixelScale;
+					w2Row += w2dY * SubpixelScale;
+				}
+
+				if (depthWritten)
+				{
+					pRenderTarget->MarkHiZDirty(blockX, blockY);
+				}
+			}
+		}
+	}
+
+	// True when the edge functions stay within an int over the pixels [MinX, MaxX] x [MinY, MaxY], including the steps between SIMD groups
+	static bool EdgeFunctionsFitInt(const int *X, const int *Y, int MinX, int MinY, int MaxX, int MaxY)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			int j = (i + 1) % 3;
+			long long dx = std::abs(static_cast<long long>(X[j]) - X[i]);
+			long long dy = std::abs(static_cast<long long>(Y[j]) - Y[i]);
+			long long distX = std::max(std::abs(static_cast<long long>(MinX) * SubpixelScale - X[i]), std::abs(static_cast<long long>(MaxX) * SubpixelScale - X[i]));
+			long long distY = std::max(std::abs(static_cast<long long>(MinY) * SubpixelScale - Y[i]), std::abs(static_cast<long long>(MaxY) * SubpixelScale - Y[i]));
+			if (dx * distY + dy * distX + 4 * (dx + dy) * SubpixelScale > INT_MAX)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Interpolated attributes of a group of N pixels, one lane per pixel
+	template <int N>
+	struct alignas(4 * N) PixelLanes
+	{
+		float PositionX[N], PositionY[N], Depth[N], PositionW[N];
+		float U[N], V[N];
+		float NormalX[N], NormalY[N], NormalZ[N], NormalW[N];
+		float B0[N], B1[N], B2[N];
+		UINT Color[N];
+	};
+
+	static void InterpolateLanes(const Primitive &Primitive, __m128 b0, __m128 b1, __m128 b2, __m128 Depth, PixelLanes<4> &Lanes)
+	{
+		const Vertex &V0 = Primitive.V[0];
+		const Vertex &V1 = Primitive.V[1];
+		const Vertex &V2 = Primitive.V[2];
+
+		__m128 rZ = BarycentricInterpolation4(Primitive.rZ[0], Primitive.rZ[1], Primitive.rZ[2], b0, b1, b2);
+		_mm_store_ps(Lanes.PositionX, BarycentricInterpolation4(V0.position.x, V1.position.x, V2.position.x, b0, b1, b2));
+		_mm_store_ps(Lanes.PositionY, BarycentricInterpolation4(V0.position.y, V1.position.y, V2.position.y, b0, b1, b2));
+		_mm_store_ps(Lanes.Depth, Depth);
+		_mm_store_ps(Lanes.PositionW, BarycentricInterpolation4(V0.position.w, V1.position.w, V2.position.w, b0, b1, b2));
+		_mm_store_ps(Lanes.U, _mm_div_ps(BarycentricInterpolation4(V0.uv.x, V1.uv.x, V2.uv.x, b0, b1, b2), rZ));
+		_mm_store_ps(Lanes.V, _mm_div_ps(BarycentricInterpolation4(V0.uv.y, V1.uv.y, V2.uv.y, b0, b1, b2), rZ));
+		_mm_store_ps(Lanes.NormalX, BarycentricInterpolation4(V0.normal.x, V1.normal.x, V2.normal.x, b0, b1, b2));
+		_mm_store_ps(Lanes.NormalY, BarycentricInterpolation4(V0.normal.y, V1.normal.y, V2.normal.y, b0, b1, b2));
+		_mm_store_ps(Lanes.NormalZ, BarycentricInterpolation4(V0.normal.z, V1.normal.z, V2.normal.z, b0, b1, b2));
+		_mm_store_ps(Lanes.NormalW, BarycentricInterpolation4(V0.normal.w, V1.normal.w, V2.normal.w, b0, b1, b2));
+		_mm_store_ps(Lanes.B0, b0);
+		_mm_store_ps(Lanes.B1, b1);
+		_mm_store_ps(Lanes.B2, b2);
+		_mm_store_si128(reinterpret_cast<__m128i *>(Lanes.Color), ColorBlend4(V0.color, V1.color, V2.color, b0, b1, b2));
+	}
+
+	TARGET_AVX2 static void InterpolateLanes(const Primitive &Primitive, __m256 b0, __m256 b1, __m256 b2, __m256 Depth, PixelLanes<8> &Lanes)
+	{
+		const Vertex &V0 = Primitive.V[0];
+		const Vertex &V1 = Primitive.V[1];
+		const Vertex &V2 = Primitive.V[2];
+
+		__m256 rZ = BarycentricInterpolation8(Primitive.rZ[0], Primitive.rZ[1], Primitive.rZ[2], b0, b1, b2);
+		_mm256_store_ps(Lanes.PositionX, BarycentricInterpolation8(V0.position.x, V1.position.x, V2.position.x, b0, b1, b2));
+		_mm256_store_ps(Lanes.PositionY, BarycentricInterpolation8(V0.position.y, V1.position.y, V2.position.y, b0, b1, b2));
+		_mm256_store_ps(Lanes.Depth, Depth);
+		_mm256_store_ps(Lanes.PositionW, BarycentricInterpolation8(V0.position.w, V1.position.w, V2.position.w, b0, b1, b2));
+		_mm256_store_ps(Lanes.U, _mm256_div_ps(BarycentricInterpolation8(V0.uv.x, V1.uv.x, V2.uv.x, b0, b1, b2), rZ));
+		_mm256_store_ps(Lanes.V, _mm256_div_ps(BarycentricInterpolation8(V0.uv.y, V1.uv.y, V2.uv.y, b0, b1, b2), rZ));
+		_mm256_store_ps(Lanes.NormalX, BarycentricInterpolation8(V0.normal.x, V1.normal.x, V2.normal.x, b0, b1, b2));
+		_mm256_store_ps(Lanes.NormalY, BarycentricInterpolation8(V0.normal.y, V1.normal.y, V2.normal.y, b0, b1, b2));
+		_mm256_store_ps(Lanes.NormalZ, BarycentricInterpolation8(V0.normal.z, V1.normal.z, V2.normal.z, b0, b1, b2));
+		_mm256_store_ps(Lanes.NormalW, BarycentricInterpolation8(V0.normal.w, V1.normal.w, V2.normal.w, b0, b1, b2));
+		_mm256_store_ps(Lanes.B0, b0);
+		_mm256_store_ps(Lanes.B1, b1);
+		_mm256_store_ps(Lanes.B2, b2);
+		_mm256_store_si256(reinterpret_cast<__m256i *>(Lanes.Color), ColorBlend8(V0.color, V1.color, V2.color, b0, b1, b2));
+	}
+
+	// Runs the pixel shader on the lanes set in LiveMask, lane i is the pixel (i % Columns, i / Columns) of the group at Index.
+	// Returns the lanes left after the late depth test.
+	template <typename ShaderPolicy, DEPTH_MODE DepthMode, int N>
+	int ShadeLanes(const Primitive &Primitive, PFN_PS PS, PixelLanes<N> &Lanes, int LiveMask, UINT Index, int Columns)
+	{
+		const Vertex &V0 = Primitive.V[0];
+		const Vertex &V1 = Primitive.V[1];
+		const Vertex &V2 = Primitive.V[2];
+		FLOAT *pDepth = pRenderTarget->DepthBuffer.Pixels.get();
+		UINT *pVisibility = pRenderTarget->VisibilityBuffer.Pixels.get();
+		UINT pitch = pRenderTarget->Width;
+
+		for (int i = 0; i < N; ++i)
+		{
+			if (!(LiveMask & (1 << i)))
+			{
+				continue;
+			}
+
+			Vec3 barycentrics = {Lanes.B0[i], Lanes.B1[i], Lanes.B2[i]};
+			Vertex v;
+			v.position = {Lanes.PositionX[i], Lanes.PositionY[i], Lanes.Depth[i], Lanes.PositionW[i]};
+			v.color = static_cast<unsigned int>(BarycentricInterpolation(V0.color, V1.color, V2.color, barycentrics));
+			v.uv = {Lanes.U[i], Lanes.V[i]};
+			v.normal = {Lanes.NormalX[i], Lanes.NormalY[i], Lanes.NormalZ[i], Lanes.NormalW[i]};
+
+			// coarse derivatives from the top left, top right and bottom left lanes of the pixel's quad
+			int quad = (i % Columns) & ~1;
+			v.ddx = {Lanes.U[quad + 1] - Lanes.U[quad], Lanes.V[quad + 1] - Lanes.V[quad]};
+			v.ddy = {Lanes.U[quad + Columns] - Lanes.U[quad], Lanes.V[quad + Columns] - Lanes.V[quad]};
+
+			ShaderPolicy::Shade(PS, Lanes.Color[i], v);
+
+			// the shader may have moved the fragment, test what it wrote
+			if constexpr (DepthMode == DepthLate)
+			{
+				UINT laneIndex = Index + (i / Columns) * pitch + i % Columns;
+				Lanes.Depth[i] = v.position.z;
+				if (!(Lanes.Depth[i] <= pDepth[laneIndex]))
+				{
+					LiveMask &= ~(1 << i);
+					continue;
+				}
+				// overrides whatever the visibility pass stored
+				pVisibility[laneIndex] = RenderTarget::NoPrimitive;
+			}
+		}
+		return LiveMask;
+	}
+
+	// RasterizeTriangle on 2x2 quads: coverage, depth and attributes are evaluated for the 4 pixels at once,
+	// only the pixel shader runs per pixel. Triangles whose edge functions need 64 bits use the scalar kernel.
+	template <typename ShaderPolicy, DEPTH_MODE DepthMode>
+	void RasterizeTriangleSSE2(const Primitive &Primitive, const RECT &Scissor, PFN_PS PS, const BlendState &Blend)
+	{
+		const Vertex &V0 = Primitive.V[0];
+		const Vertex &V1 = Primitive.V[1];
+		const Vertex &V2 = Primitive.V[2];
+		const int *X = Primitive.X;
+		const int *Y = Primitive.Y;
+
+		int startX = std::max(Primitive.Bounds.left, Scissor.left);
+		int startY = std::max(Primitive.Bounds.top, Scissor.top);
+		int endX = std::min(Primitive.Bounds.right, Scissor.right) - 1;
+		int endY = std::min(Primitive.Bounds.bottom, Scissor.bottom) - 1;
+
+		// quads start on even pixels, lanes outside of [start, end] are masked off
+		int quadStartX = startX & ~1;
+		int quadStartY = startY & ~1;
+		if (!EdgeFunctionsFitInt(X, Y, quadStartX, quadStartY, endX + 1, endY + 1))
+		{
+			RasterizeTriangle<ShaderPolicy, DepthMode>(Primitive, Scissor, PS, Blend);
+			return;
+		}
+
+		// edge functions at the first quad, w0 is the weight of V0 and is opposite of it
+		long long px = static_cast<long long>(quadStartX) * SubpixelScale;
+		long long py = static_cast<long long>(quadStartY) * SubpixelScale;
+		int w0Origin = static_cast<int>(EdgeFunction(X[1], Y[1], X[2], Y[2], px, py));
+		int w1Origin = static_cast<int>(EdgeFunction(X[2], Y[2], X[0], Y[0], px, py));
+		int w2Origin = static_cast<int>(EdgeFunction(X[0], Y[0], X[1], Y[1], px, py));
+
+		// per pixel increments
+		int w0StepX = -(Y[2] - Y[1]) * SubpixelScale, w0StepY = (X[2] - X[1]) * SubpixelScale;
+		int w1StepX = -(Y[0] - Y[2]) * SubpixelScale, w1StepY = (X[0] - X[2]) * SubpixelScale;
+		int w2StepX = -(Y[1] - Y[0]) * SubpixelScale, w2StepY = (X[1] - X[0]) * SubpixelScale;
+
+		// offset of each lane from the top left pixel of the quad
+		__m128i w0Lanes = _mm_setr_epi32(0, w0StepX, w0StepY, w0StepX + w0StepY);
+		__m128i w1Lanes = _mm_setr_epi32(0, w1StepX, w1StepY, w1StepX + w1StepY);
+		__m128i w2Lanes = _mm_setr_epi32(0, w2StepX, w2StepY, w2StepX + w2StepY);
+		__m128i w0QuadStepX = _mm_set1_epi32(2 * w0StepX), w0QuadStepY = _mm_set1_epi32(2 * w0StepY);
+		__m128i w1QuadStepX = _mm_set1_epi32(2 * w1StepX), w1QuadStepY = _mm_set1_epi32(2 * w1StepY);
+		__m128i w2QuadStepX = _mm_set1_epi32(2 * w2StepX), w2QuadStepY = _mm_set1_epi32(2 * w2StepY);
+
+		// pixels exactly on an edge are rejected unless the edge is a top or left edge, w >= min is tested as w > min - 1
+		__m128i w0Bias = _mm_set1_epi32(IsTopLeftEdge(X[1], Y[1], X[2], Y[2]) ? -1 : 0);
+		__m128i w1Bias = _mm_set1_epi32(IsTopLeftEdge(X[2], Y[2], X[0], Y[0]) ? -1 : 0);
+		__m128i w2Bias = _mm_set1_epi32(IsTopLeftEdge(X[0], Y[0], X[1], Y[1]) ? -1 : 0);
+
+		const __m128i laneX = _mm_setr_epi32(0, 1, 0, 1);
+		const __m128i laneY = _mm_setr_epi32(0, 0, 1, 1);
+
+		UINT *pColor = pRenderTarget->RT1.Pixels.get();
+		FLOAT *pDepth = pRenderTarget->DepthBuffer.Pixels.get();
+		UINT *pVisibility = pRenderTarget->VisibilityBuffer.Pixels.get();
+		UINT pitch = pRenderTarget->Width;
+
+		__m128 rArea = _mm_set1_ps(1.0f / static_cast<float>(Primitive.Area));
+
+		// screen space depth is linear, no fragment is closer than the nearest vertex (give or take rounding of the barycentrics)
+		float minDepth = std::min({V0.position.z, V1.position.z, V2.position.z}) - HiZEpsilon;
+
+		// walk the bounding box one hierarchical Z block at a time, blocks are even sized so no quad straddles two of them
+		constexpr int BlockSize = RenderTarget::HiZBlockSize;
+		for (int blockY = startY / BlockSize; blockY <= endY / BlockSize; ++blockY)
+		{
+			for (int blockX = startX / BlockSize; blockX <= endX / BlockSize; ++blockX)
+			{
+				// everything already in the block is closer than the triangle
+				if constexpr (DepthMode == DepthEarly)
+				{
+					if (minDepth > pRenderTarget->GetHiZ(blockX, blockY))
+					{
+						continue;
+					}
+				}
+
+				int blockStartX = std::max(startX, blockX * BlockSize);
+				int blockStartY = std::max(startY, blockY * BlockSize);
+				int blockEndX = std::min(endX, blockX * BlockSize + BlockSize - 1);
+				int blockEndY = std::min(endY, blockY * BlockSize + BlockSize - 1);
+				int blockQuadX = blockStartX & ~1;
+				int blockQuadY = blockStartY & ~1;
+
+				__m128i minX = _mm_set1_epi32(blockStartX - 1), maxX = _mm_set1_epi32(blockEndX + 1);
+				__m128i minY = _mm_set1_epi32(blockStartY - 1), maxY = _mm_set1_epi32(blockEndY + 1);
+
+				__m128i w0Row = _mm_add_epi32(_mm_set1_epi32(w0Origin + (blockQuadX - quadStartX) * w0StepX + (blockQuadY - quadStartY) * w0StepY), w0Lanes);
+				__m128i w1Row = _mm_add_epi32(_mm_set1_epi32(w1Origin + (blockQuadX - quadStartX) * w1StepX + (blockQuadY - quadStartY) * w1StepY), w1Lanes);
+				__m128i w2Row = _mm_add_epi32(_mm_set1_epi32(w2Origin + (blockQuadX - quadStartX) * w2StepX + (blockQuadY - quadStartY) * w2StepY), w2Lanes);
+
+				bool depthWritten = false;
+				for (int y = blockQuadY; y <= blockEndY; y += 2)
+				{
+					__m128i ys = _mm_add_epi32(_mm_set1_epi32(y), laneY);
+					__m128i rowInside = _mm_and_si128(_mm_cmpgt_epi32(ys, minY), _mm_cmplt_epi32(ys, maxY));
+
+					__m128i w0 = w0Row;
+					__m128i w1 = w1Row;
+					__m128i w2 = w2Row;
+					for (int x = blockQuadX; x <= blockEndX; x += 2, w0 = _mm_add_epi32(w0, w0QuadStepX), w1 = _mm_add_epi32(w1, w1QuadStepX), w2 = _mm_add_epi32(w2, w2QuadStepX))
+					{
+						__m128i xs = _mm_add_epi32(_mm_set1_epi32(x), laneX);
+						__m128i inside = _mm_and_si128(rowInside, _mm_and_si128(_mm_cmpgt_epi32(xs, minX), _mm_cmplt_epi32(xs, maxX)));
+						__m128i covered = _mm_and_si128(_mm_cmpgt_epi32(w0, w0Bias), _mm_and_si128(_mm_cmpgt_epi32(w1, w1Bias), _mm_cmpgt_epi32(w2, w2Bias)));
+						int insideMask = _mm_movemask_ps(_mm_castsi128_ps(inside));
+						int liveMask = _mm_movemask_ps(_mm_castsi128_ps(_mm_and_si128(inside, covered)));
+						if (liveMask == 0)
+						{
+							continue;
+						}
+
+						__m128 b0 = _mm_mul_ps(_mm_cvtepi32_ps(w0), rArea);
+						__m128 b1 = _mm_mul_ps(_mm_cvtepi32_ps(w1), rArea);
+						__m128 b2 = _mm_mul_ps(_mm_cvtepi32_ps(w2), rArea);
+						__m128 depth = BarycentricInterpolation4(V0.position.z, V1.position.z, V2.position.z, b0, b1, b2);
+
+						UINT index = y * pitch + x;
+
+						// occluded fragments never reach the pixel shader
+						if constexpr (DepthMode == DepthEarly)
+						{
+							__m128 stored = LoadQuad(pDepth + index, pitch, insideMask);
+							liveMask &= _mm_movemask_ps(_mm_cmple_ps(depth, stored));
+							if (liveMask == 0)
+							{
+								continue;
+							}
+						}
+
+						if constexpr (std::is_same_v<ShaderPolicy, VisibilityPass>)
+						{
+							StoreQuad(pVisibility + index, pitch, _mm_set1_epi32(static_cast<int>(Primitive.Index)), liveMask);
+						}
+						else
+						{
+							// attributes of every lane, the pixel shader then runs on the covered ones
+							PixelLanes<4> lanes;
+							InterpolateLanes(Primitive, b0, b1, b2, depth, lanes);
+							liveMask = ShadeLanes<ShaderPolicy, DepthMode>(Primitive, PS, lanes, liveMask, index, 2);
+
+							__m128i color = _mm_load_si128(reinterpret_cast<const __m128i *>(lanes.Color));
+							if (!Blend.IsOpaque())
+							{
+								// lanes outside of liveMask are blended against zero and never stored
+								alignas(16) UINT target[4];
+								_mm_store_si128(reinterpret_cast<__m128i *>(target), LoadQuad(pColor + index, pitch, liveMask));
+								BlendSpan(target, lanes.Color, 4, Blend);
+								color = _mm_load_si128(reinterpret_cast<const __m128i *>(target));
+							}
+							StoreQuad(pColor + index, pitch, color, liveMask);
+							depth = _mm_load_ps(lanes.Depth);
+						}
+
+						if constexpr (DepthMode != DepthOff)
+						{
+							if (liveMask)
+							{
+								StoreQuad(pDepth + index, pitch, depth, liveMask);
+								depthWritten = true;
+							}
+						}
+					}
+
+					w0Row = _mm_add_epi32(w0Row, w0QuadStepY);
+					w1Row = _mm_add_epi32(w1Row, w1QuadStepY);
+					w2Row = _mm_add_epi32(w2Row, w2QuadStepY);
+				}
+
+				if (depthWritten)
+				{
+					pRenderTarget->MarkHiZDirty(blockX, blockY);
+				}
+			}
+		}
+	}
+
+	// RasterizeTriangleSSE2 on 4x2 blocks, two quads side by side
+	template <typename ShaderPolicy, DEPTH_MODE DepthMode>
+	TARGET_AVX2 void RasterizeTriangleAVX2(const Primitive &Primitive, const RECT &Scissor, PFN_PS PS, const BlendState &Blend)
+	{
+		const Vertex &V0 = Primitive.V[0];
+		const Vertex &V1 = Primitive.V[1];
+		const Vertex &V2 = Primitive.V[2];
+		const int *X = Primitive.X;
+		const int *Y = Primitive.Y;
+
+		int startX = std::max(Primitive.Bounds.left, Scissor.left);
+		int startY = std::max(Primitive.Bounds.top, Scissor.top);
+		int endX = std::min(Primitive.Bounds.right, Scissor.right) - 1;
+		int endY = std::min(Primitive.Bounds.bottom, Scissor.bottom) - 1;
+
+		// groups start on multiples of 4 horizontally and 2 vertically, lanes outside of [start, end] are masked off
+		int groupStartX = startX & ~3;
+		int groupStartY = startY & ~1;
+		if (!EdgeFunctionsFitInt(X, Y, groupStartX, groupStartY, endX + 3, endY + 1))
+		{
+			RasterizeTriangle<ShaderPolicy, DepthMode>(Primitive, Scissor, PS, Blend);
+			return;
+		}
+
+		// edge functions at the first group, w0 is the weight of V0 and is opposite of it
+		long long px = static_cast<long long>(groupStartX) * SubpixelScale;
+		long long py = static_cast<long long>(groupStartY) * SubpixelScale;
+		int w0Origin = static_cast<int>(EdgeFunction(X[1], Y[1], X[2], Y[2], px, py));
+		int w1Origin = static_cast<int>(EdgeFunction(X[2], Y[2], X[0], Y[0], px, py));
+		int w2Origin = static_cast<int>(EdgeFunction(X[0], Y[0], X[1], Y[1], px, py));
+
+		// per pixel increments
+		int w0StepX = -(Y[2] - Y[1]) * SubpixelScale, w0StepY = (X[2] - X[1]) * SubpixelScale;
+		int w1StepX = -(Y[0] - Y[2]) * SubpixelScale, w1StepY = (X[0] - X[2]) * SubpixelScale;
+		int w2StepX = -(Y[1] - Y[0]) * SubpixelScale, w2StepY = (X[1] - X[0]) * SubpixelScale;
+
+		// offset of each lane from the top left pixel of the group
+		const __m256i laneX = _mm256_setr_epi32(0, 1, 2, 3, 0, 1, 2, 3);
+		const __m256i laneY = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1);
+		__m256i w0Lanes = _mm256_add_epi32(_mm256_mullo_epi32(laneX, _mm256_set1_epi32(w0StepX)), _mm256_mullo_epi32(laneY, _mm256_set1_epi32(w0StepY)));
+		__m256i w1Lanes = _mm256_add_epi32(_mm256_mullo_epi32(laneX, _mm256_set1_epi32(w1StepX)), _mm256_mullo_epi32(laneY, _mm256_set1_epi32(w1StepY)));
+		__m256i w2Lanes = _mm256_add_epi32(_mm256_mullo_epi32(laneX, _mm256_set1_epi32(w2StepX)), _mm256_mullo_epi32(laneY, _mm256_set1_epi32(w2StepY)));
+		__m256i w0GroupStepX = _mm256_set1_epi32(4 * w0StepX), w0GroupStepY = _mm256_set1_epi32(2 * w0StepY);
+		__m256i w1GroupStepX = _mm256_set1_epi32(4 * w1StepX), w1GroupStepY = _mm256_set1_epi32(2 * w1StepY);
+		__m256i w2GroupStepX = _mm256_set1_epi32(4 * w2StepX), w2GroupStepY = _mm256_set1_epi32(2 * w2StepY);
+
+		// pixels exactly on an edge are rejected unless the edge is a top or left edge, w >= min is tested as w > min - 1
+		__m256i w0Bias = _mm256_set1_epi32(IsTopLeftEdge(X[1], Y[1], X[2], Y[2]) ? -1 : 0);
+		__m256i w1Bias = _mm256_set1_epi32(IsTopLeftEdge(X[2], Y[2], X[0], Y[0]) ? -1 : 0);
+		__m256i w2Bias = _mm256_set1_epi32(IsTopLeftEdge(X[0], Y[0], X[1], Y[1]) ? -1 : 0);
+
+		UINT *pColor = pRenderTarget->RT1.Pixels.get();
+		FLOAT *pDepth = pRenderTarget->DepthBuffer.Pixels.get();
+		UINT *pVisibility = pRenderTarget->VisibilityBuffer.Pixels.get();
+		UINT pitch = pRenderTarget->Width;
+
+		__m256 rArea = _mm256_set1_ps(1.0f / static_cast<float>(Primitive.Area));
+
+		// screen space depth is linear, no fragment is closer than the nearest vertex (give or take rounding of the barycentrics)
+		float minDepth = std::min({V0.position.z, V1.position.z, V2.position.z}) - HiZEpsilon;
+
+		// walk the bounding box one hierarchical Z block at a time, no group straddles two of them
+		constexpr int BlockSize = RenderTarget::HiZBlockSize;
+		for (int blockY = startY / BlockSize; blockY <= endY / BlockSize; ++blockY)
+		{
+			for (int blockX = startX / BlockSize; blockX <= endX / BlockSize; ++blockX)
+			{
+				// everything already in the block is closer than the triangle
+				if constexpr (DepthMode == DepthEarly)
+				{
+					if (minDepth > pRenderTarget->GetHiZ(blockX, blockY))
+					{
+						continue;
+					}
+				}
+
+				int blockStartX = std::max(startX, blockX * BlockSize);
+				int blockStartY = std::max(startY, blockY * BlockSize);
+				int blockEndX = std::min(endX, blockX * BlockSize + BlockSize - 1);
+				int blockEndY = std::min(endY, blockY * BlockSize + BlockSize - 1);
+				int blockGroupX = blockStartX & ~3;
+				int blockGroupY = blockStartY & ~1;
+
+				__m256i minX = _mm256_set1_epi32(blockStartX - 1), maxX = _mm256_set1_epi32(blockEndX + 1);
+				__m256i minY = _mm256_set1_epi32(blockStartY - 1), maxY = _mm256_set1_epi32(blockEndY + 1);
+
+				__m256i w0Row = _mm256_add_epi32(_mm256_set1_epi32(w0Origin + (blockGroupX - groupStartX) * w0StepX + (blockGroupY - groupStartY) * w0StepY), w0Lanes);
+				__m256i w1Row = _mm256_add_epi32(_mm256_set1_epi32(w1Origin + (blockGroupX - groupStartX) * w1StepX + (blockGroupY - groupStartY) * w1StepY), w1Lanes);
+				__m256i w2Row = _mm256_add_epi32(_mm256_set1_epi32(w2Origin + (blockGroupX - groupStartX) * w2StepX + (blockGroupY - groupStartY) * w2StepY), w2Lanes);
+
+				bool depthWritten = false;
+				for (int y = blockGroupY; y <= blockEndY; y += 2)
+				{
+					__m256i ys = _mm256_add_epi32(_mm256_set1_epi32(y), laneY);
+					__m256i rowInside = _mm256_and_si256(_mm256_cmpgt_epi32(ys, minY), _mm256_cmpgt_epi32(maxY, ys));
+
+					__m256i w0 = w0Row;
+					__m256i w1 = w1Row;
+					__m256i w2 = w2Row;
+					for (int x = blockGroupX; x <= blockEndX; x += 4, w0 = _mm256_add_epi32(w0, w0GroupStepX), w1 = _mm256_add_epi32(w1, w1GroupStepX), w2 = _mm256_add_epi32(w2, w2GroupStepX))
+					{
+						__m256i xs = _mm256_add_epi32(_mm256_set1_epi32(x), laneX);
+						__m256i inside = _mm256_and_si256(rowInside, _mm256_and_si256(_mm256_cmpgt_epi32(xs, minX), _mm256_cmpgt_epi32(maxX, xs)));
+						__m256i covered = _mm256_and_si256(_mm256_cmpgt_epi32(w0, w0Bias), _mm256_and_si256(_mm256_cmpgt_epi32(w1, w1Bias), _mm256_cmpgt_epi32(w2, w2Bias)));
+						__m256i live = _mm256_and_si256(inside, covered);
+						if (_mm256_testz_si256(live, live))
+						{
+							continue;
+						}
+
+						__m256 b0 = _mm256_mul_ps(_mm256_cvtepi32_ps(w0), rArea);
+						__m256 b1 = _mm256_mul_ps(_mm256_cvtepi32_ps(w1), rArea);
+						__m256 b2 = _mm256_mul_ps(_mm256_cvtepi32_ps(w2), rArea);
+						__m256 depth = BarycentricInterpolation8(V0.position.z, V1.position.z, V2.position.z, b0, b1, b2);
+
+						UINT index = y * pitch + x;
+
+						// occluded fragments never reach the pixel shader
+						if constexpr (DepthMode == DepthEarly)
+						{
+							__m256 stored = LoadBlock(pDepth + index, pitch, inside);
+							live = _mm256_and_si256(live, _mm256_castps_si256(_mm256_cmp_ps(depth, stored, _CMP_LE_OQ)));
+							if (_mm256_testz_si256(live, live))
+							{
+								continue;
+							}
+						}
+
+						if constexpr (std::is_same_v<ShaderPolicy, VisibilityPass>)
+						{
+							StoreBlock(pVisibility + index, pitch, _mm256_set1_epi32(static_cast<int>(Primitive.Index)), live);
+						}
+						else
+						{
+							// attributes of every lane, the pixel shader then runs on the covered ones
+							PixelLanes<8> lanes;
+							InterpolateLanes(Primitive, b0, b1, b2, depth, lanes);
+							int liveMask = ShadeLanes<ShaderPolicy, DepthMode>(Primitive, PS, lanes, _mm256_movemask_ps(_mm256_castsi256_ps(live)), index, 4);
+							live = LaneMask8(liveMask);
+
+							__m256i color = _mm256_load_si256(reinterpret_cast<const __m256i *>(lanes.Color));
+							if (!Blend.IsOpaque())
+							{
+								alignas(32) UINT target[8];
+								_mm256_store_si256(reinterpret_cast<__m256i *>(target), LoadBlock(pColor + index, pitch, live));
+								BlendSpan(target, lanes.Color, 8, Blend);
+								color = _mm256_load_si256(reinterpret_cast<const __m256i *>(target));
+							}
+							StoreBlock(pColor + index, pitch, color, live);
+							depth = _mm256_load_ps(lanes.Depth);
+						}
+
+						if constexpr (DepthMode != DepthOff)
+						{
+							if (!_mm256_testz_si256(live, live))
+							{
+								StoreBlock(pDepth + index, pitch, depth, live);
+								depthWritten = true;
+							}
+						}
+					}
+
+					w0Row = _mm256_add_epi32(w0Row, w0GroupStepY);
+					w1Row = _mm256_add_epi32(w1Row, w1GroupStepY);
+					w2Row = _mm256_add_epi32(w2Row, w2GroupStepY);
+				}
+
+				if (depthWritten)
+				{
+					pRenderTarget->MarkHiZDirty(blockX, blockY);
+				}
+			}
+		}
+	}
+
+	// Interpolates the attributes of a covered pixel and runs the pixel shader on them, V receives the shaded fragment.
+	// DDX and DDY are the uv derivatives of the pixel's quad.
+	template <typename ShaderPolicy>
+	static UINT ShadeFragment(const Primitive &Primitive, const Vec3 &Barycentrics, const Vec2 &DDX, const Vec2 &DDY, PFN_PS PS, Vertex &V)
+	{
+		const Vertex &V0 = Primitive.V[0];
+		const Vertex &V1 = Primitive.V[1];
+		const Vertex &V2 = Primitive.V[2];
+
+		float finalRZ = BarycentricInterpolation(Primitive.rZ[0], Primitive.rZ[1], Primitive.rZ[2], Barycentrics);
+		V = BarycentricInterpolation(V0, V1, V2, Barycentrics);
+		V.uv.x /= finalRZ;
+		V.uv.y /= finalRZ;
+		V.ddx = DDX;
+		V.ddy = DDY;
+
+		UINT color = ColorBlend(V0, V1, V2, Barycentrics);
+
+		ShaderPolicy::Shade(PS, color, V);
+		return color;
+	}
+
+	// Perspective correct uv at the edge function values W0, W1, W2, same operations as the kernels use
+	static Vec2 InterpolateUV(const Primitive &Primitive, long long W0, long long W1, long long W2, float rArea)
+	{
+		Vec3 barycentrics = {W0 * rArea, W1 * rArea, W2 * rArea};
+		float rZ = BarycentricInterpolation(Primitive.rZ[0], Primitive.rZ[1], Primitive.rZ[2], barycentrics);
+		Vec2 uv = BarycentricInterpolation(Primitive.V[0].uv, Primitive.V[1].uv, Primitive.V[2].uv, barycentrics);
+		return {uv.x / rZ, uv.y / rZ};
+	}
+
+	// Coarse uv derivatives of the 2x2 quad whose top left pixel is (QuadX, QuadY), pixels of the quad outside of the
+	// triangle are evaluated all the same. Matches the lane differences of the SIMD kernels exactly.
+	static void QuadDerivatives(const Primitive &Primitive, int QuadX, int QuadY, Vec2 &DDX, Vec2 &DDY)
+	{
+		const int *X = Primitive.X;
+		const int *Y = Primitive.Y;
+		float rArea = 1.0f / static_cast<float>(Primitive.Area);
+
+		// top left, top right and bottom left pixels
+		Vec2 uv[3];
+		for (int i = 0; i < 3; ++i)
+		{
+			long long px = static_cast<long long>(QuadX + (i == 1)) * SubpixelScale;
+			long long py = static_cast<long long>(QuadY + (i == 2)) * SubpixelScale;
+			uv[i] = InterpolateUV(Primitive,
+								  EdgeFunction(X[1], Y[1], X[2], Y[2], px, py),
+								  EdgeFunction(X[2], Y[2], X[0], Y[0], px, py),
+								  EdgeFunction(X[0], Y[0], X[1], Y[1], px, py), rArea);
+		}
+		DDX = {uv[1].x - uv[0].x, uv[1].y - uv[0].y};
+		DDY = {uv[2].x - uv[0].x, uv[2].y - uv[0].y};
+	}
+
+	///////////////////////////////////////////////////
+	//	0 : Line is hidden behind near plane
+	//	1 : One vertex is clipped
+	//	2 : Both vertex is present in the view frustrum
+	///////////////////////////////////////////////////
+	int NearPlaneLineClipping(Vertex &Src, Vertex &Dst)
+	{
+		// both vertex is hidden
+		if (Src.position.z < 0.0f &&
+			Dst.position.z < 0.0f)
+			return 0;
+		// both vertex is present
+		if (Src.position.z >= 0.0f &&
+			Dst.position.z >= 0.0f)
+			return 2;
+		float zBehindNearP = 0.0f;
+		float deltaZ = fabs(Dst.position.z - Src.position.z);
+		float zRatio = 1.0f;
+		// if vertex a.z is behind the near plane
+		if (Src.position.z < 0.0f)
+		{
+			zBehindNearP = fabs(Src.position.z);
+			zRatio = zBehindNearP / deltaZ;
+			LerpAllAttributes(Src, Dst, zRatio);
+			return 1;
+		}
+		// if vertex b.z is behind near plane
+		else if (Dst.position.z < 0.0f)
+		{
+			zBehindNearP = fabs(Dst.position.z);
+			zRatio = zBehindNearP / deltaZ;
+			LerpAllAttributes(Dst, Src, zRatio);
+			return 1;
+		}
+		return -1;
+	}
+
+	RenderTarget *pRenderTarget = nullptr;
+	PFN_VS VS = nullptr;
+	PFN_PS PS = nullptr;
+	// set when PS writes the depth of the fragment into V.position.z, forces the depth test after shading
+	BOOL PSWritesDepth = FALSE;
+	PipelineState Pipeline = {};
+	BOOL VisibilityBufferEnable = FALSE;
+	SIMD_LEVEL SimdLevel = GetSimdLevel();
+
+	// scratch storage of DrawIndexed
+	std::vector<Vertex> TransformedVertices;
+	std::vector<bool> IsTransformed;
+
+	// tile binning, only used when rendering with worker threads or the visibility buffer
+	std::unique_ptr<ThreadPool> pThreadPool;
+	UINT NumTilesX = 0, NumTilesY = 0;
+	std::vector<Primitive> Primitives;
+	std::vector<DrawState> States;
+	std::vector<std::vector<UINT>> Bins;
 };
\ No newline at end of file
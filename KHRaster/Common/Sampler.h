@@ -0,0 +1,271 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include "Defines.h"
+#include "EngineMath.h"
+
+///////////////////////////////////////////////////
+//	None		: nearest texel of the nearest mip
+//	Bilinear	: 2x2 texels of the nearest mip
+//	Trilinear	: bilinear on the two closest mips
+//	Anisotropic	: several trilinear taps along the longer axis of
+//				  the pixel footprint, needs the uv derivatives
+///////////////////////////////////////////////////
+enum FILTER
+{
+	None,
+	Bilinear,
+	Trilinear,
+	Anisotropic
+};
+
+///////////////////////////////////////////////////
+//	Wrap	: the texture repeats
+//	Clamp	: coordinates outside of it take the edge texel
+//	Mirror	: the texture repeats, flipped every other time
+///////////////////////////////////////////////////
+enum ADDRESS_MODE
+{
+	Wrap,
+	Clamp,
+	Mirror
+};
+
+// Filter weights are 8 bit fixed point, 256 is a weight of one
+static constexpr int SamplerWeightBits = 8;
+static constexpr int SamplerWeightOne = 1 << SamplerWeightBits;
+
+// Mip level being sampled
+struct SampledLevel : TextureLevel<const UINT>
+{
+	// size - 1 when the size is a power of two, addressing then reduces to a mask
+	UINT MaskX, MaskY;
+	TEXTURE_COMPRESSION Compression;
+	UINT64 Revision;
+};
+
+inline SampledLevel GetSampledLevel(const Texture2D<UINT> &Texture, UINT Level)
+{
+	TextureLevel<const UINT> level = Texture.GetLevel(Level);
+	UINT maskX = (level.Width & (level.Width - 1)) == 0 ? level.Width - 1 : 0;
+	UINT maskY = (level.Height & (level.Height - 1)) == 0 ? level.Height - 1 : 0;
+	return {level, maskX, maskY, Texture.Compression, Texture.Revision};
+}
+
+// Recently decoded 4x4 blocks, direct mapped on the block address. Neighboring fetches mostly land in the
+// block of the previous one, so a block is decoded once for all the pixels that sample it.
+struct DecodedBlockCache
+{
+	static constexpr UINT NumEntries = 64;
+
+	struct Entry
+	{
+		const UINT *pBlock = nullptr;
+		UINT64 Revision = 0;
+		UINT Texels[16];
+	};
+
+	const UINT *Decode(const UINT *pBlock, UINT64 Revision, TEXTURE_COMPRESSION Compression)
+	{
+		// multiplicative hash so that the blocks above and below do not share a slot with power of two widths
+		UINT64 key = reinterpret_cast<uintptr_t>(pBlock) >> 3;
+		Entry &entry = Entries[(key * 0x9E3779B97F4A7C15ull) >> 58];
+		if (entry.pBlock != pBlock || entry.Revision != Revision)
+		{
+			if (Compression == BC1)
+			{
+				DecodeBC1Block(reinterpret_cast<const BYTE *>(pBlock), entry.Texels);
+			}
+			else
+			{
+				DecodeBC3Block(reinterpret_cast<const BYTE *>(pBlock), entry.Texels);
+			}
+			entry.pBlock = pBlock;
+			entry.Revision = Revision;
+		}
+		return entry.Texels;
+	}
+
+	Entry Entries[NumEntries];
+};
+
+// Per thread, texture workers never share decoded blocks
+inline thread_local DecodedBlockCache DecodedBlocks;
+
+// Texel (X, Y) of a block compressed level
+inline UINT FetchBlockTexel(const SampledLevel &Level, UINT X, UINT Y)
+{
+	const UINT *pBlock = Level.pTexels + (UINT64(Y >> 2) * Level.Pitch + (X >> 2)) * GetBlockSize(Level.Compression);
+	return DecodedBlocks.Decode(pBlock, Level.Revision, Level.Compression)[(Y & 3) * 4 + (X & 3)];
+}
+
+// Maps a texel coordinate into [0, Size). The coordinate is first reduced to one mirror period of 2 * Size,
+// with a mask when the size is a power of two. Wrap, Mirror and Clamp are then a subtract or a min/max of it and
+// the mode only picks one of the three results, so nothing branches on the coordinate.
+inline int AddressTexel(int Coord, UINT Size, UINT Mask, ADDRESS_MODE Mode)
+{
+	int size = static_cast<int>(Size);
+	int period = 2 * size;
+	int t = Mask ? Coord & (period - 1) : Coord % period;
+	t += period & (t >> 31);
+	const int addressed[] = {
+		t - (size & -static_cast<int>(t >= size)),
+		std::min(std::max(Coord, 0), size - 1),
+		std::min(t, period - 1 - t)};
+	return addressed[Mode];
+}
+
+// Lerps the four 8 bit channels of two packed texels, Weight is in [0, SamplerWeightOne].
+// Two channels are processed per multiply, each has 16 bits which is enough for 255 * 256.
+inline UINT LerpTexel(UINT A, UINT B, UINT Weight)
+{
+	UINT inverse = SamplerWeightOne - Weight;
+	UINT evenA = A & 0x00ff00ff, oddA = (A >> 8) & 0x00ff00ff;
+	UINT evenB = B & 0x00ff00ff, oddB = (B >> 8) & 0x00ff00ff;
+	UINT even = ((evenA * inverse + evenB * Weight) >> SamplerWeightBits) & 0x00ff00ff;
+	UINT odd = ((oddA * inverse + oddB * Weight) >> SamplerWeightBits) & 0x00ff00ff;
+	return even | (odd << 8);
+}
+
+struct Sampler
+{
+	FILTER Filter = Bilinear;
+	ADDRESS_MODE AddressU = Wrap;
+	ADDRESS_MODE AddressV = Wrap;
+	UINT MaxAnisotropy = 8;
+
+	bool operator==(const Sampler &) const = default;
+
+	// Samples with the level of detail given directly, Anisotropic filters like Trilinear
+	UINT Sample(const Texture2D<UINT> &Texture, Vec2 UV, float Lod) const
+	{
+		UINT levels = Texture.MipLevels;
+		switch (Filter)
+		{
+		case None:
+			return SamplePoint(GetSampledLevel(Texture, NearestLevel(Lod, levels)), UV);
+		case Bilinear:
+			return SampleBilinear(GetSampledLevel(Texture, NearestLevel(Lod, levels)), UV);
+		default:
+			return SampleTrilinear(Texture, levels, UV, Lod);
+		}
+	}
+
+	// Samples with the level of detail derived from the screen space derivatives of the uv
+	UINT SampleGrad(const Texture2D<UINT> &Texture, Vec2 UV, Vec2 DDX, Vec2 DDY) const
+	{
+		// footprint of the pixel in texels of the top level
+		float dxU = DDX.x * Texture.Width, dxV = DDX.y * Texture.Height;
+		float dyU = DDY.x * Texture.Width, dyV = DDY.y * Texture.Height;
+		float lengthSqX = dxU * dxU + dxV * dxV;
+		float lengthSqY = dyU * dyU + dyV * dyV;
+		float majorSq = std::max(lengthSqX, lengthSqY);
+		float minorSq = std::min(lengthSqX, lengthSqY);
+
+		// log2 of the length is half the log2 of the squared length, no square root needed
+		if (Filter != Anisotropic || minorSq <= 0.0f || majorSq <= minorSq)
+		{
+			return Sample(Texture, UV, 0.5f * ComputeLod(majorSq));
+		}
+
+		// spread the taps along the major axis, each one filters the footprint of the minor axis
+		float major = sqrtf(majorSq), minor = sqrtf(minorSq);
+		UINT taps = static_cast<UINT>(std::min(ceilf(major / minor), static_cast<float>(std::clamp(MaxAnisotropy, 1u, 16u))));
+		float lod = ComputeLod(major / taps);
+		Vec2 axis = lengthSqX >= lengthSqY ? DDX : DDY;
+
+		UINT levels = Texture.MipLevels;
+		UINT even = 0, odd = 0;
+		for (UINT i = 0; i < taps; ++i)
+		{
+			float offset = (i + 0.5f) / taps - 0.5f;
+			UINT texel = SampleTrilinear(Texture, levels, {UV.x + axis.x * offset, UV.y + axis.y * offset}, lod);
+			even += texel & 0x00ff00ff;
+			odd += (texel >> 8) & 0x00ff00ff;
+		}
+		// at most 16 taps of 255 per channel fit in the 16 bits between channels, each one is divided on its own
+		// so that no remainder carries into the channel below
+		auto average = [taps](UINT Sum) { return ((Sum & 0xffff) / taps) | (((Sum >> 16) / taps) << 16); };
+		return average(even) | (average(odd) << 8);
+	}
+
+	static float ComputeLod(float Footprint)
+	{
+		return Footprint > 0.0f ? log2f(Footprint) : -INFINITY;
+	}
+
+	static UINT NearestLevel(float Lod, UINT Levels)
+	{
+		float level = floorf(Lod + 0.5f);
+		// written so that a NaN lod takes the top level
+		return !(level > 0.0f) ? 0 : static_cast<UINT>(std::min(level, static_cast<float>(Levels - 1)));
+	}
+
+	UINT SamplePoint(const SampledLevel &Level, Vec2 UV) const
+	{
+		int x = AddressTexel(static_cast<int>(floorf(UV.x * Level.Width)), Level.Width, Level.MaskX, AddressU);
+		int y = AddressTexel(static_cast<int>(floorf(UV.y * Level.Height)), Level.Height, Level.MaskY, AddressV);
+		if (Level.Compression != NoCompression)
+		{
+			return FetchBlockTexel(Level, x, y);
+		}
+		return *Level.Texel(x, y);
+	}
+
+	UINT SampleBilinear(const SampledLevel &Level, Vec2 UV) const
+	{
+		// texel centers are at half coordinates, split into the integer texel and the fixed point weight
+		int fx = static_cast<int>(floorf((UV.x * Level.Width - 0.5f) * SamplerWeightOne));
+		int fy = static_cast<int>(floorf((UV.y * Level.Height - 0.5f) * SamplerWeightOne));
+		UINT weightX = fx & (SamplerWeightOne - 1);
+		UINT weightY = fy & (SamplerWeightOne - 1);
+
+		UINT x0 = AddressTexel(fx >> SamplerWeightBits, Level.Width, Level.MaskX, AddressU);
+		UINT x1 = AddressTexel((fx >> SamplerWeightBits) + 1, Level.Width, Level.MaskX, AddressU);
+		UINT y0 = AddressTexel(fy >> SamplerWeightBits, Level.Height, Level.MaskY, AddressV);
+		UINT y1 = AddressTexel((fy >> SamplerWeightBits) + 1, Level.Height, Level.MaskY, AddressV);
+
+		UINT topLeft, topRight, bottomLeft, bottomRight;
+		if (Level.Compression != NoCompression)
+		{
+			topLeft = FetchBlockTexel(Level, x0, y0);
+			topRight = FetchBlockTexel(Level, x1, y0);
+			bottomLeft = FetchBlockTexel(Level, x0, y1);
+			bottomRight = FetchBlockTexel(Level, x1, y1);
+		}
+		else
+		{
+			// rows and columns are addressed separately, which works for any layout
+			UINT column0 = Level.ColumnOffset(x0);
+			UINT column1 = Level.ColumnOffset(x1);
+			const UINT *pRow0 = Level.pTexels + Level.RowOffset(y0);
+			const UINT *pRow1 = Level.pTexels + Level.RowOffset(y1);
+			topLeft = pRow0[column0];
+			topRight = pRow0[column1];
+			bottomLeft = pRow1[column0];
+			bottomRight = pRow1[column1];
+		}
+
+		UINT top = LerpTexel(topLeft, topRight, weightX);
+		UINT bottom = LerpTexel(bottomLeft, bottomRight, weightX);
+		return LerpTexel(top, bottom, weightY);
+	}
+
+	UINT SampleTrilinear(const Texture2D<UINT> &Texture, UINT Levels, Vec2 UV, float Lod) const
+	{
+		if (!(Lod > 0.0f) || Levels == 1)
+		{
+			return SampleBilinear(GetSampledLevel(Texture, 0), UV);
+		}
+		if (Lod >= static_cast<float>(Levels - 1))
+		{
+			return SampleBilinear(GetSampledLevel(Texture, Levels - 1), UV);
+		}
+
+		UINT level = static_cast<UINT>(Lod);
+		UINT weight = static_cast<UINT>((Lod - level) * SamplerWeightOne);
+		UINT fine = SampleBilinear(GetSampledLevel(Texture, level), UV);
+		UINT coarse = SampleBilinear(GetSampledLevel(Texture, level + 1), UV);
+		return LerpTexel(fine, coarse, weight);
+	}
+};
@@ -1,5 +1,7 @@
 #pragma once
 #include "MathFunction.h"
+#include "ColorMath.h"
+#include "Sampler.h"
 
 // shader variables
 float scaleX = 1.0f;
@@ -10,18 +12,12 @@ float translateY = 0.0f;
 float translateZ = 0.0f;
 float angle = 0.0f;
 
-enum FILTER
-{
-	None,
-	Bilinear
-};
-
-struct ConstantBuffer
+// Per thread so that tile workers can bind the constants of the draw they are rasterizing
+thread_local struct ConstantBuffer
 {
 	Matrix4x4 World = Matrix_Identity();
 	Texture2D<UINT> *pTexture = nullptr;
-	FILTER Filter = None;
-	UINT SelectedMip = 0;
+	struct Sampler Sampler;
 
 	// Light stuff
 	Vertex light = {0};
@@ -29,7 +25,7 @@ struct ConstantBuffer
 	float lightRadius = 1.0f;
 } ConstantBuffer;
 
-struct Camera
+thread_local struct Camera
 {
 	Matrix4x4 View()
 	{
@@ -57,46 +53,73 @@ struct Camera
 	float AspectRatio = 1.0f;
 } Camera;
 
-inline unsigned int ColorBlend(Vertex Src, Vertex Dst, float ratio)
-{
-	unsigned int startAlpha = (Src.color & 0xff000000) >> 24;
-	unsigned int startRed = (Src.color & 0x00ff0000) >> 16;
-	unsigned int startGreen = (Src.color & 0x0000ff00) >> 8;
-	unsigned int startBlue = (Src.color & 0x000000ff);
-
-	unsigned int endAlpha = (Dst.color & 0xff000000) >> 24;
-	unsigned int endRed = (Dst.color & 0x00ff0000) >> 16;
-	unsigned int endGreen = (Dst.color & 0x0000ff00) >> 8;
-	unsigned int endBlue = (Dst.color & 0x000000ff);
+///////////////////////////////////////////////////
+//	Matrices derived from ConstantBuffer and Camera.
+//	CompileConstants rebuilds them once per draw, and
+//	only the ones whose inputs changed since the last draw
+///////////////////////////////////////////////////
+thread_local struct CompiledConstants
+{
+	Matrix4x4 World;
+	Matrix4x4 View;
+	Matrix4x4 Projection;
+	Matrix4x4 WorldViewProjection;
+	// inverse transpose of World, transforms normals
+	Matrix4x4 NormalMatrix;
+
+	// inputs the matrices were built from
+	Matrix4x4 CameraWorld;
+	float Near, Far, FOV, AspectRatio;
+	bool Valid = false;
+} CompiledConstants;
+
+void CompileConstants()
+{
+	auto &compiled = CompiledConstants;
+
+	bool worldDirty = !compiled.Valid || memcmp(&compiled.World, &ConstantBuffer.World, sizeof(Matrix4x4)) != 0;
+	bool viewDirty = !compiled.Valid || memcmp(&compiled.CameraWorld, &Camera.World, sizeof(Matrix4x4)) != 0;
+	bool projectionDirty = !compiled.Valid ||
+						   compiled.Near != Camera.Near || compiled.Far != Camera.Far ||
+						   compiled.FOV != Camera.FOV || compiled.AspectRatio != Camera.AspectRatio;
+	if (!worldDirty && !viewDirty && !projectionDirty)
+	{
+		return;
+	}
 
-	float resultAlpha = LinearInterpolation(static_cast<float>(startAlpha), static_cast<float>(endAlpha), ratio);
-	float resultRed = LinearInterpolation(static_cast<float>(startRed), static_cast<float>(endRed), ratio);
-	float resultGreen = LinearInterpolation(static_cast<float>(startGreen), static_cast<float>(endGreen), ratio);
-	float resultBlue = LinearInterpolation(static_cast<float>(startBlue), static_cast<float>(endBlue), ratio);
+	if (worldDirty)
+	{
+		compiled.World = ConstantBuffer.World;
+		// normals are directions, drop the translation
+		compiled.NormalMatrix = Matrix_Transpose(Matrix_Inverse(compiled.World));
+		compiled.NormalMatrix._e14 = compiled.NormalMatrix._e24 = compiled.NormalMatrix._e34 = 0.0f;
+		compiled.NormalMatrix._e41 = compiled.NormalMatrix._e42 = compiled.NormalMatrix._e43 = 0.0f;
+		compiled.NormalMatrix._e44 = 1.0f;
+	}
+	if (viewDirty)
+	{
+		compiled.CameraWorld = Camera.World;
+		compiled.View = Camera.View();
+	}
+	if (projectionDirty)
+	{
+		compiled.Near = Camera.Near;
+		compiled.Far = Camera.Far;
+		compiled.FOV = Camera.FOV;
+		compiled.AspectRatio = Camera.AspectRatio;
+		compiled.Projection = Camera.Projection();
+	}
 
-	return static_cast<unsigned int>(resultAlpha) << 24 | static_cast<unsigned int>(resultRed) << 16 | static_cast<unsigned int>(resultGreen) << 8 | static_cast<unsigned int>(resultBlue);
+	compiled.WorldViewProjection = Matrix_Matrix_Multiply(Matrix_Matrix_Multiply(compiled.World, compiled.View), compiled.Projection);
+	compiled.Valid = true;
 }
 
-inline unsigned int ColorBlendBGRA(unsigned int a, unsigned int b, float ratio)
+inline unsigned int ColorBlend(const Vertex &Src, const Vertex &Dst, float ratio)
 {
-	unsigned int startBlue = (a & 0xff000000) >> 24;
-	unsigned int startGreen = (a & 0x00ff0000) >> 16;
-	unsigned int startRed = (a & 0x0000ff00) >> 8;
-	unsigned int startAlpha = (a & 0x000000ff);
-
-	unsigned int endBlue = (b & 0xff000000) >> 24;
-	unsigned int endGreen = (b & 0x00ff0000) >> 16;
-	unsigned int endRed = (b & 0x0000ff00) >> 8;
-	unsigned int endAlpha = (b & 0x000000ff);
-
-	unsigned int resultBlue = static_cast<unsigned int>(LinearInterpolation(static_cast<float>(startBlue), static_cast<float>(endBlue), ratio));
-	unsigned int resultGreen = static_cast<unsigned int>(LinearInterpolation(static_cast<float>(startGreen), static_cast<float>(endGreen), ratio));
-	unsigned int resultRed = static_cast<unsigned int>(LinearInterpolation(static_cast<float>(startRed), static_cast<float>(endRed), ratio));
-	unsigned int resultAlpha = static_cast<unsigned int>(LinearInterpolation(static_cast<float>(startAlpha), static_cast<float>(endAlpha), ratio));
-
-	return (resultBlue << 24) | (resultGreen << 16) | (resultRed << 8) | resultAlpha;
+	return ColorLerp(Src.color, Dst.color, ratio);
 }
 
+// Float like ColorBlend4 and ColorBlend8, the SIMD kernels interpolate the colors of their lanes the same way
 inline unsigned int ColorBlend(const Vertex &V0, const Vertex &V1, const Vertex &V2, const Vec3 &barycentrics)
 {
 	unsigned int aAlpha = (V0.color & 0xff000000) >> 24;
@@ -122,57 +145,11 @@ inline unsigned int ColorBlend(const Vertex &V0, const Vertex &V1, const Vertex
 	return static_cast<unsigned int>(resultAlpha) << 24 | static_cast<unsigned int>(resultRed) << 16 | static_cast<unsigned int>(resultGreen) << 8 | static_cast<unsigned int>(resultBlue);
 }
 
-inline unsigned int ColorModulate(unsigned a, unsigned b)
-{
-	float startBlue = ((a & 0xff000000) >> 24) / 255.0f;
-	float startGreen = ((a & 0x00ff0000) >> 16) / 255.0f;
-	float startRed = ((a & 0x0000ff00) >> 8) / 255.0f;
-	float startAlpha = (a & 0x000000ff) / 255.0f;
-
-	float endBlue = ((b & 0xff000000) >> 24) / 255.0f;
-	float endGreen = ((b & 0x00ff0000) >> 16) / 255.0f;
-	float endRed = ((b & 0x0000ff00) >> 8) / 255.0f;
-	float endAlpha = (b & 0x000000ff) / 255.0f;
-
-	unsigned int resultBlue = static_cast<unsigned int>(startBlue * endBlue * 255.0f);
-	unsigned int resultGreen = static_cast<unsigned int>(startGreen * endGreen * 255.0f);
-	unsigned int resultRed = static_cast<unsigned int>(startRed * endRed * 255.0f);
-	unsigned int resultAlpha = static_cast<unsigned int>(startAlpha * endAlpha * 255.0f);
-
-	return (resultBlue << 24) | (resultGreen << 16) | (resultRed << 8) | resultAlpha;
-}
-
-inline unsigned int ColorCombine(unsigned a, unsigned b)
-{
-	float startBlue = ((a & 0xff000000) >> 24) / 255.0f;
-	float startGreen = ((a & 0x00ff0000) >> 16) / 255.0f;
-	float startRed = ((a & 0x0000ff00) >> 8) / 255.0f;
-	float startAlpha = (a & 0x000000ff) / 255.0f;
-
-	float endBlue = ((b & 0xff000000) >> 24) / 255.0f;
-	float endGreen = ((b & 0x00ff0000) >> 16) / 255.0f;
-	float endRed = ((b & 0x0000ff00) >> 8) / 255.0f;
-	float endAlpha = (b & 0x000000ff) / 255.0f;
-
-	unsigned int resultBlue = static_cast<unsigned int>(Saturate(startBlue + endBlue) * 255.0f);
-	unsigned int resultGreen = static_cast<unsigned int>(Saturate(startGreen + endGreen) * 255.0f);
-	unsigned int resultRed = static_cast<unsigned int>(Saturate(startRed + endRed) * 255.0f);
-	unsigned int resultAlpha = static_cast<unsigned int>(Saturate(startAlpha + endAlpha) * 255.0f);
-
-	return (resultBlue << 24) | (resultGreen << 16) | (resultRed << 8) | resultAlpha;
-}
-
 void VertexShader(Vertex &V)
 {
-	// World space
-	V.position = Vector_Matrix_Multiply(V.position, ConstantBuffer.World);
-	V.normal = Vector_Matrix_Multiply(V.normal, ConstantBuffer.World);
-
-	// View space
-	V.position = Vector_Matrix_Multiply(V.position, Camera.View());
-
-	// Projection space
-	V.position = Vector_Matrix_Multiply(V.position, Camera.Projection());
+	// Projection space, world and view are folded into one matrix by CompileConstants
+	V.position = Vector_Matrix_Multiply(V.position, CompiledConstants.WorldViewProjection);
+	V.normal = Vector_Normalize(Vector_Matrix_Multiply(V.normal, CompiledConstants.NormalMatrix));
 }
 
 void PixelShader(UINT &color, Vertex &V)
@@ -180,49 +157,23 @@ void PixelShader(UINT &color, Vertex &V)
 	auto pTexture = ConstantBuffer.pTexture;
 	if (pTexture && pTexture->MipLevels > 0)
 	{
-		const auto &textureLevelOffsets = pTexture->MiplevelOffsets;
-
-		UINT SelectedMip = (UINT)ConstantBuffer.SelectedMip;
-
-		// safe check
-		if (SelectedMip >= pTexture->MipLevels)
-			SelectedMip = pTexture->MipLevels - 1;
-		if (SelectedMip < 0)
-			SelectedMip = 0;
-
-		// texture mip map based on argument level
-		unsigned int newTextureWidth = pTexture->Width >> SelectedMip;
-		unsigned int newTextureHeight = pTexture->Height >> SelectedMip;
-		float x = V.uv.x * newTextureWidth;
-		float y = V.uv.y * newTextureHeight;
-		int index = static_cast<int>(y) * newTextureWidth + static_cast<int>(x);
-		// convert x and y to remainders, remainders are what we use to calculate the ratio of the pixels we need to lerp
-		x = x - floor(x);
-		y = y - floor(y);
-		// adjecent pixels in the texture raster, add offset to according to mip level
-
-		unsigned int topLeft = pTexture->At(index + textureLevelOffsets[SelectedMip]);
-		unsigned int topRight = pTexture->At(index + 1 + textureLevelOffsets[SelectedMip]);
-		unsigned int bottomLeft = pTexture->At(index + newTextureWidth + textureLevelOffsets[SelectedMip]);
-		unsigned int bottomRight = pTexture->At(index + newTextureWidth + 1 + textureLevelOffsets[SelectedMip]);
-
-		unsigned int h1 = ColorBlendBGRA(topLeft, topRight, x);
-		unsigned int h2 = ColorBlendBGRA(bottomLeft, bottomRight, x);
-		color = ColorBlendBGRA(h1, h2, y);
+		color = ConstantBuffer.Sampler.SampleGrad(*pTexture, V.uv, V.ddx, V.ddy);
 	}
 
 	float NoL = Saturate(Vector_Dot(ConstantBuffer.light.normal, V.normal));
-	unsigned int color0 = ColorBlendBGRA(0x000000ff, ConstantBuffer.light.color, NoL);
 
 	Vec4 pointLightDirection = Vector_Normalize(Vector_Sub(ConstantBuffer.pointLight.position, V.position));
 	float pointLightRatio = Saturate(Vector_Dot(pointLightDirection, V.normal));
 	float attenuation = 1.0f - Saturate(Vector_Length(Vector_Sub(ConstantBuffer.pointLight.position, V.position)) / ConstantBuffer.lightRadius);
 	pointLightRatio = attenuation * attenuation * pointLightRatio;
-	unsigned int color1 = ColorBlendBGRA(0x000000ff, ConstantBuffer.pointLight.color, pointLightRatio);
 
-	color = ColorModulate(color, ColorCombine(color0, color1));
+	// both lights are scaled in one register, then the second is added to the first
+	__m128i lights = ColorLerp4(_mm_set1_epi32(static_cast<int>(BLACK)),
+								_mm_setr_epi32(static_cast<int>(ConstantBuffer.light.color), static_cast<int>(ConstantBuffer.pointLight.color), 0, 0),
+								_mm_setr_epi32(ColorWeight(NoL), ColorWeight(pointLightRatio), 0, 0));
+	UINT lighting = static_cast<UINT>(_mm_cvtsi128_si32(ColorCombine4(lights, _mm_srli_si128(lights, 4))));
 
-	color = ((color & 0xff000000) >> 24 | ((color & 0x00ff0000) >> 8) | ((color & 0x0000ff00) << 8) | ((color & 0x000000ff) << 24));
+	color = ColorModulate(color, lighting);
 }
 
 void PS_White(UINT &color, Vertex &v)
@@ -252,10 +203,10 @@ void PS_Purple(UINT &color, Vertex &v)
 
 void PS_Texture(UINT &color, Vertex &v)
 {
-	int x = static_cast<int>(v.uv.x * ConstantBuffer.pTexture->Width);
-	int y = static_cast<int>(v.uv.y * ConstantBuffer.pTexture->Height);
-	color = ConstantBuffer.pTexture->GetPixel(x, y);
-	color = ((color & 0xff000000) >> 24 | ((color & 0x00ff0000) >> 8) | ((color & 0x0000ff00) << 8) | ((color & 0x000000ff) << 24));
+	// point sampled, keeps the addressing of the bound sampler
+	struct Sampler point = ConstantBuffer.Sampler;
+	point.Filter = None;
+	color = point.SampleGrad(*ConstantBuffer.pTexture, v.uv, v.ddx, v.ddy);
 }
 
 #pragma region Helper Functions
@@ -286,4 +237,5 @@ void LerpAllAttributes(Vertex &Src, Vertex &Dst, float ratio)
 	Src.color = ColorBlend(Src, Dst, ratio);
 	Src.uv.x = LinearInterpolation(Src.uv.x, Dst.uv.x, ratio);
 	Src.uv.y = LinearInterpolation(Src.uv.y, Dst.uv.y, ratio);
+	Src.normal = LinearInterpolation(Src.normal, Dst.normal, ratio);
 }
\ No newline at end of file
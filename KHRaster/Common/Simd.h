@@ -0,0 +1,176 @@
+#pragma once
+#include <immintrin.h>
+#include "CpuFeatures.h"
+
+// SSE2 helpers of the quad kernels. A quad is a 2x2 block of pixels, lane i holds the pixel (i & 1, i >> 1).
+
+// a * b0 + b * b1 + c * b2 per lane, same order of operations as the scalar BarycentricInterpolation
+inline __m128 BarycentricInterpolation4(float a, float b, float c, __m128 b0, __m128 b1, __m128 b2)
+{
+	__m128 ab = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a), b0), _mm_mul_ps(_mm_set1_ps(b), b1));
+	return _mm_add_ps(ab, _mm_mul_ps(_mm_set1_ps(c), b2));
+}
+
+// Interpolates one 8 bit channel of three packed colors, the result is truncated like the scalar ColorBlend
+inline __m128i ChannelBlend4(unsigned int a, unsigned int b, unsigned int c, int Shift, __m128 b0, __m128 b1, __m128 b2)
+{
+	float ca = static_cast<float>((a >> Shift) & 0xff);
+	float cb = static_cast<float>((b >> Shift) & 0xff);
+	float cc = static_cast<float>((c >> Shift) & 0xff);
+	return _mm_sll_epi32(_mm_cvttps_epi32(BarycentricInterpolation4(ca, cb, cc, b0, b1, b2)), _mm_cvtsi32_si128(Shift));
+}
+
+// ColorBlend of four pixels
+inline __m128i ColorBlend4(unsigned int a, unsigned int b, unsigned int c, __m128 b0, __m128 b1, __m128 b2)
+{
+	__m128i alpha = ChannelBlend4(a, b, c, 24, b0, b1, b2);
+	__m128i red = ChannelBlend4(a, b, c, 16, b0, b1, b2);
+	__m128i green = ChannelBlend4(a, b, c, 8, b0, b1, b2);
+	__m128i blue = ChannelBlend4(a, b, c, 0, b0, b1, b2);
+	return _mm_or_si128(_mm_or_si128(alpha, red), _mm_or_si128(green, blue));
+}
+
+// Loads the quad at p, lanes not set in Mask are zero and never read
+inline __m128 LoadQuad(const float *p, unsigned int Pitch, int Mask)
+{
+	if (Mask == 0xf)
+	{
+		__m128d top = _mm_load_sd(reinterpret_cast<const double *>(p));
+		return _mm_castpd_ps(_mm_loadh_pd(top, reinterpret_cast<const double *>(p + Pitch)));
+	}
+
+	alignas(16) float lanes[4] = {};
+	for (int i = 0; i < 4; ++i)
+	{
+		if (Mask & (1 << i))
+		{
+			lanes[i] = p[(i >> 1) * Pitch + (i & 1)];
+		}
+	}
+	return _mm_load_ps(lanes);
+}
+
+inline __m128i LoadQuad(const unsigned int *p, unsigned int Pitch, int Mask)
+{
+	if (Mask == 0xf)
+	{
+		__m128i top = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p));
+		return _mm_unpacklo_epi64(top, _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p + Pitch)));
+	}
+
+	alignas(16) unsigned int lanes[4] = {};
+	for (int i = 0; i < 4; ++i)
+	{
+		if (Mask & (1 << i))
+		{
+			lanes[i] = p[(i >> 1) * Pitch + (i & 1)];
+		}
+	}
+	return _mm_load_si128(reinterpret_cast<const __m128i *>(lanes));
+}
+
+// Stores the lanes of Value set in Mask, the others are left untouched
+inline void StoreQuad(float *p, unsigned int Pitch, __m128 Value, int Mask)
+{
+	if (Mask == 0xf)
+	{
+		_mm_storel_pi(reinterpret_cast<__m64 *>(p), Value);
+		_mm_storeh_pi(reinterpret_cast<__m64 *>(p + Pitch), Value);
+		return;
+	}
+
+	alignas(16) float lanes[4];
+	_mm_store_ps(lanes, Value);
+	for (int i = 0; i < 4; ++i)
+	{
+		if (Mask & (1 << i))
+		{
+			p[(i >> 1) * Pitch + (i & 1)] = lanes[i];
+		}
+	}
+}
+
+inline void StoreQuad(unsigned int *p, unsigned int Pitch, __m128i Value, int Mask)
+{
+	if (Mask == 0xf)
+	{
+		_mm_storel_epi64(reinterpret_cast<__m128i *>(p), Value);
+		_mm_storel_epi64(reinterpret_cast<__m128i *>(p + Pitch), _mm_unpackhi_epi64(Value, Value));
+		return;
+	}
+
+	alignas(16) unsigned int lanes[4];
+	_mm_store_si128(reinterpret_cast<__m128i *>(lanes), Value);
+	for (int i = 0; i < 4; ++i)
+	{
+		if (Mask & (1 << i))
+		{
+			p[(i >> 1) * Pitch + (i & 1)] = lanes[i];
+		}
+	}
+}
+
+// Expands the low 4 bits of Mask into lane masks
+inline __m128 LaneMask4(int Mask)
+{
+	const __m128i bits = _mm_setr_epi32(1, 2, 4, 8);
+	return _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(Mask), bits), bits));
+}
+
+// AVX2 helpers of the 4x2 kernels, lane i holds the pixel (i & 3, i >> 2). Masked lanes are never accessed.
+
+TARGET_AVX2 inline __m256 BarycentricInterpolation8(float a, float b, float c, __m256 b0, __m256 b1, __m256 b2)
+{
+	__m256 ab = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(a), b0), _mm256_mul_ps(_mm256_set1_ps(b), b1));
+	return _mm256_add_ps(ab, _mm256_mul_ps(_mm256_set1_ps(c), b2));
+}
+
+TARGET_AVX2 inline __m256i ChannelBlend8(unsigned int a, unsigned int b, unsigned int c, int Shift, __m256 b0, __m256 b1, __m256 b2)
+{
+	float ca = static_cast<float>((a >> Shift) & 0xff);
+	float cb = static_cast<float>((b >> Shift) & 0xff);
+	float cc = static_cast<float>((c >> Shift) & 0xff);
+	return _mm256_sllv_epi32(_mm256_cvttps_epi32(BarycentricInterpolation8(ca, cb, cc, b0, b1, b2)), _mm256_set1_epi32(Shift));
+}
+
+TARGET_AVX2 inline __m256i ColorBlend8(unsigned int a, unsigned int b, unsigned int c, __m256 b0, __m256 b1, __m256 b2)
+{
+	__m256i alpha = ChannelBlend8(a, b, c, 24, b0, b1, b2);
+	__m256i red = ChannelBlend8(a, b, c, 16, b0, b1, b2);
+	__m256i green = ChannelBlend8(a, b, c, 8, b0, b1, b2);
+	__m256i blue = ChannelBlend8(a, b, c, 0, b0, b1, b2);
+	return _mm256_or_si256(_mm256_or_si256(alpha, red), _mm256_or_si256(green, blue));
+}
+
+// Expands the bits of a movemask back into lane masks
+TARGET_AVX2 inline __m256i LaneMask8(int Mask)
+{
+	const __m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+	return _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(Mask), bits), bits);
+}
+
+TARGET_AVX2 inline __m256 LoadBlock(const float *p, unsigned int Pitch, __m256i Mask)
+{
+	__m128 top = _mm_maskload_ps(p, _mm256_castsi256_si128(Mask));
+	__m128 bottom = _mm_maskload_ps(p + Pitch, _mm256_extracti128_si256(Mask, 1));
+	return _mm256_insertf128_ps(_mm256_castps128_ps256(top), bottom, 1);
+}
+
+TARGET_AVX2 inline __m256i LoadBlock(const unsigned int *p, unsigned int Pitch, __m256i Mask)
+{
+	__m128i top = _mm_maskload_epi32(reinterpret_cast<const int *>(p), _mm256_castsi256_si128(Mask));
+	__m128i bottom = _mm_maskload_epi32(reinterpret_cast<const int *>(p + Pitch), _mm256_extracti128_si256(Mask, 1));
+	return _mm256_inserti128_si256(_mm256_castsi128_si256(top), bottom, 1);
+}
+
+TARGET_AVX2 inline void StoreBlock(float *p, unsigned int Pitch, __m256 Value, __m256i Mask)
+{
+	_mm_maskstore_ps(p, _mm256_castsi256_si128(Mask), _mm256_castps256_ps128(Value));
+	_mm_maskstore_ps(p + Pitch, _mm256_extracti128_si256(Mask, 1), _mm256_extractf128_ps(Value, 1));
+}
+
+TARGET_AVX2 inline void StoreBlock(unsigned int *p, unsigned int Pitch, __m256i Value, __m256i Mask)
+{
+	_mm_maskstore_epi32(reinterpret_cast<int *>(p), _mm256_castsi256_si128(Mask), _mm256_castsi256_si128(Value));
+	_mm_maskstore_epi32(reinterpret_cast<int *>(p + Pitch), _mm256_extracti128_si256(Mask, 1), _mm256_extracti128_si256(Value, 1));
+}
@@ -0,0 +1,671 @@
+#include "SimdKernels.h"
+#include "ColorMath.h"
+#include "CpuFeatures.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+
+//////////////////////////////////////////////////////////////////////////
+// Fill32
+//////////////////////////////////////////////////////////////////////////
+
+static void Fill32_Scalar(void *pDst, unsigned int Value, size_t Count)
+{
+	unsigned int *p = static_cast<unsigned int *>(pDst);
+	for (size_t i = 0; i < Count; ++i)
+	{
+		p[i] = Value;
+	}
+}
+
+static void Fill32_SSE2(void *pDst, unsigned int Value, size_t Count)
+{
+	unsigned int *p = static_cast<unsigned int *>(pDst);
+	__m128i value = _mm_set1_epi32(static_cast<int>(Value));
+
+	size_t i = 0;
+	for (; i + 4 <= Count; i += 4)
+	{
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(p + i), value);
+	}
+	Fill32_Scalar(p + i, Value, Count - i);
+}
+
+TARGET_AVX2 static void Fill32_AVX2(void *pDst, unsigned int Value, size_t Count)
+{
+	unsigned int *p = static_cast<unsigned int *>(pDst);
+	__m256i value = _mm256_set1_epi32(static_cast<int>(Value));
+
+	size_t i = 0;
+	for (; i + 8 <= Count; i += 8)
+	{
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(p + i), value);
+	}
+	Fill32_Scalar(p + i, Value, Count - i);
+}
+
+void Fill32(void *pDst, unsigned int Value, size_t Count)
+{
+	static void (*const kernels[])(void *, unsigned int, size_t) = {Fill32_Scalar, Fill32_SSE2, Fill32_AVX2};
+	static const auto kernel = kernels[GetSimdLevel()];
+	kernel(pDst, Value, Count);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Fill32Stream
+//////////////////////////////////////////////////////////////////////////
+
+static void Fill32Stream_SSE2(void *pDst, unsigned int Value, size_t Count)
+{
+	unsigned int *p = static_cast<unsigned int *>(pDst);
+	__m128i value = _mm_set1_epi32(static_cast<int>(Value));
+
+	// streaming stores need 16 byte aligned addresses, elements are at least 4 byte aligned
+	size_t head = std::min(Count, ((16 - reinterpret_cast<uintptr_t>(p) % 16) % 16) / 4);
+	Fill32_Scalar(p, Value, head);
+
+	size_t i = head;
+	for (; i + 4 <= Count; i += 4)
+	{
+		_mm_stream_si128(reinterpret_cast<__m128i *>(p + i), value);
+	}
+	Fill32_Scalar(p + i, Value, Count - i);
+	_mm_sfence();
+}
+
+TARGET_AVX2 static void Fill32Stream_AVX2(void *pDst, unsigned int Value, size_t Count)
+{
+	unsigned int *p = static_cast<unsigned int *>(pDst);
+	__m256i value = _mm256_set1_epi32(static_cast<int>(Value));
+
+	size_t head = std::min(Count, ((32 - reinterpret_cast<uintptr_t>(p) % 32) % 32) / 4);
+	Fill32_Scalar(p, Value, head);
+
+	size_t i = head;
+	for (; i + 8 <= Count; i += 8)
+	{
+		_mm256_stream_si256(reinterpret_cast<__m256i *>(p + i), value);
+	}
+	Fill32_Scalar(p + i, Value, Count - i);
+	_mm_sfence();
+}
+
+void Fill32Stream(void *pDst, unsigned int Value, size_t Count)
+{
+	static void (*const kernels[])(void *, unsigned int, size_t) = {Fill32_Scalar, Fill32Stream_SSE2, Fill32Stream_AVX2};
+	static const auto kernel = kernels[GetSimdLevel()];
+	kernel(pDst, Value, Count);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// BlendSpan
+//////////////////////////////////////////////////////////////////////////
+
+// Rounded Value * Factor / 255 of 8 bit channels
+static unsigned int MultiplyChannel(unsigned int Value, unsigned int Factor)
+{
+	return ((Value * Factor + 128) * 257) >> 16;
+}
+
+static unsigned int BlendFactorChannel(BLEND_FACTOR Factor, unsigned int Src, unsigned int Dst, int Shift)
+{
+	switch (Factor)
+	{
+	case BlendZero:
+		return 0;
+	case BlendOne:
+		return 255;
+	case BlendSrcColor:
+		return (Src >> Shift) & 0xff;
+	case BlendInvSrcColor:
+		return 255 - ((Src >> Shift) & 0xff);
+	case BlendSrcAlpha:
+		return Src >> 24;
+	case BlendInvSrcAlpha:
+		return 255 - (Src >> 24);
+	case BlendDstColor:
+		return (Dst >> Shift) & 0xff;
+	case BlendInvDstColor:
+		return 255 - ((Dst >> Shift) & 0xff);
+	case BlendDstAlpha:
+		return Dst >> 24;
+	default:
+		return 255 - (Dst >> 24);
+	}
+}
+
+static void BlendSpan_Scalar(unsigned int *pDst, const unsigned int *pSrc, size_t Count, const BlendState &State)
+{
+	for (size_t i = 0; i < Count; ++i)
+	{
+		unsigned int src = pSrc[i];
+		unsigned int dst = pDst[i];
+
+		unsigned int result = 0;
+		for (int shift = 0; shift < 32; shift += 8)
+		{
+			unsigned int s = (src >> shift) & 0xff;
+			unsigned int d = (dst >> shift) & 0xff;
+			unsigned int ts = MultiplyChannel(s, BlendFactorChannel(State.SrcBlend, src, dst, shift));
+			unsigned int td = MultiplyChannel(d, BlendFactorChannel(State.DstBlend, src, dst, shift));
+
+			unsigned int channel;
+			switch (State.BlendOp)
+			{
+			case BlendAdd:
+				channel = std::min(ts + td, 255u);
+				break;
+			case BlendSubtract:
+				channel = ts > td ? ts - td : 0;
+				break;
+			case BlendRevSubtract:
+				channel = td > ts ? td - ts : 0;
+				break;
+			case BlendMin:
+				channel = std::min(s, d);
+				break;
+			default:
+				channel = std::max(s, d);
+				break;
+			}
+			result |= channel << shift;
+		}
+		pDst[i] = (result & State.WriteMask) | (dst & ~State.WriteMask);
+	}
+}
+
+// Alpha of each pixel copied to all of its channels
+static __m128i BroadcastAlpha_SSE2(__m128i Pixels)
+{
+	__m128i alpha = _mm_srli_epi32(Pixels, 24);
+	alpha = _mm_or_si128(alpha, _mm_slli_epi32(alpha, 8));
+	return _mm_or_si128(alpha, _mm_slli_epi32(alpha, 16));
+}
+
+static __m128i BlendFactor_SSE2(BLEND_FACTOR Factor, __m128i Src, __m128i Dst)
+{
+	const __m128i ones = _mm_set1_epi32(-1);
+	switch (Factor)
+	{
+	case BlendZero:
+		return _mm_setzero_si128();
+	case BlendOne:
+		return ones;
+	case BlendSrcColor:
+		return Src;
+	case BlendInvSrcColor:
+		return _mm_xor_si128(Src, ones);
+	case BlendSrcAlpha:
+		return BroadcastAlpha_SSE2(Src);
+	case BlendInvSrcAlpha:
+		return _mm_xor_si128(BroadcastAlpha_SSE2(Src), ones);
+	case BlendDstColor:
+		return Dst;
+	case BlendInvDstColor:
+		return _mm_xor_si128(Dst, ones);
+	case BlendDstAlpha:
+		return BroadcastAlpha_SSE2(Dst);
+	default:
+		return _mm_xor_si128(BroadcastAlpha_SSE2(Dst), ones);
+	}
+}
+
+static __m128i Blend_SSE2(__m128i Src, __m128i Dst, const BlendState &State)
+{
+	__m128i result;
+	switch (State.BlendOp)
+	{
+	case BlendMin:
+		result = _mm_min_epu8(Src, Dst);
+		break;
+	case BlendMax:
+		result = _mm_max_epu8(Src, Dst);
+		break;
+	default:
+	{
+		__m128i ts = ColorModulate4(Src, BlendFactor_SSE2(State.SrcBlend, Src, Dst));
+		__m128i td = ColorModulate4(Dst, BlendFactor_SSE2(State.DstBlend, Src, Dst));
+		result = State.BlendOp == BlendAdd ? _mm_adds_epu8(ts, td) : State.BlendOp == BlendSubtract ? _mm_subs_epu8(ts, td) : _mm_subs_epu8(td, ts);
+		break;
+	}
+	}
+	__m128i mask = _mm_set1_epi32(static_cast<int>(State.WriteMask));
+	return _mm_or_si128(_mm_and_si128(result, mask), _mm_andnot_si128(mask, Dst));
+}
+
+static void BlendSpan_SSE2(unsigned int *pDst, const unsigned int *pSrc, size_t Count, const BlendState &State)
+{
+	size_t i = 0;
+	if (State.IsPremultiplied())
+	{
+		// Src + Dst * (1 - Src alpha), one product per channel
+		const __m128i ones = _mm_set1_epi32(-1);
+		for (; i + 4 <= Count; i += 4)
+		{
+			__m128i src = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pSrc + i));
+			__m128i dst = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pDst + i));
+			__m128i td = ColorModulate4(dst, _mm_xor_si128(BroadcastAlpha_SSE2(src), ones));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(pDst + i), _mm_adds_epu8(src, td));
+		}
+	}
+	else
+	{
+		for (; i + 4 <= Count; i += 4)
+		{
+			__m128i src = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pSrc + i));
+			__m128i dst = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pDst + i));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(pDst + i), Blend_SSE2(src, dst, State));
+		}
+	}
+	BlendSpan_Scalar(pDst + i, pSrc + i, Count - i, State);
+}
+
+// ColorModulate4 on eight pixels
+TARGET_AVX2 static __m256i Modulate_AVX2(__m256i A, __m256i B)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i half = _mm256_set1_epi16(128);
+	const __m256i scale = _mm256_set1_epi16(257);
+
+	// unpack and pack both work within 128 bit lanes, the pixel order comes back unchanged
+	__m256i low = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(A, zero), _mm256_unpacklo_epi8(B, zero)), half);
+	__m256i high = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(A, zero), _mm256_unpackhi_epi8(B, zero)), half);
+	return _mm256_packus_epi16(_mm256_mulhi_epu16(low, scale), _mm256_mulhi_epu16(high, scale));
+}
+
+TARGET_AVX2 static __m256i BroadcastAlpha_AVX2(__m256i Pixels)
+{
+	__m256i alpha = _mm256_srli_epi32(Pixels, 24);
+	alpha = _mm256_or_si256(alpha, _mm256_slli_epi32(alpha, 8));
+	return _mm256_or_si256(alpha, _mm256_slli_epi32(alpha, 16));
+}
+
+TARGET_AVX2 static __m256i BlendFactor_AVX2(BLEND_FACTOR Factor, __m256i Src, __m256i Dst)
+{
+	const __m256i ones = _mm256_set1_epi32(-1);
+	switch (Factor)
+	{
+	case BlendZero:
+		return _mm256_setzero_si256();
+	case BlendOne:
+		return ones;
+	case BlendSrcColor:
+		return Src;
+	case BlendInvSrcColor:
+		return _mm256_xor_si256(Src, ones);
+	case BlendSrcAlpha:
+		return BroadcastAlpha_AVX2(Src);
+	case BlendInvSrcAlpha:
+		return _mm256_xor_si256(BroadcastAlpha_AVX2(Src), ones);
+	case BlendDstColor:
+		return Dst;
+	case BlendInvDstColor:
+		return _mm256_xor_si256(Dst, ones);
+	case BlendDstAlpha:
+		return BroadcastAlpha_AVX2(Dst);
+	default:
+		return _mm256_xor_si256(BroadcastAlpha_AVX2(Dst), ones);
+	}
+}
+
+TARGET_AVX2 static __m256i Blend_AVX2(__m256i Src, __m256i Dst, const BlendState &State)
+{
+	__m256i result;
+	switch (State.BlendOp)
+	{
+	case BlendMin:
+		result = _mm256_min_epu8(Src, Dst);
+		break;
+	case BlendMax:
+		result = _mm256_max_epu8(Src, Dst);
+		break;
+	default:
+	{
+		__m256i ts = Modulate_AVX2(Src, BlendFactor_AVX2(State.SrcBlend, Src, Dst));
+		__m256i td = Modulate_AVX2(Dst, BlendFactor_AVX2(State.DstBlend, Src, Dst));
+		result = State.BlendOp == BlendAdd ? _mm256_adds_epu8(ts, td) : State.BlendOp == BlendSubtract ? _mm256_subs_epu8(ts, td) : _mm256_subs_epu8(td, ts);
+		break;
+	}
+	}
+	__m256i mask = _mm256_set1_epi32(static_cast<int>(State.WriteMask));
+	return _mm256_or_si256(_mm256_and_si256(result, mask), _mm256_andnot_si256(mask, Dst));
+}
+
+TARGET_AVX2 static void BlendSpan_AVX2(unsigned int *pDst, const unsigned int *pSrc, size_t Count, const BlendState &State)
+{
+	size_t i = 0;
+	if (State.IsPremultiplied())
+	{
+		const __m256i ones = _mm256_set1_epi32(-1);
+		for (; i + 8 <= Count; i += 8)
+		{
+			__m256i src = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pSrc + i));
+			__m256i dst = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pDst + i));
+			__m256i td = Modulate_AVX2(dst, _mm256_xor_si256(BroadcastAlpha_AVX2(src), ones));
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(pDst + i), _mm256_adds_epu8(src, td));
+		}
+	}
+	else
+	{
+		for (; i + 8 <= Count; i += 8)
+		{
+			__m256i src = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pSrc + i));
+			__m256i dst = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pDst + i));
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(pDst + i), Blend_AVX2(src, dst, State));
+		}
+	}
+	BlendSpan_SSE2(pDst + i, pSrc + i, Count - i, State);
+}
+
+void BlendSpan(unsigned int *pDst, const unsigned int *pSrc, size_t Count, const BlendState &State)
+{
+	static void (*const kernels[])(unsigned int *, const unsigned int *, size_t, const BlendState &) = {BlendSpan_Scalar, BlendSpan_SSE2, BlendSpan_AVX2};
+	static const auto kernel = kernels[GetSimdLevel()];
+	kernel(pDst, pSrc, Count, State);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// DownsampleRow2x2
+//////////////////////////////////////////////////////////////////////////
+
+static void DownsampleRow2x2_Scalar(unsigned int *pDst, const unsigned int *pRow0, const unsigned int *pRow1, size_t Count)
+{
+	for (size_t i = 0; i < Count; ++i)
+	{
+		unsigned int a = pRow0[2 * i], b = pRow0[2 * i + 1];
+		unsigned int c = pRow1[2 * i], d = pRow1[2 * i + 1];
+
+		unsigned int texel = 0;
+		for (int shift = 0; shift < 32; shift += 8)
+		{
+			unsigned int sum = ((a >> shift) & 0xff) + ((b >> shift) & 0xff) + ((c >> shift) & 0xff) + ((d >> shift) & 0xff);
+			texel |= ((sum + 2) >> 2) << shift;
+		}
+		pDst[i] = texel;
+	}
+}
+
+// Sums the channels of two 2 texel groups of 16 bit words into one texel each, Low holds texels 0, 1 and High texels 2, 3
+static __m128i PairSum_SSE2(__m128i Low, __m128i High)
+{
+	return _mm_add_epi16(_mm_unpacklo_epi64(Low, High), _mm_unpackhi_epi64(Low, High));
+}
+
+static void DownsampleRow2x2_SSE2(unsigned int *pDst, const unsigned int *pRow0, const unsigned int *pRow1, size_t Count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi16(2);
+
+	size_t i = 0;
+	for (; i + 4 <= Count; i += 4)
+	{
+		__m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pRow0 + 2 * i));
+		__m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pRow0 + 2 * i + 4));
+		__m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pRow1 + 2 * i));
+		__m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pRow1 + 2 * i + 4));
+
+		// vertical sums of source texels 0-1, 2-3, 4-5, 6-7 then horizontal sums of each pair
+		__m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+		__m128i s1 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+		__m128i s2 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+		__m128i s3 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+
+		__m128i low = _mm_srli_epi16(_mm_add_epi16(PairSum_SSE2(s0, s1), round), 2);
+		__m128i high = _mm_srli_epi16(_mm_add_epi16(PairSum_SSE2(s2, s3), round), 2);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(pDst + i), _mm_packus_epi16(low, high));
+	}
+	DownsampleRow2x2_Scalar(pDst + i, pRow0 + 2 * i, pRow1 + 2 * i, Count - i);
+}
+
+TARGET_AVX2 static __m256i PairSum_AVX2(__m256i Low, __m256i High)
+{
+	return _mm256_add_epi16(_mm256_unpacklo_epi64(Low, High), _mm256_unpackhi_epi64(Low, High));
+}
+
+TARGET_AVX2 static void DownsampleRow2x2_AVX2(unsigned int *pDst, const unsigned int *pRow0, const unsigned int *pRow1, size_t Count)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i round = _mm256_set1_epi16(2);
+
+	size_t i = 0;
+	for (; i + 8 <= Count; i += 8)
+	{
+		__m256i a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pRow0 + 2 * i));
+		__m256i a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pRow0 + 2 * i + 8));
+		__m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pRow1 + 2 * i));
+		__m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pRow1 + 2 * i + 8));
+
+		__m256i s0 = _mm256_add_epi16(_mm256_unpacklo_epi8(a0, zero), _mm256_unpacklo_epi8(b0, zero));
+		__m256i s1 = _mm256_add_epi16(_mm256_unpackhi_epi8(a0, zero), _mm256_unpackhi_epi8(b0, zero));
+		__m256i s2 = _mm256_add_epi16(_mm256_unpacklo_epi8(a1, zero), _mm256_unpacklo_epi8(b1, zero));
+		__m256i s3 = _mm256_add_epi16(_mm256_unpackhi_epi8(a1, zero), _mm256_unpackhi_epi8(b1, zero));
+
+		// within 128 bit lanes, so the packed result holds destination texels 0-1, 4-5 | 2-3, 6-7
+		__m256i low = _mm256_srli_epi16(_mm256_add_epi16(PairSum_AVX2(s0, s1), round), 2);
+		__m256i high = _mm256_srli_epi16(_mm256_add_epi16(PairSum_AVX2(s2, s3), round), 2);
+		__m256i packed = _mm256_packus_epi16(low, high);
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(pDst + i), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+	DownsampleRow2x2_Scalar(pDst + i, pRow0 + 2 * i, pRow1 + 2 * i, Count - i);
+}
+
+void DownsampleRow2x2(unsigned int *pDst, const unsigned int *pRow0, const unsigned int *pRow1, size_t Count)
+{
+	static void (*const kernels[])(unsigned int *, const unsigned int *, const unsigned int *, size_t) = {DownsampleRow2x2_Scalar, DownsampleRow2x2_SSE2, DownsampleRow2x2_AVX2};
+	static const auto kernel = kernels[GetSimdLevel()];
+	kernel(pDst, pRow0, pRow1, Count);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// ResolveRow4x
+//////////////////////////////////////////////////////////////////////////
+
+static void ResolveRow4x_Scalar(unsigned int *pDst, const unsigned int *pSamples, const unsigned char *pCompressed, size_t Count)
+{
+	for (size_t i = 0; i < Count; ++i)
+	{
+		if (pCompressed[i])
+		{
+			continue;
+		}
+
+		const unsigned int *pPixel = pSamples + 4 * i;
+		unsigned int color = 0;
+		for (int shift = 0; shift < 32; shift += 8)
+		{
+			unsigned int sum = ((pPixel[0] >> shift) & 0xff) + ((pPixel[1] >> shift) & 0xff) + ((pPixel[2] >> shift) & 0xff) + ((pPixel[3] >> shift) & 0xff);
+			color |= ((sum + 2) >> 2) << shift;
+		}
+		pDst[i] = color;
+	}
+}
+
+// Channels of the 4 samples of a pixel summed pairwise into 16 bit words, samples 0 + 2 and 1 + 3
+static __m128i SampleSum_SSE2(const unsigned int *pPixel)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pPixel));
+	return _mm_add_epi16(_mm_unpacklo_epi8(samples, zero), _mm_unpackhi_epi8(samples, zero));
+}
+
+static void ResolveRow4x_SSE2(unsigned int *pDst, const unsigned int *pSamples, const unsigned char *pCompressed, size_t Count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi16(2);
+
+	size_t i = 0;
+	for (; i + 4 <= Count; i += 4)
+	{
+		// lanes of the pixels that hold samples, compressed ones already have their color in pDst
+		int flags;
+		memcpy(&flags, pCompressed + i, sizeof(flags));
+		__m128i expanded = _mm_cmpeq_epi32(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(flags), zero), zero), zero);
+		if (_mm_movemask_epi8(expanded) == 0)
+		{
+			continue;
+		}
+
+		const unsigned int *pPixels = pSamples + 4 * i;
+		__m128i low = _mm_srli_epi16(_mm_add_epi16(PairSum_SSE2(SampleSum_SSE2(pPixels), SampleSum_SSE2(pPixels + 4)), round), 2);
+		__m128i high = _mm_srli_epi16(_mm_add_epi16(PairSum_SSE2(SampleSum_SSE2(pPixels + 8), SampleSum_SSE2(pPixels + 12)), round), 2);
+		__m128i resolved = _mm_packus_epi16(low, high);
+
+		__m128i dst = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pDst + i));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(pDst + i), _mm_or_si128(_mm_and_si128(expanded, resolved), _mm_andnot_si128(expanded, dst)));
+	}
+	ResolveRow4x_Scalar(pDst + i, pSamples + 4 * i, pCompressed + i, Count - i);
+}
+
+// SampleSum_SSE2 of two pixels, one per 128 bit lane
+TARGET_AVX2 static __m256i SampleSum_AVX2(const unsigned int *pPixels)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i samples = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pPixels));
+	return _mm256_add_epi16(_mm256_unpacklo_epi8(samples, zero), _mm256_unpackhi_epi8(samples, zero));
+}
+
+TARGET_AVX2 static void ResolveRow4x_AVX2(unsigned int *pDst, const unsigned int *pSamples, const unsigned char *pCompressed, size_t Count)
+{
+	const __m256i round = _mm256_set1_epi16(2);
+	// the pack below leaves pixels 0, 2, 4, 6 in the low lane and 1, 3, 5, 7 in the high one
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+	size_t i = 0;
+	for (; i + 8 <= Count; i += 8)
+	{
+		__m256i flags = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(pCompressed + i)));
+		__m256i expanded = _mm256_cmpeq_epi32(flags, _mm256_setzero_si256());
+		if (_mm256_testz_si256(expanded, expanded))
+		{
+			continue;
+		}
+
+		const unsigned int *pPixels = pSamples + 4 * i;
+		__m256i low = _mm256_srli_epi16(_mm256_add_epi16(PairSum_AVX2(SampleSum_AVX2(pPixels), SampleSum_AVX2(pPixels + 8)), round), 2);
+		__m256i high = _mm256_srli_epi16(_mm256_add_epi16(PairSum_AVX2(SampleSum_AVX2(pPixels + 16), SampleSum_AVX2(pPixels + 24)), round), 2);
+		__m256i resolved = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(low, high), order);
+
+		__m256i dst = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pDst + i));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(pDst + i), _mm256_blendv_epi8(dst, resolved, expanded));
+	}
+	ResolveRow4x_SSE2(pDst + i, pSamples + 4 * i, pCompressed + i, Count - i);
+}
+
+void ResolveRow4x(unsigned int *pDst, const unsigned int *pSamples, const unsigned char *pCompressed, size_t Count)
+{
+	static void (*const kernels[])(unsigned int *, const unsigned int *, const unsigned char *, size_t) = {ResolveRow4x_Scalar, ResolveRow4x_SSE2, ResolveRow4x_AVX2};
+	static const auto kernel = kernels[GetSimdLevel()];
+	kernel(pDst, pSamples, pCompressed, Count);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// PackRGB8 / PackRGBA8
+//////////////////////////////////////////////////////////////////////////
+
+static void PackRGB8_Scalar(unsigned char *pDst, const unsigned int *pSrc, size_t Count)
+{
+	for (size_t i = 0; i < Count; ++i)
+	{
+		pDst[i * 3 + 0] = static_cast<unsigned char>(pSrc[i] >> 16);
+		pDst[i * 3 + 1] = static_cast<unsigned char>(pSrc[i] >> 8);
+		pDst[i * 3 + 2] = static_cast<unsigned char>(pSrc[i]);
+	}
+}
+
+// Swaps red and blue, the bytes of each ARGB8 pixel then read R, G, B, A in memory
+static __m128i SwapRedBlue_SSE2(__m128i Pixels)
+{
+	const __m128i greenAlpha = _mm_set1_epi32(static_cast<int>(0xff00ff00));
+	const __m128i blue = _mm_set1_epi32(0xff);
+	__m128i redBlue = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(Pixels, blue), 16), _mm_and_si128(_mm_srli_epi32(Pixels, 16), blue));
+	return _mm_or_si128(_mm_and_si128(Pixels, greenAlpha), redBlue);
+}
+
+static void PackRGB8_SSE2(unsigned char *pDst, const unsigned int *pSrc, size_t Count)
+{
+	const __m128i low24 = _mm_set_epi32(0, 0xffffff, 0, 0xffffff);
+	const __m128i high24 = _mm_set_epi32(0xffff, static_cast<int>(0xff000000), 0xffff, static_cast<int>(0xff000000));
+	const __m128i low6Bytes = _mm_set_epi32(0, 0, 0xffff, -1);
+
+	size_t i = 0;
+	for (; i + 4 <= Count; i += 4)
+	{
+		__m128i pixels = SwapRedBlue_SSE2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pSrc + i)));
+		// drop alpha inside each 64 bit half, leaving 6 bytes at the bottom of each, then join the halves
+		__m128i halves = _mm_or_si128(_mm_and_si128(pixels, low24), _mm_and_si128(_mm_srli_epi64(pixels, 8), high24));
+		__m128i packed = _mm_or_si128(_mm_and_si128(halves, low6Bytes), _mm_andnot_si128(low6Bytes, _mm_srli_si128(halves, 2)));
+		_mm_storel_epi64(reinterpret_cast<__m128i *>(pDst + i * 3), packed);
+		int last = _mm_cvtsi128_si32(_mm_srli_si128(packed, 8));
+		memcpy(pDst + i * 3 + 8, &last, 4);
+	}
+	PackRGB8_Scalar(pDst + i * 3, pSrc + i, Count - i);
+}
+
+TARGET_AVX2 static void PackRGB8_AVX2(unsigned char *pDst, const unsigned int *pSrc, size_t Count)
+{
+	// 12 bytes of red, green and blue at the bottom of each 128 bit lane, then the lanes are joined
+	const __m256i shuffle = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+											 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	const __m256i order = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+
+	size_t i = 0;
+	for (; i + 8 <= Count; i += 8)
+	{
+		__m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pSrc + i));
+		__m256i packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(pixels, shuffle), order);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(pDst + i * 3), _mm256_castsi256_si128(packed));
+		_mm_storel_epi64(reinterpret_cast<__m128i *>(pDst + i * 3 + 16), _mm256_extracti128_si256(packed, 1));
+	}
+	PackRGB8_SSE2(pDst + i * 3, pSrc + i, Count - i);
+}
+
+void PackRGB8(unsigned char *pDst, const unsigned int *pSrc, size_t Count)
+{
+	static void (*const kernels[])(unsigned char *, const unsigned int *, size_t) = {PackRGB8_Scalar, PackRGB8_SSE2, PackRGB8_AVX2};
+	static const auto kernel = kernels[GetSimdLevel()];
+	kernel(pDst, pSrc, Count);
+}
+
+static void PackRGBA8_Scalar(unsigned char *pDst, const unsigned int *pSrc, size_t Count)
+{
+	for (size_t i = 0; i < Count; ++i)
+	{
+		pDst[i * 4 + 0] = static_cast<unsigned char>(pSrc[i] >> 16);
+		pDst[i * 4 + 1] = static_cast<unsigned char>(pSrc[i] >> 8);
+		pDst[i * 4 + 2] = static_cast<unsigned char>(pSrc[i]);
+		pDst[i * 4 + 3] = static_cast<unsigned char>(pSrc[i] >> 24);
+	}
+}
+
+static void PackRGBA8_SSE2(unsigned char *pDst, const unsigned int *pSrc, size_t Count)
+{
+	size_t i = 0;
+	for (; i + 4 <= Count; i += 4)
+	{
+		__m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pSrc + i));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(pDst + i * 4), SwapRedBlue_SSE2(pixels));
+	}
+	PackRGBA8_Scalar(pDst + i * 4, pSrc + i, Count - i);
+}
+
+TARGET_AVX2 static void PackRGBA8_AVX2(unsigned char *pDst, const unsigned int *pSrc, size_t Count)
+{
+	const __m256i shuffle = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+											 2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+
+	size_t i = 0;
+	for (; i + 8 <= Count; i += 8)
+	{
+		__m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pSrc + i));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(pDst + i * 4), _mm256_shuffle_epi8(pixels, shuffle));
+	}
+	PackRGBA8_SSE2(pDst + i * 4, pSrc + i, Count - i);
+}
+
+void PackRGBA8(unsigned char *pDst, const unsigned int *pSrc, size_t Count)
+{
+	static void (*const kernels[])(unsigned char *, const unsigned int *, size_t) = {PackRGBA8_Scalar, PackRGBA8_SSE2, PackRGBA8_AVX2};
+	static const auto kernel = kernels[GetSimdLevel()];
+	kernel(pDst, pSrc, Count);
+}
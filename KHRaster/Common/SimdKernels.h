@@ -0,0 +1,28 @@
+#pragma once
+#include <cstddef>
+#include "BlendState.h"
+
+// Span kernels bound to the widest implementation GetSimdLevel allows on first use
+
+// Writes Value into Count consecutive 32 bit elements
+void Fill32(void *pDst, unsigned int Value, size_t Count);
+
+// Fill32 with non-temporal stores that bypass the caches, for memory that is not read again soon
+void Fill32Stream(void *pDst, unsigned int Value, size_t Count);
+
+// Merges Count pixels of pSrc into pDst by State, as if State.BlendEnable were set
+void BlendSpan(unsigned int *pDst, const unsigned int *pSrc, size_t Count, const BlendState &State);
+
+// Averages each 2x2 block of texels of two source rows into one of Count destination texels, per 8 bit channel
+// and rounded to nearest. Reads 2 * Count texels of each row.
+void DownsampleRow2x2(unsigned int *pDst, const unsigned int *pRow0, const unsigned int *pRow1, size_t Count);
+
+// Averages the 4 samples of each of Count pixels into pDst, per 8 bit channel and rounded to nearest. pSamples holds
+// the samples of a pixel consecutively, pixels whose pCompressed flag is set are left untouched.
+void ResolveRow4x(unsigned int *pDst, const unsigned int *pSamples, const unsigned char *pCompressed, size_t Count);
+
+// Writes Count ARGB8 pixels as 3 bytes each, red, green then blue, the layout of 8 bit RGB images
+void PackRGB8(unsigned char *pDst, const unsigned int *pSrc, size_t Count);
+
+// Writes Count ARGB8 pixels as 4 bytes each, red, green, blue then alpha
+void PackRGBA8(unsigned char *pDst, const unsigned int *pSrc, size_t Count);
@@ -0,0 +1,109 @@
+#include "Swapchain.h"
+#include <algorithm>
+#include <cstring>
+
+Swapchain::Swapchain(unsigned int Width, unsigned int Height, unsigned int BufferCount, unsigned int MaxFramesInFlight)
+	: Width(Width), Height(Height),
+	  BufferCount(std::clamp(BufferCount, MinBuffers, MaxBuffers)),
+	  MaxFramesInFlight(std::clamp(MaxFramesInFlight, 1u, this->BufferCount - 1))
+{
+	size_t bytes = size_t(Width) * Height * sizeof(unsigned int);
+	for (unsigned int i = 0; i < this->BufferCount; ++i)
+	{
+		void *p = ::operator new[](std::max<size_t>(bytes, 1), std::align_val_t(BufferAlignment));
+		memset(p, 0, bytes);
+		Buffers.emplace_back(static_cast<unsigned int *>(p));
+	}
+	Fences.resize(this->BufferCount, 0);
+}
+
+Swapchain::~Swapchain()
+{
+	Shutdown();
+}
+
+unsigned int *Swapchain::AcquireBackBuffer()
+{
+	std::unique_lock<std::mutex> lock(Mutex);
+	FramePresented.wait(lock, [&]()
+						{ return Fences[NextBuffer] <= CompletedFrames || Closed; });
+	return Closed ? nullptr : Buffers[NextBuffer].get();
+}
+
+bool Swapchain::Present()
+{
+	std::unique_lock<std::mutex> lock(Mutex);
+	if (Closed)
+	{
+		return false;
+	}
+
+	Fences[NextBuffer] = ++SubmittedFrames;
+	Queue.push_back({NextBuffer, GetTimerTicks()});
+	NextBuffer = (NextBuffer + 1) % BufferCount;
+	FrameQueued.notify_one();
+
+	FramePresented.wait(lock, [&]()
+						{ return SubmittedFrames - CompletedFrames <= MaxFramesInFlight || Closed; });
+	return !Closed;
+}
+
+const unsigned int *Swapchain::BeginPresent(bool Wait)
+{
+	std::unique_lock<std::mutex> lock(Mutex);
+	if (Wait)
+	{
+		FrameQueued.wait(lock, [&]()
+						 { return !Queue.empty() || ShuttingDown; });
+	}
+	return Queue.empty() ? nullptr : Buffers[Queue.front().Buffer].get();
+}
+
+void Swapchain::EndPresent()
+{
+	std::unique_lock<std::mutex> lock(Mutex);
+	if (Queue.empty())
+	{
+		return;
+	}
+	QueuedFrame frame = Queue.front();
+	Queue.pop_front();
+	// frames are presented in order, the fence of every buffer up to this frame is now signaled
+	++CompletedFrames;
+
+	LastLatency = double(GetTimerTicks() - frame.PresentTicks) / double(GetTimerFrequency());
+	TotalLatency += LastLatency;
+	MaxLatency = std::max(MaxLatency, LastLatency);
+	FramePresented.notify_all();
+}
+
+void Swapchain::Close()
+{
+	std::unique_lock<std::mutex> lock(Mutex);
+	Closed = true;
+	// nothing will present the queued frames
+	Queue.clear();
+	FramePresented.notify_all();
+	FrameQueued.notify_all();
+}
+
+void Swapchain::Shutdown()
+{
+	std::unique_lock<std::mutex> lock(Mutex);
+	Closed = true;
+	ShuttingDown = true;
+	FramePresented.notify_all();
+	FrameQueued.notify_all();
+}
+
+RS_PRESENT_STATS Swapchain::GetPresentStats()
+{
+	std::unique_lock<std::mutex> lock(Mutex);
+	RS_PRESENT_STATS stats = {};
+	stats.framesPresented = CompletedFrames;
+	stats.framesInFlight = static_cast<unsigned int>(SubmittedFrames - CompletedFrames);
+	stats.lastLatency = LastLatency;
+	stats.averageLatency = CompletedFrames ? TotalLatency / double(CompletedFrames) : 0.0;
+	stats.maxLatency = MaxLatency;
+	return stats;
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "RasterSurface.h"
+
+// Back buffers shared by the render thread and the thread presenting them, used by both RasterSurface backends.
+// Presenting a frame queues the buffer it was rendered into, nothing is copied. Each buffer has a fence, the
+// number of the last frame rendered into it, and is only handed out again once that frame has been presented.
+class Swapchain
+{
+public:
+	static constexpr unsigned int MinBuffers = 2;
+	static constexpr unsigned int MaxBuffers = 3;
+	// Back buffers are page aligned
+	static constexpr size_t BufferAlignment = 4096;
+
+	// MaxFramesInFlight is clamped to [1, BufferCount - 1] so that a buffer is always free to render into
+	Swapchain(unsigned int Width, unsigned int Height, unsigned int BufferCount, unsigned int MaxFramesInFlight);
+	~Swapchain();
+
+	Swapchain(const Swapchain &) = delete;
+	Swapchain &operator=(const Swapchain &) = delete;
+
+	// Render thread. Returns the next back buffer once its last frame has been presented, nullptr once closed
+	unsigned int *AcquireBackBuffer();
+
+	// Render thread. Queues the acquired back buffer, then waits while more than MaxFramesInFlight frames are
+	// queued or being presented. Returns false once closed
+	bool Present();
+
+	// Presenting thread. Returns the pixels of the oldest queued frame, nullptr if there is none. With Wait it
+	// sleeps until a frame is queued and only returns nullptr once shut down with nothing left to present
+	const unsigned int *BeginPresent(bool Wait);
+
+	// Presenting thread. Signals the fence of the frame returned by BeginPresent, unless Close dropped it
+	void EndPresent();
+
+	// No more frames are accepted and the queued ones are dropped, waiting render threads return
+	void Close();
+
+	// Closes and lets BeginPresent return once the queue is drained
+	void Shutdown();
+
+	RS_PRESENT_STATS GetPresentStats();
+
+	const unsigned int Width;
+	const unsigned int Height;
+	const unsigned int BufferCount;
+	const unsigned int MaxFramesInFlight;
+
+private:
+	struct AlignedDelete
+	{
+		void operator()(unsigned int *p) const
+		{
+			::operator delete[](p, std::align_val_t(BufferAlignment));
+		}
+	};
+
+	struct QueuedFrame
+	{
+		unsigned int Buffer;
+		long long PresentTicks;
+	};
+
+	std::vector<std::unique_ptr<unsigned int[], AlignedDelete>> Buffers;
+	// frame number last rendered into each buffer, 0 for none
+	std::vector<unsigned long long> Fences;
+	std::deque<QueuedFrame> Queue;
+	std::mutex Mutex;
+	std::condition_variable FramePresented;
+	std::condition_variable FrameQueued;
+
+	unsigned int NextBuffer = 0;
+	unsigned long long SubmittedFrames = 0;
+	unsigned long long CompletedFrames = 0;
+	bool Closed = false;
+	bool ShuttingDown = false;
+
+	// present latency, queued to presented, in seconds
+	double LastLatency = 0.0;
+	double TotalLatency = 0.0;
+	double MaxLatency = 0.0;
+};
@@ -0,0 +1,243 @@
+#include "TextureCompression.h"
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+
+static unsigned int Channel(unsigned int Texel, int Index)
+{
+	// 0 alpha, 1 red, 2 green, 3 blue
+	return (Texel >> (24 - 8 * Index)) & 0xff;
+}
+
+static unsigned int PackTexel(unsigned int A, unsigned int R, unsigned int G, unsigned int B)
+{
+	return (A << 24) | (R << 16) | (G << 8) | B;
+}
+
+static unsigned short To565(unsigned int R, unsigned int G, unsigned int B)
+{
+	unsigned int r = (R * 31 + 127) / 255;
+	unsigned int g = (G * 63 + 127) / 255;
+	unsigned int b = (B * 31 + 127) / 255;
+	return static_cast<unsigned short>((r << 11) | (g << 5) | b);
+}
+
+static unsigned int From565(unsigned short Color)
+{
+	unsigned int r = (Color >> 11) & 0x1f;
+	unsigned int g = (Color >> 5) & 0x3f;
+	unsigned int b = Color & 0x1f;
+	return PackTexel(255, (r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2));
+}
+
+static unsigned int Mix(unsigned int A, unsigned int B, unsigned int WeightA, unsigned int WeightB)
+{
+	unsigned int sum = WeightA + WeightB;
+	return (A * WeightA + B * WeightB + sum / 2) / sum;
+}
+
+// Palette of a color block, the encoder picks indices from the same palette the decoder rebuilds.
+// FourColors is false only for BC1 blocks with c0 <= c1, their last entry is transparent black.
+static void ColorPalette(unsigned short C0, unsigned short C1, bool FourColors, unsigned int Palette[4])
+{
+	Palette[0] = From565(C0);
+	Palette[1] = From565(C1);
+	unsigned int mixed[2][3];
+	for (int channel = 1; channel < 4; ++channel)
+	{
+		unsigned int a = Channel(Palette[0], channel), b = Channel(Palette[1], channel);
+		mixed[0][channel - 1] = FourColors ? Mix(a, b, 2, 1) : Mix(a, b, 1, 1);
+		mixed[1][channel - 1] = FourColors ? Mix(a, b, 1, 2) : 0;
+	}
+	Palette[2] = PackTexel(255, mixed[0][0], mixed[0][1], mixed[0][2]);
+	Palette[3] = FourColors ? PackTexel(255, mixed[1][0], mixed[1][1], mixed[1][2]) : 0;
+}
+
+static void AlphaPalette(unsigned int A0, unsigned int A1, unsigned int Palette[8])
+{
+	Palette[0] = A0;
+	Palette[1] = A1;
+	if (A0 > A1)
+	{
+		for (unsigned int i = 1; i < 7; ++i)
+		{
+			Palette[i + 1] = Mix(A0, A1, 7 - i, i);
+		}
+	}
+	else
+	{
+		for (unsigned int i = 1; i < 5; ++i)
+		{
+			Palette[i + 1] = Mix(A0, A1, 5 - i, i);
+		}
+		Palette[6] = 0;
+		Palette[7] = 255;
+	}
+}
+
+static int ColorDistance(unsigned int A, unsigned int B)
+{
+	int distance = 0;
+	for (int channel = 1; channel < 4; ++channel)
+	{
+		int d = static_cast<int>(Channel(A, channel)) - static_cast<int>(Channel(B, channel));
+		distance += d * d;
+	}
+	return distance;
+}
+
+// Bounding box fit: the end points are the corners of the box around the colors, inset by 1/16 to cut the error
+// at the extremes, and every texel takes the closest palette entry.
+static void EncodeColorBlock(const unsigned int Texels[16], bool Punchthrough, unsigned char *pBlock)
+{
+	unsigned int minColor[4] = {0, 255, 255, 255}, maxColor[4] = {0, 0, 0, 0};
+	bool transparent = false, opaque = false;
+	for (int i = 0; i < 16; ++i)
+	{
+		if (Punchthrough && Channel(Texels[i], 0) < 128)
+		{
+			transparent = true;
+			continue;
+		}
+		opaque = true;
+		for (int channel = 1; channel < 4; ++channel)
+		{
+			minColor[channel] = std::min(minColor[channel], Channel(Texels[i], channel));
+			maxColor[channel] = std::max(maxColor[channel], Channel(Texels[i], channel));
+		}
+	}
+
+	unsigned short c0 = 0, c1 = 0;
+	if (opaque)
+	{
+		for (int channel = 1; channel < 4; ++channel)
+		{
+			unsigned int inset = (maxColor[channel] - minColor[channel]) >> 4;
+			minColor[channel] += inset;
+			maxColor[channel] -= inset;
+		}
+		c0 = To565(maxColor[1], maxColor[2], maxColor[3]);
+		c1 = To565(minColor[1], minColor[2], minColor[3]);
+	}
+
+	// c0 > c1 selects four colors, c0 <= c1 three colors and transparent black
+	if (transparent ? c0 > c1 : c0 < c1)
+	{
+		std::swap(c0, c1);
+	}
+	bool fourColors = c0 > c1;
+
+	unsigned int palette[4];
+	ColorPalette(c0, c1, fourColors, palette);
+	int numColors = fourColors ? 4 : 3;
+
+	unsigned int indices = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		unsigned int index = 3;
+		if (!(Punchthrough && Channel(Texels[i], 0) < 128))
+		{
+			int bestDistance = INT_MAX;
+			for (int j = 0; j < numColors; ++j)
+			{
+				int distance = ColorDistance(Texels[i], palette[j]);
+				if (distance < bestDistance)
+				{
+					bestDistance = distance;
+					index = j;
+				}
+			}
+		}
+		indices |= index << (2 * i);
+	}
+
+	pBlock[0] = static_cast<unsigned char>(c0);
+	pBlock[1] = static_cast<unsigned char>(c0 >> 8);
+	pBlock[2] = static_cast<unsigned char>(c1);
+	pBlock[3] = static_cast<unsigned char>(c1 >> 8);
+	for (int i = 0; i < 4; ++i)
+	{
+		pBlock[4 + i] = static_cast<unsigned char>(indices >> (8 * i));
+	}
+}
+
+static void DecodeColorBlock(const unsigned char *pBlock, bool AllowPunchthrough, unsigned int Texels[16])
+{
+	unsigned short c0 = static_cast<unsigned short>(pBlock[0] | (pBlock[1] << 8));
+	unsigned short c1 = static_cast<unsigned short>(pBlock[2] | (pBlock[3] << 8));
+	unsigned int indices = pBlock[4] | (pBlock[5] << 8) | (pBlock[6] << 16) | (static_cast<unsigned int>(pBlock[7]) << 24);
+
+	unsigned int palette[4];
+	ColorPalette(c0, c1, !AllowPunchthrough || c0 > c1, palette);
+	for (int i = 0; i < 16; ++i)
+	{
+		Texels[i] = palette[(indices >> (2 * i)) & 3];
+	}
+}
+
+void EncodeBC1Block(const unsigned int Texels[16], unsigned char *pBlock)
+{
+	EncodeColorBlock(Texels, true, pBlock);
+}
+
+void DecodeBC1Block(const unsigned char *pBlock, unsigned int Texels[16])
+{
+	DecodeColorBlock(pBlock, true, Texels);
+}
+
+void EncodeBC3Block(const unsigned int Texels[16], unsigned char *pBlock)
+{
+	unsigned int minAlpha = 255, maxAlpha = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		minAlpha = std::min(minAlpha, Channel(Texels[i], 0));
+		maxAlpha = std::max(maxAlpha, Channel(Texels[i], 0));
+	}
+
+	// a0 > a1 gives eight interpolated alphas, a flat block only ever uses the first one
+	unsigned int palette[8];
+	AlphaPalette(maxAlpha, minAlpha, palette);
+	int numAlphas = maxAlpha > minAlpha ? 8 : 1;
+
+	unsigned long long indices = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		int alpha = static_cast<int>(Channel(Texels[i], 0));
+		int index = 0, bestDistance = INT_MAX;
+		for (int j = 0; j < numAlphas; ++j)
+		{
+			int distance = std::abs(alpha - static_cast<int>(palette[j]));
+			if (distance < bestDistance)
+			{
+				bestDistance = distance;
+				index = j;
+			}
+		}
+		indices |= static_cast<unsigned long long>(index) << (3 * i);
+	}
+
+	pBlock[0] = static_cast<unsigned char>(maxAlpha);
+	pBlock[1] = static_cast<unsigned char>(minAlpha);
+	for (int i = 0; i < 6; ++i)
+	{
+		pBlock[2 + i] = static_cast<unsigned char>(indices >> (8 * i));
+	}
+	EncodeColorBlock(Texels, false, pBlock + 8);
+}
+
+void DecodeBC3Block(const unsigned char *pBlock, unsigned int Texels[16])
+{
+	DecodeColorBlock(pBlock + 8, false, Texels);
+
+	unsigned int palette[8];
+	AlphaPalette(pBlock[0], pBlock[1], palette);
+	unsigned long long indices = 0;
+	for (int i = 0; i < 6; ++i)
+	{
+		indices |= static_cast<unsigned long long>(pBlock[2 + i]) << (8 * i);
+	}
+	for (int i = 0; i < 16; ++i)
+	{
+		Texels[i] = (Texels[i] & 0x00ffffff) | (palette[(indices >> (3 * i)) & 7] << 24);
+	}
+}
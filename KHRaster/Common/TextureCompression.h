@@ -0,0 +1,30 @@
+#pragma once
+
+///////////////////////////////////////////////////
+//	NoCompression	: 32 bit texels
+//	BC1				: 8 bytes per 4x4 block, RGB with 1 bit alpha
+//	BC3				: 16 bytes per 4x4 block, BC1 colors plus
+//					  8 bytes of interpolated alpha
+///////////////////////////////////////////////////
+enum TEXTURE_COMPRESSION
+{
+	NoCompression,
+	BC1,
+	BC3
+};
+
+// Size of a block in 32 bit units, as it is stored in a Texture2D<UINT>
+inline unsigned int GetBlockSize(TEXTURE_COMPRESSION Compression)
+{
+	return Compression == BC1 ? 2 : 4;
+}
+
+// Texels are ARGB8, see PixelFormat.h.
+// A block holds 16 texels in row major order.
+
+// Texels with alpha below 128 become transparent black, the others opaque
+void EncodeBC1Block(const unsigned int Texels[16], unsigned char *pBlock);
+void EncodeBC3Block(const unsigned int Texels[16], unsigned char *pBlock);
+
+void DecodeBC1Block(const unsigned char *pBlock, unsigned int Texels[16]);
+void DecodeBC3Block(const unsigned char *pBlock, unsigned int Texels[16]);
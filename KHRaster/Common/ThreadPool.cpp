@@ -0,0 +1,96 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(unsigned int NumThreads)
+{
+	// the calling thread counts as one of the threads
+	for (unsigned int i = 1; i < NumThreads; ++i)
+	{
+		Workers.emplace_back(&ThreadPool::WorkerLoop, this);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::unique_lock<std::mutex> lock(Mutex);
+		Exit = true;
+	}
+	WorkReady.notify_all();
+
+	for (auto &worker : Workers)
+	{
+		worker.join();
+	}
+}
+
+void ThreadPool::ParallelFor(unsigned int Count, const std::function<void(unsigned int)> &Task)
+{
+	if (Count == 0)
+	{
+		return;
+	}
+
+	// nothing to share, skip the wake up
+	if (Workers.empty() || Count == 1)
+	{
+		for (unsigned int i = 0; i < Count; ++i)
+		{
+			Task(i);
+		}
+		return;
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(Mutex);
+		pTask = &Task;
+		TaskCount = Count;
+		NextIndex = 0;
+		ActiveWorkers = static_cast<unsigned int>(Workers.size());
+		++Generation;
+	}
+	WorkReady.notify_all();
+
+	RunTasks();
+
+	// wait for every worker to leave the job before the task goes out of scope
+	std::unique_lock<std::mutex> lock(Mutex);
+	WorkDone.wait(lock, [&]()
+				  { return ActiveWorkers == 0; });
+	pTask = nullptr;
+}
+
+void ThreadPool::WorkerLoop()
+{
+	unsigned long long seenGeneration = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(Mutex);
+			WorkReady.wait(lock, [&]()
+						   { return Exit || Generation != seenGeneration; });
+			if (Exit)
+			{
+				return;
+			}
+			seenGeneration = Generation;
+		}
+
+		RunTasks();
+
+		{
+			std::unique_lock<std::mutex> lock(Mutex);
+			if (--ActiveWorkers == 0)
+			{
+				WorkDone.notify_one();
+			}
+		}
+	}
+}
+
+void ThreadPool::RunTasks()
+{
+	for (unsigned int i = NextIndex++; i < TaskCount; i = NextIndex++)
+	{
+		(*pTask)(i);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,42 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads that cooperatively run indexed jobs.
+// The calling thread always participates, so a pool of N threads spawns N - 1 workers.
+class ThreadPool
+{
+public:
+	explicit ThreadPool(unsigned int NumThreads);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	// Runs Task(Index) for every Index in [0, Count) and returns once all of them have finished.
+	// Indices are handed out dynamically, there is no guarantee on which thread runs which index.
+	void ParallelFor(unsigned int Count, const std::function<void(unsigned int)> &Task);
+
+	unsigned int GetNumThreads() const { return static_cast<unsigned int>(Workers.size()) + 1; }
+
+private:
+	void WorkerLoop();
+	void RunTasks();
+
+	std::vector<std::thread> Workers;
+	std::mutex Mutex;
+	std::condition_variable WorkReady;
+	std::condition_variable WorkDone;
+
+	// current job, only valid while Generation is advanced and ActiveWorkers > 0
+	const std::function<void(unsigned int)> *pTask = nullptr;
+	unsigned int TaskCount = 0;
+	std::atomic_uint NextIndex = 0;
+	unsigned int ActiveWorkers = 0;
+	unsigned long long Generation = 0;
+	bool Exit = false;
+};
\ No newline at end of file
@@ -1,13 +1,16 @@
 #include "XTime.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <math.h>
+#include <thread>
 
 XTime::XTime(unsigned char samples, double smoothFactor)
 {
 	// clear the structure and init basic values
-	ZeroMemory(&localStack, sizeof(THREAD_DATA));
-	localStack.numSamples = max(1, samples); // one sample is minimum
+	memset(&localStack, 0, sizeof(THREAD_DATA));
+	localStack.numSamples = std::max<unsigned char>(1, samples); // one sample is minimum
 	localStack.blendWeight = smoothFactor;
-	localStack.threadID = GetCurrentThreadId();
 	// Thread & frame rate measurements (used for throttling)
 	localStack.samplesPerSecond = localStack.lastSecond = 0;
 	localStack.actualHz = 0;
@@ -16,13 +19,13 @@ XTime::XTime(unsigned char samples, double smoothFactor)
 void XTime::Restart()
 {
 	// get processor frequency (length of each tick on this core)
-	QueryPerformanceFrequency(&localStack.frequency);
+	localStack.frequency = GetTimerFrequency();
 	// reset counters
 	localStack.deltaTime = localStack.totalTime =
 		localStack.smoothDelta = localStack.lastSecond = 0.0;
 	localStack.signalCount = localStack.elapsedSignals = 0;
 	// Track the start time
-	QueryPerformanceCounter(&localStack.start);
+	localStack.start = GetTimerTicks();
 	localStack.signals[localStack.signalCount++] = localStack.start;
 }
 double XTime::TotalTime()
@@ -31,36 +34,35 @@ double XTime::TotalTime()
 }
 double XTime::TotalTimeExact()
 {
-	LARGE_INTEGER now;
-	QueryPerformanceCounter(&now);									// what is the time right now?
-	LONGLONG elapsed = now.QuadPart - localStack.start.QuadPart;	// determine time elapsed since the start.
-	return double(elapsed) / double(localStack.frequency.QuadPart); // return in seconds
+	long long now = GetTimerTicks();						// what is the time right now?
+	long long elapsed = now - localStack.start;				// determine time elapsed since the start.
+	return double(elapsed) / double(localStack.frequency); // return in seconds
 }
 // Append to the signal buffer and compute resulting times
 void XTime::Signal()
 {
 	// make room for the new signal
-	memmove_s(localStack.signals + 1u, sizeof(LARGE_INTEGER) * 255, localStack.signals, sizeof(LARGE_INTEGER) * localStack.numSamples);
+	memmove(localStack.signals + 1u, localStack.signals, sizeof(long long) * localStack.numSamples);
 	// append to the front of signals and up the count (no more than the last index tho)
-	QueryPerformanceCounter(localStack.signals);
-	localStack.signalCount = min(localStack.signalCount + 1, 255);
+	localStack.signals[0] = GetTimerTicks();
+	localStack.signalCount = std::min(localStack.signalCount + 1, 255);
 	// with our signal buffer updated, we can now compute our timing values
-	localStack.totalTime = double((*localStack.signals).QuadPart - localStack.start.QuadPart) / double(localStack.frequency.QuadPart);
-	localStack.deltaTime = double(localStack.signals[0].QuadPart - localStack.signals[1].QuadPart) / double(localStack.frequency.QuadPart);
+	localStack.totalTime = double(localStack.signals[0] - localStack.start) / double(localStack.frequency);
+	localStack.deltaTime = double(localStack.signals[0] - localStack.signals[1]) / double(localStack.frequency);
 	// with our signal buffer updated we can compute our weighted average for a smoother delta curve.
 	double totalWeight = 0, runningWeight = 1;
-	LONGLONG totalValue = 0, sampleDelta;
+	long long totalValue = 0, sampleDelta;
 	// loop up to num samples or as many as we have available
-	for (unsigned char i = 0; i < min(localStack.numSamples, localStack.signalCount - 1); ++i)
+	for (unsigned char i = 0; i < std::min<int>(localStack.numSamples, localStack.signalCount - 1); ++i)
 	{
 		// determine each delta as we go
-		sampleDelta = localStack.signals[i].QuadPart - localStack.signals[i + 1].QuadPart;
-		totalValue += LONGLONG(sampleDelta * runningWeight); // this cast is expensive, need to look into optimizing
+		sampleDelta = localStack.signals[i] - localStack.signals[i + 1];
+		totalValue += (long long)(sampleDelta * runningWeight); // this cast is expensive, need to look into optimizing
 		totalWeight += runningWeight;						 // tally all the weights used
 		runningWeight *= localStack.blendWeight;			 // adjust the weight of next delta
 	}
 	// with our totals calculated, determine the weighted average.
-	localStack.smoothDelta = (totalValue / totalWeight) / double(localStack.frequency.QuadPart);
+	localStack.smoothDelta = (totalValue / totalWeight) / double(localStack.frequency);
 
 	++localStack.actualHz;
 
@@ -95,6 +97,6 @@ void XTime::Throttle(double targetHz)
 		// if we are going too fast slow down
 		unsigned int slow = 0;
 		while (localStack.elapsedSignals / (TotalTimeExact() - localStack.lastSecond) > targetHz)
-			Sleep(slow++);
+			std::this_thread::sleep_for(std::chrono::milliseconds(slow++));
 	}
 }
\ No newline at end of file
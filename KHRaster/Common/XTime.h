@@ -1,14 +1,14 @@
 #pragma once		 // microsoft include guard for visual studio.
-#include "Windows.h" // needed for timer ops
+#include "Platform.h" // needed for timer ops
 class XTime
 {
 	// per thread timing data
 	struct THREAD_DATA
 	{
-		LARGE_INTEGER signals[256], frequency, start;
+		long long signals[256], frequency, start;
 		double totalTime, deltaTime, smoothDelta, blendWeight;
 		double samplesPerSecond, lastSecond, actualHz;
-		unsigned int threadID, elapsedSignals;
+		unsigned int elapsedSignals;
 		unsigned char signalCount, numSamples;
 	} localStack; // instance of timing data on this thread
 
@@ -38,7 +38,7 @@ public:
 	double SamplesPerSecond();
 	// Use the "targetHz" parameter to enable thread throttling.
 	// By default, thread throttling is not enabled "0". However by specifying a non-zero targetHz,
-	// the Throttle function will attempt to gradually adjust the threads speed to match the target Hz by calling "Sleep".
+	// the Throttle function will attempt to gradually adjust the threads speed to match the target Hz by sleeping.
 	// this function is best called once per frame per thread just like "Signal"
 	// ************************************* IMPORTANT *****************************************************************
 	// By default the fidelity of the thread scheduler is 15.6ms in windows.
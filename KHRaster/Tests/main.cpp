@@ -0,0 +1,236 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <Common/Defines.h>
+#include <Common/Shaders.h>
+#include <Common/Rasterizer.h>
+
+// Texture data of the samples
+#include "../05_TexturedCube/celestial.h"
+#include "../05_TexturedCube/CatMarioModel Death.h"
+
+// Regression checks run by ctest, each one is registered under its name. They print what failed and return false.
+
+static int Channel(UINT Texel, int Index)
+{
+	return static_cast<int>((Texel >> (8 * Index)) & 0xff);
+}
+
+static void RoundTripBlock(const UINT Texels[16], TEXTURE_COMPRESSION Compression, UINT Decoded[16])
+{
+	BYTE block[16];
+	if (Compression == BC1)
+	{
+		EncodeBC1Block(Texels, block);
+		DecodeBC1Block(block, Decoded);
+	}
+	else
+	{
+		EncodeBC3Block(Texels, block);
+		DecodeBC3Block(block, Decoded);
+	}
+}
+
+// A block of one color only loses what its 565 end points can't hold: 4 on red and blue, 2 on green.
+// BC3 keeps a flat alpha exactly.
+static bool CheckBCFlatBlocks()
+{
+	// blue, green, red, alpha
+	const int bounds[4] = {4, 2, 4, 0};
+	bool passed = true;
+	for (TEXTURE_COMPRESSION compression : {BC1, BC3})
+	{
+		for (UINT value = 0; value < 256; ++value)
+		{
+			UINT alpha = compression == BC1 ? 0xff : value;
+			UINT colors[] = {(alpha << 24) | value * 0x010101, (alpha << 24) | (value << 16) | ((255 - value) << 8) | (value / 2)};
+			for (UINT color : colors)
+			{
+				UINT texels[16], decoded[16];
+				std::fill(texels, texels + 16, color);
+				RoundTripBlock(texels, compression, decoded);
+				for (int c = 0; c < 4; ++c)
+				{
+					if (std::abs(Channel(decoded[0], c) - Channel(color, c)) > bounds[c])
+					{
+						printf("BC%d flat block %08x decodes to %08x\n", compression == BC1 ? 1 : 3, color, decoded[0]);
+						passed = false;
+						break;
+					}
+				}
+			}
+		}
+	}
+	return passed;
+}
+
+// BC3 alpha is stored as an 8 step ramp between the lowest and highest alpha of the block, so each texel is at
+// most half a step, plus a rounding of the ramp, from its alpha.
+static bool CheckBC3AlphaRamp()
+{
+	bool passed = true;
+	srand(1);
+	for (int i = 0; i < 10000 && passed; ++i)
+	{
+		UINT texels[16], decoded[16];
+		int low = rand() % 256, high = low + rand() % (256 - low);
+		for (UINT &texel : texels)
+		{
+			texel = UINT(low + rand() % (high - low + 1)) << 24 | 0x808080;
+		}
+		texels[0] = UINT(low) << 24 | 0x808080;
+		texels[15] = UINT(high) << 24 | 0x808080;
+		RoundTripBlock(texels, BC3, decoded);
+
+		double bound = (high - low) / 14.0 + 1.0;
+		for (int j = 0; j < 16; ++j)
+		{
+			if (std::abs(Channel(decoded[j], 3) - Channel(texels[j], 3)) > bound)
+			{
+				printf("BC3 alpha %d in [%d, %d] decodes to %d\n", Channel(texels[j], 3), low, high, Channel(decoded[j], 3));
+				passed = false;
+				break;
+			}
+		}
+	}
+	return passed;
+}
+
+// Peak signal to noise ratio of every channel of the top level after a round trip through the codec, in dB.
+// Channels equal on every texel count as infinite.
+static void MeasureRoundTrip(const Texture2D<UINT> &Texture, TEXTURE_COMPRESSION Compression, double Psnr[4])
+{
+	TextureLevel<const UINT> level = Texture.GetLevel(0);
+	double squaredError[4] = {};
+	for (UINT by = 0; by < level.Height / 4; ++by)
+	{
+		for (UINT bx = 0; bx < level.Width / 4; ++bx)
+		{
+			UINT texels[16], decoded[16];
+			for (UINT i = 0; i < 16; ++i)
+			{
+				texels[i] = *level.Texel(bx * 4 + i % 4, by * 4 + i / 4);
+			}
+			RoundTripBlock(texels, Compression, decoded);
+			for (UINT i = 0; i < 16; ++i)
+			{
+				for (int c = 0; c < 4; ++c)
+				{
+					double error = Channel(decoded[i], c) - Channel(texels[i], c);
+					squaredError[c] += error * error;
+				}
+			}
+		}
+	}
+	for (int c = 0; c < 4; ++c)
+	{
+		double meanSquaredError = squaredError[c] / (level.Width * level.Height);
+		Psnr[c] = meanSquaredError > 0.0 ? 10.0 * log10(255.0 * 255.0 / meanSquaredError) : INFINITY;
+	}
+}
+
+// The sample textures through BC1 (celestial, opaque) and BC3 (CatMarioModel, cut out), the bounds are about 1 dB
+// under what the encoder reaches on them
+static bool CheckBCTextures()
+{
+	Texture2D<UINT> celestial(celestial_width, celestial_height, celestial_numlevels, celestial_leveloffsets, celestial_pixels, BGRA8);
+	Texture2D<UINT> catMario(CatMarioModel_Death_width, CatMarioModel_Death_height, CatMarioModel_Death_numlevels, CatMarioModel_Death_leveloffsets,
+							 CatMarioModel_Death_pixels, BGRA8);
+
+	struct
+	{
+		const char *pName;
+		const Texture2D<UINT> &Texture;
+		TEXTURE_COMPRESSION Compression;
+		// blue, green, red, alpha
+		double MinPsnr[4];
+	} const cases[] = {{"celestial BC1", celestial, BC1, {27.0, 30.0, 28.0, INFINITY}},
+					   {"CatMarioModel BC3", catMario, BC3, {35.0, 35.0, 35.0, 46.0}}};
+
+	bool passed = true;
+	for (const auto &test : cases)
+	{
+		double psnr[4];
+		MeasureRoundTrip(test.Texture, test.Compression, psnr);
+		for (int c = 0; c < 4; ++c)
+		{
+			if (!(psnr[c] >= test.MinPsnr[c]))
+			{
+				printf("%s: channel %d PSNR %.2f dB, expected at least %.2f dB\n", test.pName, c, psnr[c], test.MinPsnr[c]);
+				passed = false;
+			}
+		}
+	}
+	return passed;
+}
+
+// Draws an opaque triangle and an alpha blended one over it, once in place and once through the visibility buffer
+// with every thread. The deferred opaque pixels have to be shaded before the blend reads them, so both give the same image.
+static bool CheckDeferredBlending()
+{
+	const UINT Size = 64;
+	Vertex opaque[3] = {{{-0.9f, -0.9f, 0.5f, 1.0f}, 0xffff0000}, {{0.9f, -0.9f, 0.5f, 1.0f}, 0xffff0000}, {{0.0f, 0.9f, 0.5f, 1.0f}, 0xffff0000}};
+	Vertex blended[3] = {{{-0.9f, 0.9f, 0.25f, 1.0f}, 0x800000ff}, {{0.9f, 0.9f, 0.25f, 1.0f}, 0x800000ff}, {{0.0f, -0.9f, 0.25f, 1.0f}, 0x800000ff}};
+
+	std::vector<UINT> images[2];
+	for (int deferred = 0; deferred < 2; ++deferred)
+	{
+		RenderTarget target(Size, Size);
+		Rasterizer rasterizer(&target);
+		rasterizer.SetThreadCount(deferred ? std::thread::hardware_concurrency() : 0);
+		rasterizer.SetVisibilityBuffer(deferred);
+		target.Clear();
+		target.DepthEnable = TRUE;
+
+		rasterizer.FillTriangle(opaque[0], opaque[1], opaque[2]);
+		target.Blend = BlendState::AlphaBlend();
+		rasterizer.FillTriangle(blended[0], blended[1], blended[2]);
+		rasterizer.Flush();
+
+		images[deferred].assign(target.RT1.Pixels.get(), target.RT1.Pixels.get() + Size * Size);
+	}
+
+	if (images[0] != images[1])
+	{
+		printf("Blending over the visibility buffer does not match drawing in place\n");
+		return false;
+	}
+	return true;
+}
+
+static const struct
+{
+	const char *pName;
+	bool (*pRun)();
+} Checks[] = {{"BCFlatBlocks", CheckBCFlatBlocks},
+			  {"BC3AlphaRamp", CheckBC3AlphaRamp},
+			  {"BCTextures", CheckBCTextures},
+			  {"DeferredBlending", CheckDeferredBlending}};
+
+// Runs the check named by the first argument, or every one without it
+int main(int argc, char **argv)
+{
+	int ran = 0, failed = 0;
+	for (const auto &check : Checks)
+	{
+		if (argc > 1 && strcmp(argv[1], check.pName) != 0)
+		{
+			continue;
+		}
+		bool passed = check.pRun();
+		printf("%s: %s\n", check.pName, passed ? "passed" : "failed");
+		++ran;
+		failed += !passed;
+	}
+	if (ran == 0)
+	{
+		printf("No check named %s\n", argv[1]);
+		return 1;
+	}
+	return failed ? 1 : 0;
+}